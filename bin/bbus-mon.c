@@ -70,6 +70,7 @@ static const char* str_msgtype(unsigned char msgtype)
 	PRES_CASE_PROPVAL(BBUS_MSGTYPE_CLOSE);
 	PRES_CASE_PROPVAL(BBUS_MSGTYPE_CTRL);
 	PRES_CASE_PROPVAL(BBUS_MSGTYPE_MON);
+	PRES_CASE_PROPVAL(BBUS_MSGTYPE_CLIRESOLVE);
 	PRES_DEF_WRONGVAL;
 	}
 }
@@ -93,6 +94,8 @@ static const char* str_errcode(unsigned char errcode)
 	PRES_CASE_PROPVAL(BBUS_PROT_ENOMETHOD);
 	PRES_CASE_PROPVAL(BBUS_PROT_EMETHODERR);
 	PRES_CASE_PROPVAL(BBUS_PROT_EMREGERR);
+	PRES_CASE_PROPVAL(BBUS_PROT_ESTALEHANDLE);
+	PRES_CASE_PROPVAL(BBUS_PROT_ETIMEDOUT);
 	PRES_DEF_WRONGVAL;
 	}
 }
@@ -19,6 +19,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <string.h>
+#include <pthread.h>
 #include "bbusd/log.h"
 #include "bbusd/common.h"
 #include "bbusd/service.h"
@@ -29,14 +30,80 @@
 #include "bbusd/callers.h"
 #include "bbusd/monitor.h"
 #include "bbusd/auth.h"
+#include "bbusd/lock.h"
+
+#define BBUSD_MAXWORKERS	256
+#define BBUSD_MAXMSGSPERPOLL	16
+#define BBUSD_DEFCALLTIMEOUT	30000
+#define BBUSD_POLLTIMEOUT	500000
+#define BBUSD_EXPIRETIMEOUT	10000
+
+struct worker
+{
+	pthread_t thread;
+	bbus_pollset* pollset;
+};
 
 static volatile int run;
+static struct worker* workers;
+static unsigned numworkers = 0;
+static size_t maxqueued = BBUS_CLIENT_DEFMAXQUEUED;
+static unsigned calltimeout = BBUSD_DEFCALLTIMEOUT;
 
 static void opt_setsockpath(const char* path)
 {
 	bbus_prot_setsockpath(path);
 }
 
+static void opt_setworkers(const char* arg)
+{
+	char* end;
+	unsigned long val;
+
+	val = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || val > BBUSD_MAXWORKERS)
+		bbusd_die("Invalid number of worker threads: '%s'\n", arg);
+
+	numworkers = (unsigned)val;
+}
+
+static void opt_setmaxqueued(const char* arg)
+{
+	char* end;
+	unsigned long val;
+
+	val = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || val < BBUS_MAXMSGSIZE)
+		bbusd_die("Invalid outbound queue size: '%s'\n", arg);
+
+	maxqueued = (size_t)val;
+}
+
+static void opt_setmaxpload(const char* arg)
+{
+	char* end;
+	unsigned long val;
+
+	val = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || val < BBUS_MAXPLOADSIZE
+						|| val > UINT32_MAX)
+		bbusd_die("Invalid maximum payload size: '%s'\n", arg);
+
+	bbus_prot_setmaxpload((size_t)val);
+}
+
+static void opt_setcalltimeout(const char* arg)
+{
+	char* end;
+	unsigned long val;
+
+	val = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || val > UINT32_MAX)
+		bbusd_die("Invalid call timeout: '%s'\n", arg);
+
+	calltimeout = (unsigned)val;
+}
+
 static struct bbus_option cmdopts[] = {
 	{
 		.shortopt = 0,
@@ -45,6 +112,45 @@ static struct bbus_option cmdopts[] = {
 		.action = BBUS_OPTACT_CALLFUNC,
 		.actdata = &opt_setsockpath,
 		.descr = "path to the busybus socket",
+	},
+	{
+		.shortopt = 0,
+		.longopt = "workers",
+		.hasarg = BBUS_OPT_ARGREQ,
+		.action = BBUS_OPTACT_CALLFUNC,
+		.actdata = &opt_setworkers,
+		.descr = "number of worker threads handling client "
+			 "connections, if 0 (default) everything is "
+			 "handled in the main thread",
+	},
+	{
+		.shortopt = 0,
+		.longopt = "max-queue",
+		.hasarg = BBUS_OPT_ARGREQ,
+		.action = BBUS_OPTACT_CALLFUNC,
+		.actdata = &opt_setmaxqueued,
+		.descr = "max number of bytes queued for a single client, "
+			 "when exceeded messages for monitors are dropped "
+			 "and other clients are disconnected",
+	},
+	{
+		.shortopt = 0,
+		.longopt = "max-payload",
+		.hasarg = BBUS_OPT_ARGREQ,
+		.action = BBUS_OPTACT_CALLFUNC,
+		.actdata = &opt_setmaxpload,
+		.descr = "max payload size of a single message in bytes, "
+			 "clients sending bigger messages are disconnected",
+	},
+	{
+		.shortopt = 0,
+		.longopt = "call-timeout",
+		.hasarg = BBUS_OPT_ARGREQ,
+		.action = BBUS_OPTACT_CALLFUNC,
+		.actdata = &opt_setcalltimeout,
+		.descr = "milliseconds after which calls not replied to by "
+			 "services fail, unless set by the caller, "
+			 "0 disables the timeout (default: 30000)",
 	}
 };
 
@@ -94,13 +200,29 @@ static int send_message(bbus_client* cli, struct bbus_msg_hdr* hdr,
 {
 	int ret;
 
-	ret = bbus_client_sendmsg(cli, hdr, meta, obj);
+	ret = bbusd_client_sendmsg(cli, hdr, meta, obj);
 	if (ret == 0)
 		bbusd_mon_notify_sent(hdr, meta, obj);
 
 	return ret;
 }
 
+/*
+ * Same as send_message(), but passes on the marshalled object data straight
+ * from the receive buffer.
+ */
+static int forward_message(bbus_client* cli, struct bbus_msg_hdr* hdr,
+			char* meta, const void* obj, size_t objsize)
+{
+	int ret;
+
+	ret = bbusd_client_sendraw(cli, hdr, meta, obj, objsize);
+	if (ret == 0)
+		bbusd_mon_notify_sent(hdr, meta, NULL);
+
+	return ret;
+}
+
 static int handle_clientcall(bbus_client* cli, struct bbus_msg* msg)
 {
 	struct bbusd_method* mthd;
@@ -109,27 +231,52 @@ static int handle_clientcall(bbus_client* cli, struct bbus_msg* msg)
 	bbus_object* argobj = NULL;
 	bbus_object* retobj = NULL;
 	struct bbus_msg_hdr hdr;
+	const void* rawarg;
+	size_t argsize;
 	char* meta;
-
-	mname = bbus_prot_extractmeta(msg);
-	if (mname == NULL)
-		return -1;
+	struct bbusd_call call;
+	struct bbusd_remote_method* rmthd;
+	unsigned callid;
+	unsigned timeout;
 
 	memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
-	mthd = bbusd_locate_method(mname);
-	if (mthd == NULL) {
-		bbusd_logmsg(BBUSD_LOG_ERR, "No such method: %s\n", mname);
-		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
-					BBUS_PROT_ENOMETHOD);
-		ret = -1;
-		goto respond;
-	}
+	if (BBUS_HDR_ISFLAGSET(&msg->hdr, BBUS_PROT_METHODHANDLE)) {
+		mthd = bbusd_method_byhandle(bbus_hdr_gettoken(&msg->hdr),
+								&mname);
+		if (mthd == NULL) {
+			bbusd_logmsg(BBUSD_LOG_ERR,
+				"Stale method handle: 0x%08x\n",
+				bbus_hdr_gettoken(&msg->hdr));
+			bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
+						BBUS_PROT_ESTALEHANDLE);
+			goto respond;
+		}
+	} else {
+		mname = bbus_prot_extractmeta(msg);
+		if (mname == NULL)
+			return -1;
 
-	argobj = bbus_prot_extractobj(msg);
-	if (argobj == NULL)
-		return -1;
+		mthd = bbusd_locate_method(mname);
+		if (mthd == NULL) {
+			bbusd_logmsg(BBUSD_LOG_ERR,
+				"No such method: %s\n", mname);
+			bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
+						BBUS_PROT_ENOMETHOD);
+			goto respond;
+		}
+	}
 
 	if (mthd->type == BBUSD_METHOD_LOCAL) {
+		rawarg = bbus_prot_rawobj(msg, &argsize);
+		if (rawarg == NULL)
+			return -1;
+
+		/* Local methods only read the argument. */
+		argobj = bbus_obj_arena_alloc(bbusd_getarena());
+		if (argobj == NULL)
+			return -1;
+		bbus_obj_setview(argobj, rawarg, argsize);
+
 		retobj = ((struct bbusd_local_method*)mthd)->func(argobj);
 		if (retobj == NULL) {
 			bbusd_logmsg(BBUSD_LOG_ERR, "Error calling method.\n");
@@ -145,23 +292,40 @@ static int handle_clientcall(bbus_client* cli, struct bbus_msg* msg)
 		goto respond;
 	} else
 	if (mthd->type == BBUSD_METHOD_REMOTE) {
+		/* The argument is passed on without unmarshalling. */
+		rawarg = bbus_prot_rawobj(msg, &argsize);
+		if (rawarg == NULL)
+			return -1;
+
 		meta = mname_from_srvcname(mname);
 		if (meta == NULL) {
 			bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
 					BBUS_PROT_EMETHODERR);
 			goto respond;
 		}
+		/* Each forwarded call is tracked until the service replies. */
+		rmthd = (struct bbusd_remote_method*)mthd;
+		timeout = BBUS_HDR_ISFLAGSET(&msg->hdr, BBUS_PROT_HASTIMEOUT)
+				? bbus_hdr_gettimeout(&msg->hdr) : calltimeout;
+		callid = bbusd_new_call(bbus_client_gettoken(cli),
+					&msg->hdr, rmthd->srvc, timeout);
+		if (callid == BBUSD_NOCALL) {
+			bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
+					BBUS_PROT_EMETHODERR);
+			goto respond;
+		}
+
 		bbus_hdr_build(&hdr, BBUS_MSGTYPE_SRVCALL, BBUS_PROT_EGOOD);
 		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
 		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
-		bbus_hdr_setpsize(&hdr, (uint16_t)(strlen(meta) + 1
-						+ bbus_obj_rawsize(argobj)));
-		bbus_hdr_settoken(&hdr, bbus_client_gettoken(cli));
+		bbus_hdr_setpsize(&hdr, strlen(meta) + 1 + argsize);
+		bbus_hdr_settoken(&hdr, callid);
 
-		ret = send_message(
-				((struct bbusd_remote_method*)mthd)->srvc->cli,
-				&hdr, meta, argobj);
+		ret = forward_message(rmthd->srvc->cli,
+					&hdr, meta, rawarg, argsize);
 		if (ret < 0) {
+			(void)bbusd_take_call(callid,
+						rmthd->srvc->cli, &call);
 			bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
 					BBUS_PROT_EMETHODERR);
 			BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
@@ -174,6 +338,10 @@ static int handle_clientcall(bbus_client* cli, struct bbus_msg* msg)
 	goto dontrespond;
 
 respond:
+	/* Replies to asynchronous calls carry the caller's call id. */
+	if (BBUS_HDR_ISFLAGSET(&msg->hdr, BBUS_PROT_HASCALLID))
+		bbus_hdr_setcallid(&hdr, bbus_hdr_getcallid(&msg->hdr));
+
 	ret = send_message(cli, &hdr, NULL, retobj);
 	if (ret < 0) {
 		bbusd_logmsg(BBUSD_LOG_ERR,
@@ -189,6 +357,39 @@ dontrespond:
 	return ret;
 }
 
+static int resolve_method(bbus_client* cli, struct bbus_msg* msg)
+{
+	const char* mname;
+	bbus_method_handle handle;
+	struct bbus_msg_hdr hdr;
+	int ret;
+
+	mname = bbus_prot_extractmeta(msg);
+	if (mname == NULL)
+		return -1;
+
+	memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
+	handle = bbusd_method_gethandle(mname);
+	if (handle == BBUS_METHOD_NOHANDLE) {
+		bbusd_logmsg(BBUSD_LOG_ERR, "No such method: %s\n", mname);
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY,
+					BBUS_PROT_ENOMETHOD);
+	} else {
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY, BBUS_PROT_EGOOD);
+		bbus_hdr_settoken(&hdr, handle);
+	}
+
+	ret = send_message(cli, &hdr, NULL, NULL);
+	if (ret < 0) {
+		bbusd_logmsg(BBUSD_LOG_ERR,
+				"Error sending reply to client: %s\n",
+				bbus_strerror(bbus_lasterror()));
+		ret = -1;
+	}
+
+	return ret;
+}
+
 static int register_service(struct bbusd_clientlist_elem* cli,
 						struct bbus_msg* msg)
 {
@@ -225,7 +426,7 @@ static int register_service(struct bbusd_clientlist_elem* cli,
 		goto metafree;
 	}
 
-	mthd = bbus_malloc0(sizeof(struct bbusd_remote_method));
+	mthd = bbusd_alloc_remote_method();
 	if (mthd == NULL) {
 		ret = -1;
 		goto pathfree;
@@ -246,7 +447,7 @@ static int register_service(struct bbusd_clientlist_elem* cli,
 	}
 
 mthdfree:
-	bbus_free(mthd);
+	bbusd_free_remote_method(mthd);
 
 pathfree:
 	bbus_str_free(path);
@@ -280,20 +481,35 @@ static int handle_control_message(bbus_client* cli BBUS_UNUSED,
 	return 0;
 }
 
-static int pass_srvc_reply(bbus_client* srvc BBUS_UNUSED, struct bbus_msg* msg)
+static int pass_srvc_reply(bbus_client* srvc, struct bbus_msg* msg)
 {
 	struct bbus_msg_hdr hdr;
 	struct bbusd_clientlist_elem* cli;
-	bbus_object* obj;
+	struct bbusd_call call;
+	const void* obj;
+	size_t objsize = 0;
 	int ret;
 
-	cli = bbusd_get_caller(bbus_hdr_gettoken(&msg->hdr));
+	ret = bbusd_take_call(bbus_hdr_gettoken(&msg->hdr), srvc, &call);
+	if (ret < 0) {
+		/*
+		 * Most likely the call has already timed out. Replies with
+		 * ids of calls forwarded to other services end up here too
+		 * and leave those calls alone.
+		 */
+		bbusd_logmsg(BBUSD_LOG_WARN,
+			"Reply to an unknown call received - discarding.\n");
+		return 0;
+	}
+
+	/* The caller may have disconnected in the meantime. */
+	cli = bbusd_get_caller(call.caller);
 	if (cli == NULL) {
 		bbusd_logmsg(BBUSD_LOG_ERR, "Caller not found for reply.\n");
 		return -1;
 	}
 
-	obj = bbus_prot_extractobj(msg);
+	obj = bbus_prot_rawobj(msg, &objsize);
 	if (obj == NULL) {
 		bbusd_logmsg(BBUSD_LOG_ERR,
 			"Error extracting the object from message: %s\n",
@@ -305,10 +521,13 @@ static int pass_srvc_reply(bbus_client* srvc BBUS_UNUSED, struct bbus_msg* msg)
 
 	bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY, BBUS_PROT_EGOOD);
 	BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
-	bbus_hdr_setpsize(&hdr, bbus_obj_rawsize(obj));
+	bbus_hdr_setpsize(&hdr, objsize);
 
 respond:
-	ret = send_message(cli->cli, &hdr, NULL, obj);
+	if (call.hascallid)
+		bbus_hdr_setcallid(&hdr, call.callid);
+
+	ret = forward_message(cli->cli, &hdr, NULL, obj, objsize);
 	if (ret < 0) {
 		bbusd_logmsg(BBUSD_LOG_ERR,
 			"Error sending server reply to client: %s\n",
@@ -316,18 +535,59 @@ respond:
 		ret = -1;
 	}
 
-	bbus_obj_free(obj);
 	return ret;
 }
 
+static void reply_call_error(const struct bbusd_call* call, int errcode)
+{
+	struct bbusd_clientlist_elem* cli;
+	struct bbus_msg_hdr hdr;
+
+	cli = bbusd_get_caller(call->caller);
+	if (cli == NULL)
+		return;
+
+	bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY, errcode);
+	if (call->hascallid)
+		bbus_hdr_setcallid(&hdr, call->callid);
+
+	if (send_message(cli->cli, &hdr, NULL, NULL) < 0) {
+		bbusd_logmsg(BBUSD_LOG_ERR,
+			"Error sending reply to client: %s\n",
+			bbus_strerror(bbus_lasterror()));
+	}
+}
+
+/*
+ * Tells the caller its call won't be replied to, because the service
+ * providing the method disconnected.
+ */
+static void fail_call(const struct bbusd_call* call)
+{
+	reply_call_error(call, BBUS_PROT_EMETHODERR);
+}
+
+static void expire_call(const struct bbusd_call* call)
+{
+	bbusd_logmsg(BBUSD_LOG_WARN, "Method call timed out.\n");
+	reply_call_error(call, BBUS_PROT_ETIMEDOUT);
+}
+
+/*
+ * Must be called with the lock held for writing. Tokens identify caller
+ * connections, after wrapping around those still in use are skipped.
+ */
 static unsigned make_token(void)
 {
 	static unsigned curtok = 0;
 
-	if (curtok == UINT_MAX)
-		curtok = 0;
+	do {
+		if (curtok == UINT_MAX)
+			curtok = 0;
+		++curtok;
+	} while (bbusd_get_caller(curtok) != NULL);
 
-	return ++curtok;
+	return curtok;
 }
 
 static int client_auth(const struct bbus_client_cred* cred)
@@ -353,14 +613,54 @@ static struct bbus_accept_callbacks accept_funcs = {
 	.sent = accept_msg_sent,
 };
 
-static void accept_client(bbus_server* server)
+/*
+ * Removes the client from all lists and closes the connection.
+ */
+static void drop_client(bbus_pollset* pollset,
+				struct bbusd_clientlist_elem* cli_elem)
+{
+	bbus_client* cli;
+
+	cli = cli_elem->cli;
+
+	bbusd_wrlock();
+	if (pollset != NULL)
+		(void)bbus_pollset_rmcli(pollset, cli);
+	switch (bbus_client_gettype(cli)) {
+	case BBUS_CLIENT_CALLER:
+		bbusd_rm_caller(bbus_client_gettoken(cli));
+		break;
+	case BBUS_CLIENT_MON:
+		bbusd_monlist_rm(cli);
+		break;
+	case BBUS_CLIENT_SERVICE:
+		bbusd_remove_srvc_methods(cli_elem);
+		bbusd_fail_srvc_calls(cli_elem, fail_call);
+		break;
+	default:
+		break;
+	}
+	bbusd_clientlist_rm(&cli_elem);
+	bbusd_unlock();
+
+	/* Nobody can reference this client anymore. */
+	bbus_client_close(cli);
+	bbus_client_free(cli);
+}
+
+static void accept_client(bbus_server* server, bbus_pollset* pollset)
 {
 	bbus_client* cli;
+	struct bbusd_clientlist_elem* cli_elem;
 	int r;
 	unsigned token;
 
+	/* The accept callbacks notify the monitors. */
+	bbusd_rdlock();
 	/* TODO Client credentials verification. */
 	cli = bbus_srv_accept(server, &accept_funcs);
+	bbusd_unlock();
+	bbusd_resetarena();
 	if (cli == NULL) {
 		bbusd_logmsg(BBUSD_LOG_ERR,
 			"Error accepting incoming client "
@@ -370,21 +670,28 @@ static void accept_client(bbus_server* server)
 	}
 	bbusd_logmsg(BBUSD_LOG_INFO, "Client '%s' connected.\n",
 					bbus_client_getname(cli));
+	bbus_client_setmaxqueued(cli, maxqueued);
 
+	bbusd_wrlock();
 	r = bbusd_clientlist_add(cli);
 	if (r < 0) {
+		bbusd_unlock();
 		bbusd_logmsg(BBUSD_LOG_ERR,
 			"Error adding new client to the list: %s\n",
 			bbus_strerror(bbus_lasterror()));
+		bbus_client_close(cli);
+		bbus_client_free(cli);
 		return;
 	}
+	/* This client is the list's tail at this point. */
+	cli_elem = bbusd_clientlist_getlast();
+	bbus_client_setpriv(cli, cli_elem);
 
 	switch (bbus_client_gettype(cli)) {
 	case BBUS_CLIENT_CALLER:
 		token = make_token();
 		bbus_client_settoken(cli, token);
-		/* This client is the list's tail at this point. */
-		r = bbusd_add_caller(token, bbusd_clientlist_getlast());
+		r = bbusd_add_caller(token, cli_elem);
 		if (r < 0) {
 			bbusd_logmsg(BBUSD_LOG_ERR,
 				"Error adding new client to "
@@ -399,7 +706,6 @@ static void accept_client(bbus_server* server)
 				"Error adding new monitor to "
 				"the list: %s\n",
 				bbus_strerror(bbus_lasterror()));
-			return;
 		}
 		break;
 	case BBUS_CLIENT_SERVICE:
@@ -412,41 +718,51 @@ static void accept_client(bbus_server* server)
 	default:
 		break;
 	}
+	bbusd_unlock();
+
+	/* From now on the client can be handled by its worker thread. */
+	r = bbus_pollset_addcli(pollset, cli);
+	if (r < 0) {
+		bbusd_logmsg(BBUSD_LOG_ERR,
+			"Error adding new client to the pollset: %s\n",
+			bbus_strerror(bbus_lasterror()));
+		drop_client(NULL, cli_elem);
+	}
 }
 
 /*
  * Returns -1 if client connection shall be closed after the function call,
- * and 0 if it must be kept active.
+ * and 0 if it must be kept active. Must be called with the daemon lock held.
  */
-static int handle_client(struct bbusd_clientlist_elem* cli_elem)
+static int dispatch_message(struct bbusd_clientlist_elem* cli_elem,
+						struct bbus_msg* msg)
 {
 	bbus_client* cli;
 	int r;
 
 	cli = cli_elem->cli;
-	bbusd_zeromsgbuf();
-	r = bbus_client_rcvmsg(cli, bbusd_getmsgbuf(), bbusd_msgbufsize());
-	if (r < 0) {
-		bbusd_logmsg(BBUSD_LOG_ERR,
-			"Error receiving message from client: %s\n",
-			bbus_strerror(bbus_lasterror()));
-		goto cli_close;
-	}
-
-	bbusd_mon_notify_recvd(bbusd_getmsgbuf());
+	bbusd_mon_notify_recvd(msg);
 
 	/* TODO Common function for error reporting. */
 	switch (bbus_client_gettype(cli)) {
 	case BBUS_CLIENT_CALLER:
-		switch (bbusd_getmsgbuf()->hdr.msgtype) {
+		switch (msg->hdr.msgtype) {
 		case BBUS_MSGTYPE_CLICALL:
-			r = handle_clientcall(cli, bbusd_getmsgbuf());
+			r = handle_clientcall(cli, msg);
 			if (r < 0) {
 				bbusd_logmsg(BBUSD_LOG_ERR,
 					"Error on client call\n");
 				goto cli_close;
 			}
 			break;
+		case BBUS_MSGTYPE_CLIRESOLVE:
+			r = resolve_method(cli, msg);
+			if (r < 0) {
+				bbusd_logmsg(BBUSD_LOG_ERR,
+					"Error resolving a method\n");
+				goto cli_close;
+			}
+			break;
 		case BBUS_MSGTYPE_CLOSE:
 			goto cli_close;
 			break;
@@ -458,9 +774,9 @@ static int handle_client(struct bbusd_clientlist_elem* cli_elem)
 		}
 		break;
 	case BBUS_CLIENT_SERVICE:
-		switch (bbusd_getmsgbuf()->hdr.msgtype) {
+		switch (msg->hdr.msgtype) {
 		case BBUS_MSGTYPE_SRVREG:
-			r = register_service(cli_elem, bbusd_getmsgbuf());
+			r = register_service(cli_elem, msg);
 			if (r < 0) {
 				bbusd_logmsg(BBUSD_LOG_ERR,
 					"Error registering a service\n");
@@ -468,7 +784,7 @@ static int handle_client(struct bbusd_clientlist_elem* cli_elem)
 			}
 			break;
 		case BBUS_MSGTYPE_SRVUNREG:
-			r = unregister_service(cli, bbusd_getmsgbuf());
+			r = unregister_service(cli, msg);
 			if (r < 0) {
 				bbusd_logmsg(BBUSD_LOG_ERR,
 					"Error unregistering a service: %s\n",
@@ -477,7 +793,7 @@ static int handle_client(struct bbusd_clientlist_elem* cli_elem)
 			}
 			break;
 		case BBUS_MSGTYPE_SRVREPLY:
-			r = pass_srvc_reply(cli, bbusd_getmsgbuf());
+			r = pass_srvc_reply(cli, msg);
 			if (r < 0) {
 				bbusd_logmsg(BBUSD_LOG_ERR,
 					"Error passing a service reply: %s\n",
@@ -496,9 +812,9 @@ static int handle_client(struct bbusd_clientlist_elem* cli_elem)
 		}
 		break;
 	case BBUS_CLIENT_CTL:
-		switch (bbusd_getmsgbuf()->hdr.msgtype) {
+		switch (msg->hdr.msgtype) {
 		case BBUS_MSGTYPE_CTRL:
-			handle_control_message(cli, bbusd_getmsgbuf());
+			handle_control_message(cli, msg);
 			break;
 		case BBUS_MSGTYPE_CLOSE:
 			goto cli_close;
@@ -510,9 +826,8 @@ static int handle_client(struct bbusd_clientlist_elem* cli_elem)
 		}
 		break;
 	case BBUS_CLIENT_MON:
-		switch (bbusd_getmsgbuf()->hdr.msgtype) {
+		switch (msg->hdr.msgtype) {
 		case BBUS_MSGTYPE_CLOSE:
-			bbusd_monlist_rm(cli);
 			goto cli_close;
 			break;
 		default:
@@ -536,75 +851,273 @@ cli_close:
 	return -1;
 }
 
-static void poll_and_handle_inbound_traffic(bbus_server* server,
-						bbus_pollset* pollset)
+/*
+ * Messages sent with the lock held are only queued and get written once it's
+ * about to be released - until then none of the recipients can be removed.
+ */
+static void lock_and_cork(int write)
+{
+	if (write)
+		bbusd_wrlock();
+	else
+		bbusd_rdlock();
+	bbus_client_cork();
+}
+
+static void uncork_and_unlock(void)
+{
+	bbus_client_uncork();
+	bbusd_unlock();
+}
+
+/*
+ * Must be called with the lock held for reading.
+ *
+ * Handles all messages, that can be received from the client without
+ * blocking. To stay fair to the other clients the socket isn't read
+ * anymore after BBUSD_MAXMSGSPERPOLL messages, but whatever has already
+ * been buffered must be handled - it won't make the socket readable.
+ */
+static int do_handle_client(struct bbusd_clientlist_elem* cli_elem)
+{
+	struct bbus_msg* msg;
+	unsigned i;
+	int r;
+
+	for (i = 0; i < BBUSD_MAXMSGSPERPOLL
+			|| bbus_client_rcvpending(cli_elem->cli); ++i) {
+		r = bbus_client_tryrcvmsg(cli_elem->cli, bbusd_getmsgbuf(),
+						bbusd_msgbufsize());
+		if (r < 0) {
+			bbusd_logmsg(BBUSD_LOG_ERR,
+				"Error receiving message from client: %s\n",
+				bbus_strerror(bbus_lasterror()));
+			return -1;
+		} else
+		if (r == 0) {
+			/* Nothing more to read until the next poll. */
+			break;
+		}
+
+		msg = *bbusd_getmsgbuf();
+		/* Only (un)registering services modifies the service tree. */
+		if (msg->hdr.msgtype == BBUS_MSGTYPE_SRVREG
+				|| msg->hdr.msgtype == BBUS_MSGTYPE_SRVUNREG) {
+			uncork_and_unlock();
+			lock_and_cork(1);
+			r = dispatch_message(cli_elem, msg);
+			uncork_and_unlock();
+			lock_and_cork(0);
+		} else {
+			r = dispatch_message(cli_elem, msg);
+		}
+		if (r < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int handle_client(struct bbusd_clientlist_elem* cli_elem)
+{
+	int r;
+
+	r = do_handle_client(cli_elem);
+	/* Everything sent has been copied to the outbound queues by now. */
+	bbusd_resetarena();
+
+	return r;
+}
+
+static void handle_ready_clients(bbus_pollset* pollset)
+{
+	bbus_client* cli;
+	int ret;
+
+	/* Replies for all ready clients are sent in one go at the end. */
+	lock_and_cork(0);
+	while ((cli = bbus_pollset_nextcli(pollset)) != NULL) {
+		ret = handle_client(bbus_client_getpriv(cli));
+		if (ret < 0) {
+			uncork_and_unlock();
+			drop_client(pollset, bbus_client_getpriv(cli));
+			bbusd_logmsg(BBUSD_LOG_INFO,
+					"Client disconnected.\n");
+			lock_and_cork(0);
+		}
+	}
+	uncork_and_unlock();
+}
+
+/*
+ * Returns the number of ready objects in the pollset, 0 on timeout
+ * or if interrupted by a signal.
+ */
+static int do_poll(bbus_pollset* pollset, long usec)
 {
-	int retval;
-	int numclients;
-	struct bbusd_clientlist_elem* tmpcli;
-	struct bbusd_clientlist_elem* cli_rm;
 	struct bbus_timeval tv;
+	int retval;
 
 	memset(&tv, 0, sizeof(struct bbus_timeval));
-	bbus_pollset_clear(pollset);
-	bbus_pollset_addsrv(pollset, server);
-	for (tmpcli = bbusd_clientlist_getfirst(); tmpcli != NULL;
-			tmpcli = tmpcli->next) {
-		bbus_pollset_addcli(pollset, tmpcli->cli);
-	}
 	tv.sec = 0;
-	tv.usec = 500000;
+	tv.usec = usec;
 	retval = bbus_poll(pollset, &tv);
 	if (retval < 0) {
 		if (bbus_lasterror() == BBUS_EPOLLINTR) {
-			return;
+			return 0;
 		} else {
 			bbusd_die("Error polling connections: %s",
 					bbus_strerror(bbus_lasterror()));
 		}
-	} else
-	if (retval == 0) {
-		/* Timeout. */
+	}
+
+	return retval;
+}
+
+/*
+ * Returns the number of calls, that can still time out. Every polling
+ * thread expires calls, so that those it forwarded itself are timed out
+ * without waiting for the others to wake up.
+ */
+static unsigned expire_calls(void)
+{
+	unsigned ret;
+
+	lock_and_cork(0);
+	ret = bbusd_expire_calls(expire_call);
+	uncork_and_unlock();
+	/* Monitor notifications about the errors sent live in the arena. */
+	bbusd_resetarena();
+
+	return ret;
+}
+
+/*
+ * Wake up often enough to time out the calls accurately.
+ */
+static long poll_timeout(unsigned numtimed)
+{
+	return numtimed > 0 ? BBUSD_EXPIRETIMEOUT : BBUSD_POLLTIMEOUT;
+}
+
+static void* worker_main(void* arg)
+{
+	struct worker* worker = arg;
+	unsigned numtimed = 0;
+
+	while (do_run()) {
+		if (do_poll(worker->pollset, poll_timeout(numtimed)) > 0)
+			handle_ready_clients(worker->pollset);
+		numtimed = expire_calls();
+	}
+
+	bbusd_freemsgbuf();
+	return NULL;
+}
+
+static void start_workers(void)
+{
+	unsigned i;
+	int ret;
+
+	if (numworkers == 0)
 		return;
-	} else {
-		/* Incoming data. */
-		numclients = retval;
-		if (bbus_pollset_srvisset(pollset, server)) {
-			while (bbus_srv_clientpending(server)) {
-				accept_client(server);
-			}
-			--numclients;
+
+	workers = bbus_malloc0(numworkers * sizeof(struct worker));
+	if (workers == NULL) {
+		bbusd_die("Error allocating memory for worker threads: %s\n",
+			bbus_strerror(bbus_lasterror()));
+	}
+
+	for (i = 0; i < numworkers; ++i) {
+		workers[i].pollset = bbus_pollset_make();
+		if (workers[i].pollset == NULL) {
+			bbusd_die("Error creating the poll_set: %s\n",
+				bbus_strerror(bbus_lasterror()));
 		}
 
-		tmpcli = bbusd_clientlist_getfirst();
-		while (numclients > 0) {
-			retval = 0;
-			if (bbus_pollset_cliisset(pollset, tmpcli->cli)) {
-				retval = handle_client(tmpcli);
-				--numclients;
-			}
+		ret = pthread_create(&workers[i].thread, NULL,
+						worker_main, &workers[i]);
+		if (ret != 0) {
+			bbusd_die("Error starting worker thread: %s\n",
+							strerror(ret));
+		}
+	}
 
-			if (retval == 0) {
-				tmpcli = tmpcli->next;
-			} else {
-				bbus_client_close(tmpcli->cli);
-				bbus_client_free(tmpcli->cli);
-				cli_rm = tmpcli;
-				tmpcli = tmpcli->next;
-				bbusd_clientlist_rm(&cli_rm);
-				bbusd_logmsg(BBUSD_LOG_INFO,
-						"Client disconnected.\n");
-			}
+	bbusd_logmsg(BBUSD_LOG_INFO, "Started %u worker threads.\n",
+							numworkers);
+}
+
+static void stop_workers(void)
+{
+	unsigned i;
+
+	for (i = 0; i < numworkers; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		bbus_pollset_free(workers[i].pollset);
+	}
+
+	bbus_free(workers);
+}
+
+/*
+ * Returns the pollset to which a new client should be added. Clients are
+ * distributed among the workers in a round-robin fashion.
+ */
+static bbus_pollset* pick_pollset(bbus_pollset* mainpset)
+{
+	static unsigned next = 0;
+
+	if (numworkers == 0)
+		return mainpset;
+
+	return workers[next++ % numworkers].pollset;
+}
+
+static void poll_and_handle_inbound_traffic(bbus_server* server,
+				bbus_pollset* pollset, unsigned numtimed)
+{
+	if (do_poll(pollset, poll_timeout(numtimed)) == 0)
+		return;
+
+	if (bbus_pollset_srvisset(pollset, server)) {
+		while (bbus_srv_clientpending(server)) {
+			accept_client(server, pick_pollset(pollset));
 		}
 	}
+
+	/* Without worker threads the main pollset contains all clients. */
+	if (numworkers == 0)
+		handle_ready_clients(pollset);
+}
+
+static void log_iostats(void)
+{
+	struct bbus_iostats stats;
+	struct bbus_memstats mem;
+
+	bbus_iostats_get(&stats);
+	bbus_memstats_get(&mem);
+	bbusd_logmsg(BBUSD_LOG_INFO,
+		"Received %lu messages (%lu bytes) in %lu read calls.\n",
+		stats.rcvmsgs, stats.rcvbytes, stats.rcvcalls);
+	bbusd_logmsg(BBUSD_LOG_INFO,
+		"Sent %lu messages (%lu bytes) in %lu write calls.\n",
+		stats.sndmsgs, stats.sndbytes, stats.sndcalls);
+	bbusd_logmsg(BBUSD_LOG_INFO,
+		"Made %lu heap allocations (%.2f per received message).\n",
+		mem.allocs, stats.rcvmsgs == 0 ? 0.0
+				: (double)mem.allocs / stats.rcvmsgs);
 }
 
 int main(int argc, char** argv)
 {
 	int retval;
 	struct bbusd_clientlist_elem* tmpcli;
+	struct bbusd_clientlist_elem* nextcli;
 	static bbus_pollset* pollset;
 	bbus_server* server;
+	unsigned numtimed = 0;
 
 	retval = bbus_parse_args(argc, argv, &optlist, NULL);
 	if (retval == BBUS_ARGS_HELP)
@@ -612,6 +1125,8 @@ int main(int argc, char** argv)
 	else if (retval == BBUS_ARGS_ERR)
 		return EXIT_FAILURE;
 
+	bbusd_lock_init();
+	bbusd_init_clientlist_pool();
 	bbusd_init_caller_map();
 	bbusd_init_service_map();
 	bbusd_register_local_methods();
@@ -635,29 +1150,43 @@ int main(int argc, char** argv)
 			bbus_strerror(bbus_lasterror()));
 	}
 
+	retval = bbus_pollset_addsrv(pollset, server);
+	if (retval < 0) {
+		bbusd_die("Error adding the server to the poll_set: %s\n",
+			bbus_strerror(bbus_lasterror()));
+	}
+
 	bbusd_logmsg(BBUSD_LOG_INFO, "Busybus daemon starting!\n");
 	run = 1;
 	(void)signal(SIGTERM, sighandler);
 	(void)signal(SIGINT, sighandler);
+	start_workers();
 
 	/*
 	 * MAIN LOOP
 	 */
 	while (do_run()) {
-		poll_and_handle_inbound_traffic(server, pollset);
+		poll_and_handle_inbound_traffic(server, pollset, numtimed);
+		numtimed = expire_calls();
 	}
 
 	/* Cleanup. */
+	stop_workers();
+	log_iostats();
+	bbus_pollset_free(pollset);
 	bbus_srv_close(server);
 
 	for (tmpcli = bbusd_clientlist_getfirst(); tmpcli != NULL;
-					tmpcli = tmpcli->next) {
+						tmpcli = nextcli) {
+		nextcli = tmpcli->next;
 		bbus_client_close(tmpcli->cli);
 		bbus_client_free(tmpcli->cli);
-		bbus_free(tmpcli);
 	}
 
+	bbusd_free_clientlist_pool();
 	bbusd_free_service_map();
+	bbusd_freemsgbuf();
+	bbusd_lock_free();
 
 	bbusd_logmsg(BBUSD_LOG_INFO, "Busybus daemon exiting!\n");
 	return EXIT_SUCCESS;
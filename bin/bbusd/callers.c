@@ -14,6 +14,10 @@
 
 #include "callers.h"
 #include "common.h"
+#include "log.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
 
 /*
  * Caller map:
@@ -22,17 +26,99 @@
  */
 static bbus_hashmap* caller_map;
 
+/*
+ * Calls forwarded to services and not yet replied to are kept in a slab.
+ * Call ids consist of the slot index in the low bits and the slot's
+ * generation in the high bits, which is bumped every time the slot is
+ * freed - late replies to calls, that have already been taken care of,
+ * can't be mistaken for replies to newer calls using the same slot.
+ *
+ * Calls are added and removed by the workers holding the daemon lock only
+ * for reading, so the slab has a lock of its own.
+ */
+#define CALLID_IDXBITS		20
+#define CALLID_MAXSLOTS		(1U << CALLID_IDXBITS)
+#define CALLID_IDXMASK		(CALLID_MAXSLOTS - 1)
+#define CALLID_GENMASK		0xFFFU
+#define CALLID_NOSLOT		UINT32_MAX
+
+/*
+ * Calls with a deadline are also linked into a hashed timer wheel: each
+ * bucket holds the calls expiring at the ticks equal to its index modulo
+ * WHEEL_SIZE. Adding and removing a call is O(1) and every tick only
+ * scans one bucket, skipping the calls due in one of the later rounds.
+ * Calls time out after seconds rather than minutes, so there are few
+ * of those and cascading between wheels of a hierarchical one wouldn't
+ * pay off.
+ */
+#define WHEEL_TICKMS		10
+#define WHEEL_SIZE		512
+
+struct call_slot
+{
+	/* The id is BBUSD_NOCALL if the slot is free. */
+	struct bbusd_call call;
+	uint32_t gen;
+	uint32_t nextfree;
+	/* Tick at which the call expires, 0 if never. */
+	uint64_t deadline;
+	uint32_t wheelnext;
+	uint32_t wheelprev;
+};
+
+static struct call_slot* calls;
+static uint32_t numcalls;
+static uint32_t callsize;
+/*
+ * Free slots are reused in FIFO order, so that it takes as long as
+ * possible for the generation of any single slot to wrap around.
+ */
+static uint32_t freehead = CALLID_NOSLOT;
+static uint32_t freetail = CALLID_NOSLOT;
+static uint32_t wheel[WHEEL_SIZE];
+/* Last tick, whose bucket has been checked for expired calls. */
+static uint64_t wheeltick;
+static unsigned numtimed;
+static pthread_mutex_t call_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The coarse clock is much cheaper to read and its resolution is still
+ * finer than a single tick.
+ */
+static uint64_t now_tick(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000)
+							/ WHEEL_TICKMS;
+}
+
 void bbusd_init_caller_map(void)
 {
+	unsigned i;
+
 	caller_map = bbus_hmap_create(BBUS_HMAP_KEYUINT);
-	if (caller_map == NULL) {
-		bbusd_die("Error creating the caller hashmap: %s\n",
-					bbus_strerror(bbus_lasterror()));
-	}
+	if (caller_map == NULL)
+		goto err;
+
+	for (i = 0; i < WHEEL_SIZE; ++i)
+		wheel[i] = CALLID_NOSLOT;
+	wheeltick = now_tick();
+
+	return;
+
+err:
+	bbusd_die("Error creating the caller hashmap: %s\n",
+				bbus_strerror(bbus_lasterror()));
 }
 
 void bbusd_clean_caller_map(void)
 {
+	bbus_free(calls);
+	calls = NULL;
+	numcalls = callsize = numtimed = 0;
+	freehead = freetail = CALLID_NOSLOT;
 	bbus_hmap_free(caller_map);
 }
 
@@ -47,3 +133,217 @@ int bbusd_add_caller(unsigned token, struct bbusd_clientlist_elem* caller)
 	return bbus_hmap_setuint(caller_map, (unsigned)token, caller);
 }
 
+void bbusd_rm_caller(unsigned token)
+{
+	(void)bbus_hmap_rmuint(caller_map, token);
+}
+
+
+/*
+ * Must be called with call_lock held.
+ */
+static int alloc_slot(uint32_t* idx)
+{
+	struct call_slot* newcalls;
+	uint32_t newsize;
+
+	if (freehead != CALLID_NOSLOT) {
+		*idx = freehead;
+		freehead = calls[*idx].nextfree;
+		if (freehead == CALLID_NOSLOT)
+			freetail = CALLID_NOSLOT;
+		return 0;
+	}
+
+	if (numcalls == CALLID_MAXSLOTS) {
+		bbusd_logmsg(BBUSD_LOG_ERR,
+			"Maximum number of pending calls reached\n");
+		return -1;
+	}
+
+	if (numcalls == callsize) {
+		newsize = callsize == 0 ? 64 : callsize * 2;
+		newcalls = bbus_realloc(calls,
+				newsize * sizeof(struct call_slot));
+		if (newcalls == NULL)
+			return -1;
+
+		calls = newcalls;
+		callsize = newsize;
+	}
+
+	*idx = numcalls++;
+	calls[*idx].gen = 1;
+
+	return 0;
+}
+
+/*
+ * Must be called with call_lock held.
+ */
+static void wheel_add(uint32_t idx, unsigned timeout)
+{
+	struct call_slot* slot = &calls[idx];
+	uint32_t* bucket;
+
+	/* Never expire calls earlier than requested. */
+	slot->deadline = now_tick() + 1
+			+ (timeout + WHEEL_TICKMS - 1) / WHEEL_TICKMS;
+	bucket = &wheel[slot->deadline % WHEEL_SIZE];
+
+	slot->wheelprev = CALLID_NOSLOT;
+	slot->wheelnext = *bucket;
+	if (*bucket != CALLID_NOSLOT)
+		calls[*bucket].wheelprev = idx;
+	*bucket = idx;
+	++numtimed;
+}
+
+/*
+ * Must be called with call_lock held.
+ */
+static void wheel_rm(uint32_t idx)
+{
+	struct call_slot* slot = &calls[idx];
+
+	if (slot->wheelprev != CALLID_NOSLOT)
+		calls[slot->wheelprev].wheelnext = slot->wheelnext;
+	else
+		wheel[slot->deadline % WHEEL_SIZE] = slot->wheelnext;
+
+	if (slot->wheelnext != CALLID_NOSLOT)
+		calls[slot->wheelnext].wheelprev = slot->wheelprev;
+
+	slot->deadline = 0;
+	--numtimed;
+}
+
+/*
+ * Must be called with call_lock held.
+ */
+static void free_slot(uint32_t idx)
+{
+	struct call_slot* slot = &calls[idx];
+
+	if (slot->deadline != 0)
+		wheel_rm(idx);
+
+	slot->call.id = BBUSD_NOCALL;
+	slot->gen = (slot->gen + 1) & CALLID_GENMASK;
+	if (slot->gen == 0)
+		slot->gen = 1;
+
+	slot->nextfree = CALLID_NOSLOT;
+	if (freetail == CALLID_NOSLOT)
+		freehead = idx;
+	else
+		calls[freetail].nextfree = idx;
+	freetail = idx;
+}
+
+unsigned bbusd_new_call(unsigned caller, const struct bbus_msg_hdr* hdr,
+			struct bbusd_clientlist_elem* srvc, unsigned timeout)
+{
+	struct bbusd_call* call;
+	unsigned id = BBUSD_NOCALL;
+	uint32_t idx;
+	int ret;
+
+	pthread_mutex_lock(&call_lock);
+	ret = alloc_slot(&idx);
+	if (ret < 0)
+		goto out;
+
+	call = &calls[idx].call;
+	memset(call, 0, sizeof(struct bbusd_call));
+	call->id = id = (calls[idx].gen << CALLID_IDXBITS) | idx;
+	call->caller = caller;
+	call->srvc = srvc;
+	if (BBUS_HDR_ISFLAGSET(hdr, BBUS_PROT_HASCALLID)) {
+		call->hascallid = 1;
+		call->callid = bbus_hdr_getcallid(hdr);
+	}
+
+	calls[idx].deadline = 0;
+	if (timeout > 0)
+		wheel_add(idx, timeout);
+
+out:
+	pthread_mutex_unlock(&call_lock);
+	return id;
+}
+
+/*
+ * Only takes the call if it was forwarded to srvc, so that a service can't
+ * complete or cancel calls of another one. NULL matches any service.
+ */
+int bbusd_take_call(unsigned id, bbus_client* srvc, struct bbusd_call* call)
+{
+	uint32_t idx;
+	int ret = -1;
+
+	idx = id & CALLID_IDXMASK;
+	pthread_mutex_lock(&call_lock);
+	if (id == BBUSD_NOCALL || idx >= numcalls
+					|| calls[idx].call.id != id)
+		goto out;
+
+	if (srvc != NULL && calls[idx].call.srvc->cli != srvc)
+		goto out;
+
+	memcpy(call, &calls[idx].call, sizeof(struct bbusd_call));
+	free_slot(idx);
+	ret = 0;
+
+out:
+	pthread_mutex_unlock(&call_lock);
+	return ret;
+}
+
+void bbusd_fail_srvc_calls(struct bbusd_clientlist_elem* srvc,
+			void (*failfunc)(const struct bbusd_call*))
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&call_lock);
+	for (i = 0; i < numcalls; ++i) {
+		if (calls[i].call.id == BBUSD_NOCALL
+				|| calls[i].call.srvc != srvc)
+			continue;
+
+		failfunc(&calls[i].call);
+		free_slot(i);
+	}
+	pthread_mutex_unlock(&call_lock);
+}
+
+unsigned bbusd_expire_calls(void (*failfunc)(const struct bbusd_call*))
+{
+	uint64_t now;
+	uint64_t tick;
+	uint32_t idx;
+	uint32_t next;
+	unsigned ret;
+
+	pthread_mutex_lock(&call_lock);
+	now = now_tick();
+	/* Every bucket needs to be checked at most once. */
+	tick = now - wheeltick > WHEEL_SIZE ? now - WHEEL_SIZE : wheeltick;
+	while (tick < now) {
+		++tick;
+		for (idx = wheel[tick % WHEEL_SIZE];
+				idx != CALLID_NOSLOT; idx = next) {
+			next = calls[idx].wheelnext;
+			if (calls[idx].deadline > now)
+				continue;
+
+			failfunc(&calls[idx].call);
+			free_slot(idx);
+		}
+	}
+	wheeltick = now;
+	ret = numtimed;
+	pthread_mutex_unlock(&call_lock);
+
+	return ret;
+}
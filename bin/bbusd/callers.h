@@ -23,6 +23,30 @@ void bbusd_clean_caller_map(void);
 
 struct bbusd_clientlist_elem* bbusd_get_caller(unsigned token);
 int bbusd_add_caller(unsigned token, struct bbusd_clientlist_elem* caller);
+void bbusd_rm_caller(unsigned token);
+
+/*
+ * Method call forwarded to a service. The id identifies the call in the
+ * SRVCALL message and the service's reply, callid is the identifier of an
+ * asynchronous call chosen by the caller.
+ */
+struct bbusd_call
+{
+	unsigned id;
+	unsigned caller;
+	int hascallid;
+	uint32_t callid;
+	struct bbusd_clientlist_elem* srvc;
+};
+
+#define BBUSD_NOCALL	0
+
+unsigned bbusd_new_call(unsigned caller, const struct bbus_msg_hdr* hdr,
+			struct bbusd_clientlist_elem* srvc, unsigned timeout);
+int bbusd_take_call(unsigned id, bbus_client* srvc, struct bbusd_call* call);
+void bbusd_fail_srvc_calls(struct bbusd_clientlist_elem* srvc,
+			void (*failfunc)(const struct bbusd_call*));
+unsigned bbusd_expire_calls(void (*failfunc)(const struct bbusd_call*));
 
 
 #endif /* __BBUSD_CALLERS__ */
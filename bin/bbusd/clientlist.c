@@ -13,12 +13,30 @@
  */
 
 #include "clientlist.h"
+#include "common.h"
+
+/* Elements of all client lists come from a single pool. */
+static bbus_pool* elem_pool;
+
+void bbusd_init_clientlist_pool(void)
+{
+	elem_pool = bbus_pool_create(sizeof(struct bbusd_clientlist_elem));
+	if (elem_pool == NULL) {
+		bbusd_die("Error creating the client list pool: %s\n",
+					bbus_strerror(bbus_lasterror()));
+	}
+}
+
+void bbusd_free_clientlist_pool(void)
+{
+	bbus_pool_destroy(elem_pool);
+}
 
 int __bbusd_clientlist_add(bbus_client* cli, struct bbusd_clientlist* list)
 {
 	struct bbusd_clientlist_elem* el;
 
-	el = bbus_malloc(sizeof(struct bbusd_clientlist_elem));
+	el = bbus_pool_alloc(elem_pool);
 	if (el == NULL)
 		return -1;
 
@@ -32,6 +50,6 @@ void __bbusd_clientlist_rm(struct bbusd_clientlist_elem** elem,
 				struct bbusd_clientlist* list)
 {
 	bbus_list_rm(list, *elem);
-	bbus_free(*elem);
+	bbus_pool_free(elem_pool, *elem);
 }
 
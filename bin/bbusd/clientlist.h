@@ -30,6 +30,8 @@ struct bbusd_clientlist
 	struct bbusd_clientlist_elem* tail;
 };
 
+void bbusd_init_clientlist_pool(void);
+void bbusd_free_clientlist_pool(void);
 int __bbusd_clientlist_add(bbus_client* cli, struct bbusd_clientlist* list);
 void __bbusd_clientlist_rm(struct bbusd_clientlist_elem** elem,
 				struct bbusd_clientlist* list);
@@ -13,6 +13,7 @@
  */
 
 #include "clients.h"
+#include "log.h"
 
 static struct bbusd_clientlist clients = { NULL, NULL };
 
@@ -36,3 +37,49 @@ struct bbusd_clientlist_elem* bbusd_clientlist_getlast(void)
 	return clients.tail;
 }
 
+/*
+ * Must be used instead of bbus_client_sendmsg() for clients stored in the
+ * client list. Handles outbound queue overflows: messages for monitors are
+ * dropped, other clients get disconnected - the connection is only shut
+ * down here, the worker owning the client will notice and remove it.
+ */
+static void handle_send_error(bbus_client* cli)
+{
+	if (bbus_lasterror() == BBUS_EQUEUEFULL) {
+		if (bbus_client_gettype(cli) == BBUS_CLIENT_MON) {
+			bbusd_logmsg(BBUSD_LOG_WARN,
+				"Monitor '%s' too slow, dropping message.\n",
+				bbus_client_getname(cli));
+		} else {
+			bbusd_logmsg(BBUSD_LOG_ERR,
+				"Client '%s' too slow, disconnecting.\n",
+				bbus_client_getname(cli));
+			(void)bbus_client_shutdown(cli);
+		}
+	}
+}
+
+int bbusd_client_sendmsg(bbus_client* cli, struct bbus_msg_hdr* hdr,
+				const char* meta, bbus_object* obj)
+{
+	int ret;
+
+	ret = bbus_client_sendmsg(cli, hdr, meta, obj);
+	if (ret < 0)
+		handle_send_error(cli);
+
+	return ret;
+}
+
+int bbusd_client_sendraw(bbus_client* cli, struct bbus_msg_hdr* hdr,
+		const char* meta, const void* obj, size_t objsize)
+{
+	int ret;
+
+	ret = bbus_client_sendraw(cli, hdr, meta, obj, objsize);
+	if (ret < 0)
+		handle_send_error(cli);
+
+	return ret;
+}
+
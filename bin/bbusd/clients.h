@@ -22,6 +22,10 @@ int bbusd_clientlist_add(bbus_client* cli);
 void bbusd_clientlist_rm(struct bbusd_clientlist_elem** elem);
 struct bbusd_clientlist_elem* bbusd_clientlist_getfirst(void);
 struct bbusd_clientlist_elem* bbusd_clientlist_getlast(void);
+int bbusd_client_sendmsg(bbus_client* cli, struct bbus_msg_hdr* hdr,
+				const char* meta, bbus_object* obj);
+int bbusd_client_sendraw(bbus_client* cli, struct bbus_msg_hdr* hdr,
+		const char* meta, const void* obj, size_t objsize);
 
 #endif /* __BBUSD_CLIENTS__ */
 
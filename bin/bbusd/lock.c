@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "lock.h"
+#include "common.h"
+#include <pthread.h>
+#include <string.h>
+
+static pthread_rwlock_t daemon_lock;
+
+void bbusd_lock_init(void)
+{
+	pthread_rwlockattr_t attr;
+	int ret;
+
+	pthread_rwlockattr_init(&attr);
+	/*
+	 * Writers are rare (new connections, disconnects, service
+	 * registrations) - don't let a steady stream of readers starve them.
+	 */
+	pthread_rwlockattr_setkind_np(&attr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	ret = pthread_rwlock_init(&daemon_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	if (ret != 0) {
+		bbusd_die("Error initializing the daemon lock: %s\n",
+							strerror(ret));
+	}
+}
+
+void bbusd_lock_free(void)
+{
+	pthread_rwlock_destroy(&daemon_lock);
+}
+
+void bbusd_rdlock(void)
+{
+	pthread_rwlock_rdlock(&daemon_lock);
+}
+
+void bbusd_wrlock(void)
+{
+	pthread_rwlock_wrlock(&daemon_lock);
+}
+
+void bbusd_unlock(void)
+{
+	pthread_rwlock_unlock(&daemon_lock);
+}
+
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BBUSD_LOCK__
+#define __BBUSD_LOCK__
+
+/*
+ * Global daemon lock. Message handlers hold it for reading, anything
+ * modifying the client list, the caller map, the monitor list or the
+ * service tree must hold it for writing.
+ */
+
+void bbusd_lock_init(void);
+void bbusd_lock_free(void);
+void bbusd_rdlock(void);
+void bbusd_wrlock(void);
+void bbusd_unlock(void);
+
+#endif /* __BBUSD_LOCK__ */
+
@@ -45,8 +45,24 @@ static bbus_object* lm_echo(bbus_object* arg)
 }
 DEF_LOCAL_METHOD(lm_echo);
 
+static bbus_object* lm_stats(bbus_object* arg BBUS_UNUSED)
+{
+	struct bbus_iostats stats;
+
+	bbus_iostats_get(&stats);
+	return bbus_obj_build("uuuuuu",
+			(bbus_uint32)stats.rcvcalls,
+			(bbus_uint32)stats.rcvbytes,
+			(bbus_uint32)stats.rcvmsgs,
+			(bbus_uint32)stats.sndcalls,
+			(bbus_uint32)stats.sndbytes,
+			(bbus_uint32)stats.sndmsgs);
+}
+DEF_LOCAL_METHOD(lm_stats);
+
 void bbusd_register_local_methods(void)
 {
 	REG_LOCAL_METHOD("bbus.bbusd.echo", lm_echo);
+	REG_LOCAL_METHOD("bbus.bbusd.stats", lm_stats);
 }
 
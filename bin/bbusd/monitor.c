@@ -13,7 +13,9 @@
  */
 
 #include "monitor.h"
+#include "clients.h"
 #include "log.h"
+#include "msgbuf.h"
 #include <string.h>
 
 static struct bbusd_clientlist monitors = { NULL, NULL };
@@ -43,7 +45,7 @@ static bbus_object* pack_msg(const struct bbus_msg_hdr* hdr, const char* meta)
 {
 	bbus_object* obj;
 
-	obj = bbus_obj_build("bbbuubs",
+	obj = bbus_obj_arena_build(bbusd_getarena(), "bbbuubs",
 				hdr->msgtype,
 				hdr->sotype,
 				hdr->errcode,
@@ -62,7 +64,7 @@ static bbus_object* pack_msg(const struct bbus_msg_hdr* hdr, const char* meta)
 
 /*
  * Send a prepared message to all monitors. Deletes the object before
- * returning.
+ * returning, unless it comes from the arena.
  */
 static void send_to_monitors(const char* meta, bbus_object* obj)
 {
@@ -79,8 +81,9 @@ static void send_to_monitors(const char* meta, bbus_object* obj)
 		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
 
 	for (mon = monitors.head; mon != NULL; mon = mon->next) {
-		ret = bbus_client_sendmsg(mon->cli, &hdr, meta, obj);
-		if (ret < 0) {
+		ret = bbusd_client_sendmsg(mon->cli, &hdr, meta, obj);
+		/* Queue overflows are already reported. */
+		if (ret < 0 && bbus_lasterror() != BBUS_EQUEUEFULL) {
 			bbusd_logmsg(BBUSD_LOG_ERR,
 				"Error sending a message to monitor: %s\n",
 				bbus_strerror(bbus_lasterror()));
@@ -95,6 +98,10 @@ void bbusd_mon_notify_recvd(const struct bbus_msg* msg)
 	bbus_object* obj;
 	const char* meta;
 
+	/* Don't build messages nobody is going to receive. */
+	if (monitors.head == NULL)
+		return;
+
 	if (BBUS_HDR_ISFLAGSET(&msg->hdr, BBUS_PROT_HASMETA)) {
 		meta = bbus_prot_extractmeta(msg);
 		if (meta == NULL) {
@@ -118,6 +125,9 @@ void bbusd_mon_notify_recvd(const struct bbus_msg* msg)
 void bbusd_mon_notify_sent(const struct bbus_msg_hdr* hdr,
 				const char* meta, bbus_object* obj)
 {
+	if (monitors.head == NULL)
+		return;
+
 	obj = pack_msg(hdr, meta == NULL ? "" : meta);
 	if (obj == NULL)
 		return;
@@ -13,23 +13,54 @@
  */
 
 #include "msgbuf.h"
-#include <string.h>
+#include "common.h"
 
-static unsigned char __msgbuf[2*BBUS_MAXPLOADSIZE];
-static struct bbus_msg* msgbuf = (struct bbus_msg*)__msgbuf;
+/*
+ * Every worker thread receives into its own buffer, which grows to fit
+ * the biggest message received so far.
+ */
+static BBUS_THREAD_LOCAL struct bbus_msg* msgbuf;
+static BBUS_THREAD_LOCAL size_t msgbufsize;
+
+/*
+ * Temporaries needed to handle a single batch of messages are allocated
+ * from a per-thread arena, which is reset after every batch.
+ */
+static BBUS_THREAD_LOCAL bbus_arena* arena;
 
-struct bbus_msg* bbusd_getmsgbuf(void)
+struct bbus_msg** bbusd_getmsgbuf(void)
 {
-	return msgbuf;
+	return &msgbuf;
 }
 
-void bbusd_zeromsgbuf(void)
+size_t* bbusd_msgbufsize(void)
 {
-	memset(msgbuf, 0, sizeof(__msgbuf));
+	return &msgbufsize;
 }
 
-size_t bbusd_msgbufsize(void)
+bbus_arena* bbusd_getarena(void)
 {
-	return sizeof(__msgbuf);
+	if (arena == NULL) {
+		arena = bbus_arena_create(BBUS_ARENA_DEFCHUNKSIZE);
+		if (arena == NULL)
+			bbusd_die("Error creating the memory arena: %s\n",
+					bbus_strerror(bbus_lasterror()));
+	}
+
+	return arena;
 }
 
+void bbusd_resetarena(void)
+{
+	if (arena != NULL)
+		bbus_arena_reset(arena);
+}
+
+void bbusd_freemsgbuf(void)
+{
+	bbus_free(msgbuf);
+	msgbuf = NULL;
+	msgbufsize = 0;
+	bbus_arena_free(arena);
+	arena = NULL;
+}
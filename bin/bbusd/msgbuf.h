@@ -17,9 +17,11 @@
 
 #include <busybus.h>
 
-struct bbus_msg* bbusd_getmsgbuf(void);
-void bbusd_zeromsgbuf(void);
-size_t bbusd_msgbufsize(void);
+struct bbus_msg** bbusd_getmsgbuf(void);
+size_t* bbusd_msgbufsize(void);
+bbus_arena* bbusd_getarena(void);
+void bbusd_resetarena(void);
+void bbusd_freemsgbuf(void);
 
 #endif /* __BBUSD_MSGBUF__ */
 
@@ -26,7 +26,125 @@ struct service_tree
 	bbus_hashmap* methods;
 };
 
+struct method_entry
+{
+	struct bbusd_method* mthd;
+	char* path;
+	bbus_method_handle handle;
+};
+
+/*
+ * Handles consist of the slot index in the low bits and the slot's
+ * generation in the high bits. The generation is bumped every time a slot
+ * is freed, so that handles to removed methods can't be used to call
+ * a different method which took over the slot later. Generations start at
+ * 1, so no valid handle ever equals BBUS_METHOD_NOHANDLE.
+ *
+ * The generation is only 12 bits wide (HANDLE_GENMASK). A slot, which has
+ * gone through all generations, is retired instead of being freed, so that
+ * an old handle can't become valid again. Free slots are reused first in,
+ * first out, to spread re-registrations over all of them.
+ */
+#define HANDLE_IDXBITS		20
+#define HANDLE_MAXSLOTS		(1U << HANDLE_IDXBITS)
+#define HANDLE_IDXMASK		(HANDLE_MAXSLOTS - 1)
+#define HANDLE_GENMASK		0xFFFU
+#define HANDLE_NOFREE		UINT32_MAX
+
+struct handle_slot
+{
+	struct method_entry* entr;
+	uint32_t gen;
+	uint32_t nextfree;
+};
+
+/*
+ * The tree mirrors the hierarchy of services, while the method index maps
+ * full method paths to the same method objects, so that method calls can
+ * be resolved with a single lookup. Calls made by handle skip the lookup
+ * altogether and index the slot array directly.
+ */
 static struct service_tree* srvc_tree;
+static bbus_hashmap* method_index;
+
+static struct handle_slot* slots;
+static uint32_t numslots;
+static uint32_t slotsize;
+static uint32_t freehead = HANDLE_NOFREE;
+static uint32_t freetail = HANDLE_NOFREE;
+
+static bbus_pool* node_pool;
+static bbus_pool* remote_pool;
+static bbus_pool* entry_pool;
+
+static int alloc_handle(struct method_entry* entr)
+{
+	struct handle_slot* newslots;
+	uint32_t idx;
+	uint32_t newsize;
+
+	if (freehead != HANDLE_NOFREE) {
+		idx = freehead;
+		freehead = slots[idx].nextfree;
+		if (freehead == HANDLE_NOFREE)
+			freetail = HANDLE_NOFREE;
+	} else {
+		if (numslots == HANDLE_MAXSLOTS) {
+			bbusd_logmsg(BBUSD_LOG_ERR,
+				"Maximum number of methods reached\n");
+			return -1;
+		}
+
+		if (numslots == slotsize) {
+			newsize = slotsize == 0 ? 64 : slotsize * 2;
+			newslots = bbus_realloc(slots,
+				newsize * sizeof(struct handle_slot));
+			if (newslots == NULL)
+				return -1;
+
+			slots = newslots;
+			slotsize = newsize;
+		}
+
+		idx = numslots++;
+		slots[idx].gen = 1;
+	}
+
+	slots[idx].entr = entr;
+	entr->handle = (slots[idx].gen << HANDLE_IDXBITS) | idx;
+
+	return 0;
+}
+
+static void free_handle(bbus_method_handle handle)
+{
+	uint32_t idx;
+
+	idx = handle & HANDLE_IDXMASK;
+	slots[idx].entr = NULL;
+	slots[idx].gen = (slots[idx].gen + 1) & HANDLE_GENMASK;
+	if (slots[idx].gen == 0) {
+		/* Out of generations - the slot is never used again. */
+		return;
+	}
+
+	slots[idx].nextfree = HANDLE_NOFREE;
+	if (freetail == HANDLE_NOFREE)
+		freehead = idx;
+	else
+		slots[freetail].nextfree = idx;
+	freetail = idx;
+}
+
+struct bbusd_remote_method* bbusd_alloc_remote_method(void)
+{
+	return bbus_pool_alloc0(remote_pool);
+}
+
+void bbusd_free_remote_method(struct bbusd_remote_method* mthd)
+{
+	bbus_pool_free(remote_pool, mthd);
+}
 
 static int do_insert_method(const char* path, struct bbusd_method* mthd,
 					struct service_tree* node)
@@ -61,7 +179,7 @@ static int do_insert_method(const char* path, struct bbusd_method* mthd,
 		next = bbus_hmap_findstr(node->subsrvc, path);
 		if (next == NULL) {
 			/* Insert new service. */
-			next = bbus_malloc(sizeof(struct service_tree));
+			next = bbus_pool_alloc(node_pool);
 			if (next == NULL)
 				goto err_mknext;
 
@@ -88,81 +206,191 @@ err_mkmethods:
 	bbus_hmap_free(next->subsrvc);
 
 err_mksubsrvc:
-	bbus_free(next);
+	bbus_pool_free(node_pool, next);
 
 err_mknext:
 	return -1;
 }
 
+/*
+ * Removes the method from the service tree, empty nodes are kept.
+ */
+static void do_remove_method(const char* path)
+{
+	struct service_tree* node;
+	char* mname;
+	char* cur;
+	char* found;
+
+	mname = bbus_str_cpy(path);
+	if (mname == NULL)
+		bbusd_die("Error removing method '%s': %s\n",
+			path, bbus_strerror(bbus_lasterror()));
+
+	node = srvc_tree;
+	cur = mname;
+	while ((found = index(cur, '.')) != NULL) {
+		*found = '\0';
+		node = bbus_hmap_findstr(node->subsrvc, cur);
+		if (node == NULL)
+			goto out;
+		cur = found+1;
+	}
+	(void)bbus_hmap_rmstr(node->methods, cur);
+
+out:
+	bbus_str_free(mname);
+}
+
 int bbusd_insert_method(const char* path, struct bbusd_method* mthd)
 {
+	struct method_entry* entr;
 	char* mname;
 	int ret;
 
+	if (bbus_hmap_findstr(method_index, path) != NULL) {
+		bbusd_logmsg(BBUSD_LOG_ERR,
+			"Method already exists for this value: %s\n", path);
+		return -1;
+	}
+
+	entr = bbus_pool_alloc0(entry_pool);
+	if (entr == NULL)
+		goto err_logerr;
+
+	entr->mthd = mthd;
+	entr->path = bbus_str_cpy(path);
+	if (entr->path == NULL)
+		goto err_freeentr;
+
+	ret = alloc_handle(entr);
+	if (ret < 0)
+		goto err_freepath;
+
+	ret = bbus_hmap_setstr(method_index, path, entr);
+	if (ret < 0)
+		goto err_freehandle;
+
 	mname = bbus_str_cpy(path);
 	if (mname == NULL)
-		return -1;
+		goto err_rmindex;
 
 	ret = do_insert_method(mname, mthd, srvc_tree);
 	bbus_str_free(mname);
+	if (ret < 0)
+		goto err_rmindex;
+
+	return 0;
+
+err_rmindex:
+	bbus_hmap_rmstr(method_index, path);
+
+err_freehandle:
+	free_handle(entr->handle);
+
+err_freepath:
+	bbus_str_free(entr->path);
+
+err_freeentr:
+	bbus_pool_free(entry_pool, entr);
 
-	return ret;
+err_logerr:
+	bbusd_logmsg(BBUSD_LOG_ERR, "Error registering new method: %s\n",
+				bbus_strerror(bbus_lasterror()));
+	return -1;
 }
 
-static struct bbusd_method* do_locate_method(char* path, struct service_tree* node)
+struct bbusd_method* bbusd_locate_method(const char* path)
 {
-	char* found;
-	struct service_tree* next;
+	struct method_entry* entr;
 
-	found = index(path, '.');
-	if (found == NULL) {
-		/* This is a method. */
-		return bbus_hmap_findstr(node->methods, path);
-	} else {
-		*found = '\0';
-		/* This is a sub-service. */
-		next = bbus_hmap_findstr(node->subsrvc, path);
-		if (next == NULL) {
-			return NULL;
-		}
+	entr = bbus_hmap_findstr(method_index, path);
+	return entr == NULL ? NULL : entr->mthd;
+}
 
-		return do_locate_method(found+1, next);
-	}
+bbus_method_handle bbusd_method_gethandle(const char* path)
+{
+	struct method_entry* entr;
+
+	entr = bbus_hmap_findstr(method_index, path);
+	return entr == NULL ? BBUS_METHOD_NOHANDLE : entr->handle;
 }
 
-struct bbusd_method* bbusd_locate_method(const char* path)
+struct bbusd_method* bbusd_method_byhandle(bbus_method_handle handle,
+							const char** path)
 {
-	char* mname;
-	struct bbusd_method* ret;
+	struct method_entry* entr;
+	uint32_t idx;
 
-	mname = bbus_str_cpy(path);
-	if (mname == NULL)
+	idx = handle & HANDLE_IDXMASK;
+	if (idx >= numslots)
 		return NULL;
 
-	ret = do_locate_method(mname, srvc_tree);
-	bbus_str_free(mname);
+	entr = slots[idx].entr;
+	if (entr == NULL || entr->handle != handle)
+		return NULL;
+
+	if (path != NULL)
+		*path = entr->path;
 
-	return ret;
+	return entr->mthd;
+}
+
+void bbusd_remove_srvc_methods(struct bbusd_clientlist_elem* srvc)
+{
+	struct method_entry* entr;
+	struct bbusd_remote_method* mthd;
+	uint32_t i;
+
+	for (i = 0; i < numslots; ++i) {
+		entr = slots[i].entr;
+		if (entr == NULL || entr->mthd->type != BBUSD_METHOD_REMOTE)
+			continue;
+
+		mthd = (struct bbusd_remote_method*)entr->mthd;
+		if (mthd->srvc != srvc)
+			continue;
+
+		bbusd_logmsg(BBUSD_LOG_INFO,
+			"Method '%s' unregistered.\n", entr->path);
+		do_remove_method(entr->path);
+		(void)bbus_hmap_rmstr(method_index, entr->path);
+		free_handle(entr->handle);
+		bbus_str_free(entr->path);
+		bbus_pool_free(entry_pool, entr);
+		bbusd_free_remote_method(mthd);
+	}
 }
 
 void bbusd_init_service_map(void)
 {
-	srvc_tree = bbus_malloc(sizeof(struct service_tree));
+	node_pool = bbus_pool_create(sizeof(struct service_tree));
+	if (node_pool == NULL)
+		goto err;
+
+	remote_pool = bbus_pool_create(sizeof(struct bbusd_remote_method));
+	if (remote_pool == NULL)
+		goto err;
+
+	entry_pool = bbus_pool_create(sizeof(struct method_entry));
+	if (entry_pool == NULL)
+		goto err;
+
+	srvc_tree = bbus_pool_alloc(node_pool);
 	if (srvc_tree == NULL)
 		goto err;
 
 	srvc_tree->subsrvc = bbus_hmap_create(BBUS_HMAP_KEYSTR);
-	if (srvc_tree->subsrvc == NULL) {
-		bbus_free(srvc_tree);
+	if (srvc_tree->subsrvc == NULL)
 		goto err;
-	}
 
 	srvc_tree->methods = bbus_hmap_create(BBUS_HMAP_KEYSTR);
-	if (srvc_tree->methods == NULL) {
-		bbus_hmap_free(srvc_tree->subsrvc);
-		bbus_free(srvc_tree);
+	if (srvc_tree->methods == NULL)
+		goto err;
+
+	method_index = bbus_hmap_create(BBUS_HMAP_KEYSTR);
+	if (method_index == NULL)
 		goto err;
-	}
 
 	return;
 
@@ -173,8 +401,21 @@ err:
 
 void bbusd_free_service_map(void)
 {
+	uint32_t i;
+
+	for (i = 0; i < numslots; ++i) {
+		if (slots[i].entr != NULL)
+			bbus_str_free(slots[i].entr->path);
+	}
+	bbus_free(slots);
+	slots = NULL;
+	numslots = slotsize = 0;
+	freehead = freetail = HANDLE_NOFREE;
+	bbus_pool_destroy(entry_pool);
+	bbus_hmap_free(method_index);
 	bbus_hmap_free(srvc_tree->methods);
 	bbus_hmap_free(srvc_tree->subsrvc);
-	bbus_free(srvc_tree);
+	bbus_pool_destroy(remote_pool);
+	bbus_pool_destroy(node_pool);
 }
 
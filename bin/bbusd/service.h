@@ -48,6 +48,12 @@ struct bbusd_signal
 
 int bbusd_insert_method(const char* path, struct bbusd_method* mthd);
 struct bbusd_method* bbusd_locate_method(const char* path);
+bbus_method_handle bbusd_method_gethandle(const char* path);
+struct bbusd_method* bbusd_method_byhandle(bbus_method_handle handle,
+							const char** path);
+void bbusd_remove_srvc_methods(struct bbusd_clientlist_elem* srvc);
+struct bbusd_remote_method* bbusd_alloc_remote_method(void);
+void bbusd_free_remote_method(struct bbusd_remote_method* mthd);
 void bbusd_init_service_map(void);
 void bbusd_free_service_map(void);
 
@@ -166,6 +166,154 @@ void bbus_free(void* ptr) BBUS_PUBLIC;
  */
 void* bbus_memdup(const void* src, size_t size) BBUS_PUBLIC;
 
+/**
+ * @brief Heap usage statistics of the calling process.
+ *
+ * Only memory allocated with bbus_malloc(), bbus_malloc0(), bbus_realloc()
+ * and bbus_free() is accounted for.
+ */
+struct bbus_memstats
+{
+	unsigned long allocs;		/**< Allocations and reallocations. */
+	unsigned long frees;		/**< Freed memory blocks. */
+};
+
+/**
+ * @brief Retrieves the heap usage statistics.
+ * @param stats Structure to fill.
+ *
+ * This function is thread-safe.
+ */
+void bbus_memstats_get(struct bbus_memstats* stats) BBUS_PUBLIC;
+
+/**
+ * @brief Resets all heap usage counters to zero.
+ */
+void bbus_memstats_reset(void) BBUS_PUBLIC;
+
+/**
+ * @brief Opaque type representing a memory arena.
+ *
+ * Arenas serve short-lived allocations, that can all be released at once.
+ * Memory is carved out of big chunks without any per-allocation overhead
+ * and there's no way to free a single allocation. Arenas are not
+ * thread-safe.
+ */
+typedef struct __bbus_arena bbus_arena;
+
+/**
+ * @brief Default size of a single arena chunk.
+ */
+#define BBUS_ARENA_DEFCHUNKSIZE	4096
+
+/**
+ * @brief Creates a new memory arena.
+ * @param chunksize Size of memory chunks allocated from the heap.
+ * @return New arena or NULL if no memory.
+ *
+ * The first chunk is allocated right away.
+ */
+bbus_arena* bbus_arena_create(size_t chunksize) BBUS_PUBLIC;
+
+/**
+ * @brief Frees the arena and all memory allocated from it.
+ * @param arena Arena to free - can be NULL.
+ */
+void bbus_arena_free(bbus_arena* arena) BBUS_PUBLIC;
+
+/**
+ * @brief Allocates memory from the arena.
+ * @param arena The arena.
+ * @param size Number of bytes to allocate.
+ * @return Pointer to the allocated memory or NULL if no memory.
+ *
+ * Allocations bigger than the chunk size get a chunk of their own.
+ */
+void* bbus_arena_alloc(bbus_arena* arena, size_t size) BBUS_PUBLIC;
+
+/**
+ * @brief Duplicates memory area using the arena.
+ * @param arena The arena.
+ * @param src Memory to duplicate.
+ * @param size Number of bytes to duplicate.
+ * @return Pointer to the copy or NULL if no memory.
+ */
+void* bbus_arena_memdup(bbus_arena* arena, const void* src,
+					size_t size) BBUS_PUBLIC;
+
+/**
+ * @brief Releases all memory allocated from the arena.
+ * @param arena The arena.
+ *
+ * The first chunk is kept for further allocations, the rest is returned
+ * to the heap.
+ */
+void bbus_arena_reset(bbus_arena* arena) BBUS_PUBLIC;
+
+/**
+ * @brief Opaque type representing a pool of fixed-size objects.
+ *
+ * Pools allocate memory in slabs holding several objects each. Freed
+ * objects are kept for reuse instead of being returned to the heap, which
+ * avoids fragmentation caused by many small, long-lived allocations.
+ * Pools are thread-safe.
+ */
+typedef struct __bbus_pool bbus_pool;
+
+/**
+ * @brief Usage statistics of an object pool.
+ */
+struct bbus_poolstats
+{
+	unsigned long allocs;		/**< Objects allocated. */
+	unsigned long frees;		/**< Objects freed. */
+	unsigned long inuse;		/**< Objects currently in use. */
+	unsigned long cached;		/**< Free objects ready for reuse. */
+	unsigned long slabs;		/**< Slabs allocated from the heap. */
+};
+
+/**
+ * @brief Creates a new object pool.
+ * @param size Size of a single object.
+ * @return New pool or NULL if no memory.
+ */
+bbus_pool* bbus_pool_create(size_t size) BBUS_PUBLIC;
+
+/**
+ * @brief Destroys the pool and frees all objects allocated from it.
+ * @param pool Pool to destroy - can be NULL.
+ */
+void bbus_pool_destroy(bbus_pool* pool) BBUS_PUBLIC;
+
+/**
+ * @brief Allocates a single object from the pool.
+ * @param pool The pool.
+ * @return Pointer to the object or NULL if no memory.
+ */
+void* bbus_pool_alloc(bbus_pool* pool) BBUS_PUBLIC;
+
+/**
+ * @brief Works just like bbus_pool_alloc, but zeroes the object.
+ * @param pool The pool.
+ * @return Pointer to the object or NULL if no memory.
+ */
+void* bbus_pool_alloc0(bbus_pool* pool) BBUS_PUBLIC;
+
+/**
+ * @brief Returns an object to the pool.
+ * @param pool The pool, that the object was allocated from.
+ * @param obj The object - can be NULL.
+ */
+void bbus_pool_free(bbus_pool* pool, void* obj) BBUS_PUBLIC;
+
+/**
+ * @brief Retrieves the usage statistics of the pool.
+ * @param pool The pool.
+ * @param stats Structure to fill.
+ */
+void bbus_pool_getstats(bbus_pool* pool,
+			struct bbus_poolstats* stats) BBUS_PUBLIC;
+
 /**
  * @brief Atomically accesses the value of a variable and returns it.
  * @param VAR The variable to access.
@@ -198,6 +346,13 @@ void* bbus_memdup(const void* src, size_t size) BBUS_PUBLIC;
  */
 #define BBUS_ATOMIC_LOCK_RELEASE(VAR) (void)__sync_lock_release(&(VAR))
 
+/**
+ * @brief Atomically adds VAL to VAR.
+ * @param VAR The variable to modify.
+ * @param VAL Value to add.
+ */
+#define BBUS_ATOMIC_ADD(VAR, VAL) (void)__sync_fetch_and_add(&(VAR), (VAL))
+
 /**
  * @brief Represents an elapsed time.
  */
@@ -260,6 +415,28 @@ int bbus_regex_match(const char* pattern, const char* str) BBUS_PUBLIC;
  */
 uint32_t bbus_crc32(const void* buf, size_t bufsize) BBUS_PUBLIC;
 
+/**
+ * @brief Computes a fast non-cryptographic hash of given data.
+ * @param buf Buffer containing the data.
+ * @param bufsize Size of the data.
+ * @return 32-bit hash.
+ *
+ * The data is consumed eight bytes at a time. The result depends on the
+ * host's byte order.
+ */
+uint32_t bbus_hash_str(const void* buf, size_t bufsize) BBUS_PUBLIC;
+
+/**
+ * @brief Computes a hash of an unsigned integer.
+ * @param buf Pointer to the integer.
+ * @param bufsize Size of the integer.
+ * @return 32-bit hash.
+ *
+ * Falls back to bbus_hash_str() if bufsize isn't the size of a 32-bit
+ * integer.
+ */
+uint32_t bbus_hash_uint(const void* buf, size_t bufsize) BBUS_PUBLIC;
+
 /**
  * @brief For given uid returns the name of the user.
  * @param uid The user ID.
@@ -365,12 +542,42 @@ enum bbus_hmap_type
 	BBUS_HMAP_KEYSTR,	/**< Keys are null-terminated strings. */
 };
 
+/**
+ * @brief Hash function used to place the keys in a hashmap.
+ *
+ * bbus_crc32(), bbus_hash_str() and bbus_hash_uint() can all be used.
+ */
+typedef uint32_t (*bbus_hmap_hashfunc)(const void*, size_t);
+
+/**
+ * @brief Selects the data structure backing a hashmap.
+ */
+enum bbus_hmap_impl
+{
+	BBUS_HMAP_OPENADDR = 1,	/**< Open addressing, Robin Hood probing. */
+	BBUS_HMAP_CHAINED,	/**< Separate chaining. */
+};
+
 /**
  * @brief Creates an empty hashmap object.
+ * @param type Type of the keys.
  * @return Pointer to the new hashmap or NULL if no memory.
+ *
+ * The returned hashmap uses open addressing.
  */
 bbus_hashmap* bbus_hmap_create(enum bbus_hmap_type type) BBUS_PUBLIC;
 
+/**
+ * @brief Creates an empty hashmap object using given implementation.
+ * @param type Type of the keys.
+ * @param impl Hashmap implementation.
+ * @return Pointer to the new hashmap or NULL in case of an error.
+ *
+ * Both implementations behave the same, only their performance differs.
+ */
+bbus_hashmap* bbus_hmap_create_impl(enum bbus_hmap_type type,
+		enum bbus_hmap_impl impl) BBUS_PUBLIC;
+
 /**
  * @brief Inserts an entry or sets a new value for an existing one.
  * @param hmap The hashmap.
@@ -432,6 +639,38 @@ void* bbus_hmap_finduint(bbus_hashmap* hmap, unsigned key) BBUS_PUBLIC;
  */
 void* bbus_hmap_rmuint(bbus_hashmap* hmap, unsigned key) BBUS_PUBLIC;
 
+/**
+ * @brief Sets the hash function used by the hashmap.
+ * @param hmap The hashmap, must be empty.
+ * @param func New hash function or NULL to use the default one.
+ * @return 0 on success, -1 if the hashmap isn't empty.
+ *
+ * By default bbus_hash_str() is used for maps with string keys and
+ * bbus_hash_uint() for maps with unsigned integer keys.
+ */
+int bbus_hmap_sethashfunc(bbus_hashmap* hmap,
+		bbus_hmap_hashfunc func) BBUS_PUBLIC;
+
+/**
+ * @brief Sets the load factor at which the hashmap grows.
+ * @param hmap The hashmap.
+ * @param percent Maximum number of entries per 100 slots or buckets.
+ * @return 0 on success, -1 if the value isn't supported.
+ *
+ * The open addressing map accepts values from 10 to 95 (default: 87),
+ * the chained map from 10 to 400 (default: 100). Growing is incremental -
+ * after doubling its size, the map moves a few of the old entries on
+ * every insert and removal.
+ */
+int bbus_hmap_setmaxload(bbus_hashmap* hmap, unsigned percent) BBUS_PUBLIC;
+
+/**
+ * @brief Returns the number of entries stored in the hashmap.
+ * @param hmap The hashmap.
+ * @return Number of entries.
+ */
+size_t bbus_hmap_size(bbus_hashmap* hmap) BBUS_PUBLIC;
+
 /**
  * @brief Deletes all key-value pairs from the hashmap.
  * @param hmap Hashmap to reset.
@@ -599,6 +838,14 @@ void bbus_free_nonopts(struct bbus_nonopts* nonopts) BBUS_PUBLIC;
  */
 #define BBUS_ENV_SOCKPATH	"BBUS_SOCKPATH"
 
+/**
+ * @brief Maximum accepted payload size in bytes.
+ *
+ * Overrides BBUS_PROT_DEFMAXPLOAD. Can be changed at runtime with
+ * bbus_prot_setmaxpload().
+ */
+#define BBUS_ENV_MAXPLOAD	"BBUS_MAXPLOAD"
+
 /**
  * @}
  *
@@ -633,7 +880,12 @@ void bbus_free_nonopts(struct bbus_nonopts* nonopts) BBUS_PUBLIC;
 #define BBUS_EHMAPINVTYPE	10017 /**< Invalid key type for this map. */
 #define BBUS_EREGEXPTRN		10018 /**< Invalid regex pattern. */
 #define BBUS_ECLIUNAUTH		10019 /**< Client unauthorized. */
-#define __BBUS_MAX_ERR		10020 /**< Highest error code */
+#define BBUS_EQUEUEFULL		10020 /**< Outbound queue full. */
+#define BBUS_EMSGTOOBIG		10021 /**< Message exceeds size limit. */
+#define BBUS_EOBJRDONLY		10022 /**< Object is read-only. */
+#define BBUS_ESTALEHANDLE	10023 /**< Method handle no longer valid. */
+#define BBUS_ETIMEDOUT		10024 /**< Method call timed out. */
+#define __BBUS_MAX_ERR		10025 /**< Highest error code */
 
 /**
  * @}
@@ -712,6 +964,16 @@ typedef struct __bbus_object bbus_object;
  */
 bbus_object* bbus_obj_alloc(void) BBUS_PUBLIC;
 
+/**
+ * @brief Allocate an empty busybus object from a memory arena.
+ * @param arena The arena.
+ * @return Pointer to a new object or NULL if no memory.
+ *
+ * Both the object and its data buffer live in the arena and are released
+ * on bbus_arena_reset() - bbus_obj_free() does nothing for such objects.
+ */
+bbus_object* bbus_obj_arena_alloc(bbus_arena* arena) BBUS_PUBLIC;
+
 /**
  * @brief Free an object.
  * @param obj The object - can be NULL.
@@ -865,6 +1127,38 @@ void bbus_obj_rewind(bbus_object* obj) BBUS_PUBLIC;
  */
 bbus_object* bbus_obj_frombuf(const void* buf, size_t bufsize) BBUS_PUBLIC;
 
+/**
+ * @brief Creates a read-only view of data stored in given buffer.
+ * @param buf The buffer.
+ * @param bufsize Size of the buffer.
+ * @return New object or NULL if no memory.
+ *
+ * Unlike bbus_obj_frombuf() the data is not copied - the buffer must stay
+ * valid for as long as the object is used. Data can be extracted from the
+ * view as from any other object, but inserting fails with BBUS_EOBJRDONLY.
+ * Freeing the view leaves the buffer untouched.
+ */
+bbus_object* bbus_obj_mkview(const void* buf, size_t bufsize) BBUS_PUBLIC;
+
+/**
+ * @brief Makes an object a read-only view of data stored in given buffer.
+ * @param obj The object.
+ * @param buf The buffer.
+ * @param bufsize Size of the buffer.
+ *
+ * Allows to reuse a single object for viewing subsequent buffers. Any data
+ * owned by the object is freed and the extraction position is rewound.
+ */
+void bbus_obj_setview(bbus_object* obj, const void* buf,
+					size_t bufsize) BBUS_PUBLIC;
+
+/**
+ * @brief Checks whether the object is a read-only view.
+ * @param obj The object.
+ * @return BBUS_TRUE if the object borrows its data, BBUS_FALSE otherwise.
+ */
+int bbus_obj_isview(const bbus_object* obj) BBUS_PUBLIC;
+
 /**
  * @brief Builds an object according to given description and arguments.
  * @param descr Valid object description.
@@ -872,6 +1166,18 @@ bbus_object* bbus_obj_frombuf(const void* buf, size_t bufsize) BBUS_PUBLIC;
  */
 bbus_object* bbus_obj_build(const char* descr, ...) BBUS_PUBLIC;
 
+/**
+ * @brief Builds an object in a memory arena.
+ * @param arena The arena.
+ * @param descr Valid object description.
+ * @return New object or NULL on error.
+ *
+ * Works like bbus_obj_build(), but the object is allocated using
+ * bbus_obj_arena_alloc().
+ */
+bbus_object* bbus_obj_arena_build(bbus_arena* arena,
+				const char* descr, ...) BBUS_PUBLIC;
+
 /**
  * @brief Builds an object according to given description and argument list.
  * @param descr Valid object description.
@@ -948,6 +1254,7 @@ int bbus_obj_repr(bbus_object* obj, const char* descr, char* buf,
 #define BBUS_MSGTYPE_CLOSE	0x0D /**< Client closes session. */
 #define BBUS_MSGTYPE_CTRL	0x0E /**< Control message. */
 #define BBUS_MSGTYPE_MON	0x0F /**< Monitoring message. */
+#define BBUS_MSGTYPE_CLIRESOLVE	0x10 /**< Client resolves a method. */
 /**
  * @}
  *
@@ -976,6 +1283,8 @@ int bbus_obj_repr(bbus_object* obj, const char* descr, char* buf,
 #define BBUS_PROT_ENOMETHOD	0x01 /**< No such method. */
 #define BBUS_PROT_EMETHODERR	0x02 /**< Error calling the method. */
 #define BBUS_PROT_EMREGERR	0x03 /**< Error registering the method. */
+#define BBUS_PROT_ESTALEHANDLE	0x04 /**< Method handle no longer valid. */
+#define BBUS_PROT_ETIMEDOUT	0x05 /**< Method call timed out. */
 /**
  * @}
  *
@@ -986,6 +1295,34 @@ int bbus_obj_repr(bbus_object* obj, const char* descr, char* buf,
  */
 #define BBUS_PROT_HASMETA	(1 << 0) /**< Message contains metadata. */
 #define BBUS_PROT_HASOBJECT	(1 << 1) /**< Message contains an object. */
+/**
+ * @brief Header is followed by a 32-bit payload size.
+ *
+ * Set by the library when sending messages with payloads bigger than
+ * UINT16_MAX, there's no need to set it manually.
+ */
+#define BBUS_PROT_EXTLEN	(1 << 2)
+/**
+ * @brief Method is called by its handle.
+ *
+ * Set in BBUS_MSGTYPE_CLICALL messages carrying the method handle in the
+ * 'token' field instead of the method name in the metadata.
+ */
+#define BBUS_PROT_METHODHANDLE	(1 << 3)
+/**
+ * @brief Header is followed by a 32-bit call identifier.
+ *
+ * Set in asynchronous method calls and in replies to them, see
+ * bbus_hdr_setcallid().
+ */
+#define BBUS_PROT_HASCALLID	(1 << 4)
+/**
+ * @brief Header is followed by a 32-bit call timeout.
+ *
+ * Set in method calls overriding the daemon's default call timeout,
+ * see bbus_hdr_settimeout().
+ */
+#define BBUS_PROT_HASTIMEOUT	(1 << 5)
 /**
  * @}
  */
@@ -1000,14 +1337,16 @@ struct bbus_msg_hdr
 	uint8_t sotype;		/**< Session open client type. */
 	uint8_t errcode;	/**< Protocol error code. */
 	uint32_t token;		/**< Used only for method calling. */
-	uint16_t psize;		/**< Size of the payload. */
+	uint32_t psize;		/**< Size of the payload. */
 	uint8_t flags;		/**< Various protocol flags. */
+	uint32_t callid;	/**< Identifies asynchronous calls. */
+	uint32_t timeout;	/**< Call timeout in milliseconds. */
 };
 
 /**
  * @brief Number of fields in the header.
  */
-#define BBUS_MSGHDR_NUMFIELDS	7
+#define BBUS_MSGHDR_NUMFIELDS	9
 
 /**
  * @brief Size of the busybus message header structure.
@@ -1016,20 +1355,35 @@ struct bbus_msg_hdr
 
 /**
  * @brief Real size of the busybus message header - without any padding space.
+ *
+ * Headers of messages with the BBUS_PROT_EXTLEN, BBUS_PROT_HASCALLID or
+ * BBUS_PROT_HASTIMEOUT flags set are followed by additional four bytes on
+ * the wire for each of these flags.
  */
 #define BBUS_MSGHDR_REALSIZE						\
 	(4*sizeof(uint8_t) + 2*sizeof(uint16_t) + sizeof(uint32_t))
 
 /**
- * @brief Biggest allowed payload size.
+ * @brief Payload size, that fits in a buffer of BBUS_MAXMSGSIZE bytes.
+ *
+ * Fixed-size buffers of BBUS_MAXMSGSIZE bytes are enough for all messages
+ * with payloads up to this size. Bigger messages are accepted up to the
+ * limit set with bbus_prot_setmaxpload() and must be received into
+ * buffers, that can grow.
  */
 #define BBUS_MAXPLOADSIZE	4096
 
 /**
- * @brief Biggest allowed message size.
+ * @brief Size of a message buffer fitting any payload up to
+ * BBUS_MAXPLOADSIZE bytes.
  */
 #define BBUS_MAXMSGSIZE		(BBUS_MSGHDR_SIZE + BBUS_MAXPLOADSIZE)
 
+/**
+ * @brief Default limit of the payload size.
+ */
+#define BBUS_PROT_DEFMAXPLOAD	(1024 * 1024)
+
 /**
  * @brief Represents a busybus message.
  */
@@ -1048,6 +1402,18 @@ struct bbus_msg
  */
 bbus_object* bbus_prot_extractobj(const struct bbus_msg* msg) BBUS_PUBLIC;
 
+/**
+ * @brief Locates the marshalled object in the message buffer.
+ * @param msg The message.
+ * @param size Place to store the size of the object data.
+ * @return Pointer to the object data or NULL if object not present.
+ *
+ * Unlike bbus_prot_extractobj() nothing is copied - the returned pointer
+ * is only valid as long as the message buffer.
+ */
+const void* bbus_prot_rawobj(const struct bbus_msg* msg,
+					size_t* size) BBUS_PUBLIC;
+
 /**
  * @brief Extracts the meta string from the message buffer.
  * @param msg The message.
@@ -1075,6 +1441,51 @@ void bbus_prot_setsockpath(const char* path) BBUS_PUBLIC;
  */
 const char* bbus_prot_getsockpath(void) BBUS_PUBLIC;
 
+/**
+ * @brief Sets the maximum payload size of sent and received messages.
+ * @param size New limit.
+ *
+ * Trying to send or receive a bigger message fails with BBUS_EMSGTOOBIG.
+ * Values smaller than BBUS_MAXPLOADSIZE or bigger than UINT32_MAX are
+ * rounded to the nearest of these two. This function is thread-safe.
+ */
+void bbus_prot_setmaxpload(size_t size) BBUS_PUBLIC;
+
+/**
+ * @brief Returns the maximum payload size of sent and received messages.
+ * @return Current limit.
+ */
+size_t bbus_prot_getmaxpload(void) BBUS_PUBLIC;
+
+/**
+ * @brief Socket I/O statistics of the calling process.
+ *
+ * Every send and receive system call issued by the library is counted,
+ * including those, that didn't transfer any data.
+ */
+struct bbus_iostats
+{
+	unsigned long rcvcalls;		/**< Receive system calls. */
+	unsigned long rcvbytes;		/**< Bytes received. */
+	unsigned long rcvmsgs;		/**< Complete messages received. */
+	unsigned long sndcalls;		/**< Send system calls. */
+	unsigned long sndbytes;		/**< Bytes sent. */
+	unsigned long sndmsgs;		/**< Complete messages sent or queued. */
+};
+
+/**
+ * @brief Retrieves the I/O statistics.
+ * @param stats Structure to fill.
+ *
+ * This function is thread-safe.
+ */
+void bbus_iostats_get(struct bbus_iostats* stats) BBUS_PUBLIC;
+
+/**
+ * @brief Resets all I/O statistics counters to zero.
+ */
+void bbus_iostats_reset(void) BBUS_PUBLIC;
+
 /**
  * @defgroup __header__ Header structure manipulation
  * @{
@@ -1107,6 +1518,35 @@ unsigned bbus_hdr_gettoken(const struct bbus_msg_hdr* hdr) BBUS_PUBLIC;
  */
 void bbus_hdr_settoken(struct bbus_msg_hdr* hdr, unsigned tok) BBUS_PUBLIC;
 
+/**
+ * @brief Returns the call identifier from the header in host byte order.
+ * @param hdr The header.
+ * @return The call identifier, meaningful only if BBUS_PROT_HASCALLID is set.
+ */
+uint32_t bbus_hdr_getcallid(const struct bbus_msg_hdr* hdr) BBUS_PUBLIC;
+
+/**
+ * @brief Assigns the call identifier to 'hdr' and sets BBUS_PROT_HASCALLID.
+ * @param hdr The header.
+ * @param callid The call identifier.
+ */
+void bbus_hdr_setcallid(struct bbus_msg_hdr* hdr, uint32_t callid) BBUS_PUBLIC;
+
+/**
+ * @brief Returns the call timeout from the header in host byte order.
+ * @param hdr The header.
+ * @return Timeout in milliseconds, meaningful only if BBUS_PROT_HASTIMEOUT
+ *         is set.
+ */
+uint32_t bbus_hdr_gettimeout(const struct bbus_msg_hdr* hdr) BBUS_PUBLIC;
+
+/**
+ * @brief Assigns the call timeout to 'hdr' and sets BBUS_PROT_HASTIMEOUT.
+ * @param hdr The header.
+ * @param msec Timeout in milliseconds.
+ */
+void bbus_hdr_settimeout(struct bbus_msg_hdr* hdr, uint32_t msec) BBUS_PUBLIC;
+
 /**
  * @brief Returns the payload size from the header in host byte order.
  * @param hdr The header.
@@ -1119,7 +1559,7 @@ size_t bbus_hdr_getpsize(const struct bbus_msg_hdr* hdr) BBUS_PUBLIC;
  * @param hdr The header.
  * @param size New size.
  *
- * If 'size' exceeds UINT16_MAX, the size will be set exactly to UINT16_MAX.
+ * If 'size' exceeds UINT32_MAX, the size will be set exactly to UINT32_MAX.
  */
 void bbus_hdr_setpsize(struct bbus_msg_hdr* hdr, size_t size) BBUS_PUBLIC;
 
@@ -1151,8 +1591,6 @@ void bbus_hdr_setpsize(struct bbus_msg_hdr* hdr, size_t size) BBUS_PUBLIC;
  * Functions used by method calling clients.
  */
 
-/* TODO Asynchronous calls. */
-
 /**
  * @brief Opaque type representing a client connection.
  */
@@ -1175,6 +1613,131 @@ bbus_client_connection* bbus_connect(const char* name) BBUS_PUBLIC;
 bbus_object* bbus_callmethod(bbus_client_connection* conn,
 		const char* method, bbus_object* arg) BBUS_PUBLIC;
 
+/**
+ * @brief Calls a method synchronously without copying the returned data.
+ * @param conn The client connection.
+ * @param method Full service and method name.
+ * @param arg Marshalled arguments.
+ * @return Read-only view of the returned data or NULL if error.
+ *
+ * Works like bbus_callmethod(), but the returned object is a view of the
+ * connection's receive buffer (see bbus_obj_mkview()). It belongs to the
+ * connection, must not be freed and stays valid only until the next call
+ * made using the same connection.
+ */
+bbus_object* bbus_callmethod_view(bbus_client_connection* conn,
+		const char* method, bbus_object* arg) BBUS_PUBLIC;
+
+/**
+ * @brief Compact identifier of a method assigned by the busybus daemon.
+ *
+ * Handles stay valid for as long as the method stays registered. Once the
+ * service providing the method disconnects, calls using the old handle
+ * fail with BBUS_ESTALEHANDLE even if the method gets registered again -
+ * it must be resolved anew in that case.
+ */
+typedef uint32_t bbus_method_handle;
+
+/**
+ * @brief Value never assigned to any method.
+ */
+#define BBUS_METHOD_NOHANDLE	((bbus_method_handle)0)
+
+/**
+ * @brief Resolves the method name to a handle.
+ * @param conn The client connection.
+ * @param method Full service and method name.
+ * @return Method handle or BBUS_METHOD_NOHANDLE if error.
+ */
+bbus_method_handle bbus_resolvemethod(bbus_client_connection* conn,
+		const char* method) BBUS_PUBLIC;
+
+/**
+ * @brief Calls a method synchronously using its handle.
+ * @param conn The client connection.
+ * @param handle Method handle returned by bbus_resolvemethod().
+ * @param arg Marshalled arguments.
+ * @return Returned marshalled data or NULL if error.
+ *
+ * Works like bbus_callmethod(), but only the handle is sent to the daemon,
+ * which spares it the method name lookup.
+ */
+bbus_object* bbus_callmethod_id(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg) BBUS_PUBLIC;
+
+/**
+ * @brief Calls a method using its handle without copying the returned data.
+ * @param conn The client connection.
+ * @param handle Method handle returned by bbus_resolvemethod().
+ * @param arg Marshalled arguments.
+ * @return Read-only view of the returned data or NULL if error.
+ *
+ * Combines bbus_callmethod_id() with bbus_callmethod_view().
+ */
+bbus_object* bbus_callmethod_id_view(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg) BBUS_PUBLIC;
+
+/**
+ * @brief Identifies an asynchronous method call.
+ */
+typedef uint32_t bbus_call_token;
+
+/**
+ * @brief Value never assigned to any asynchronous call.
+ */
+#define BBUS_CALL_NOTOKEN	((bbus_call_token)0)
+
+/**
+ * @brief Calls a method asynchronously.
+ * @param conn The client connection.
+ * @param method Full service and method name.
+ * @param arg Marshalled arguments.
+ * @return Token identifying the call or BBUS_CALL_NOTOKEN if error.
+ *
+ * Returns as soon as the call has been sent. Any number of calls can be
+ * in flight on a single connection, their replies are received using
+ * bbus_poll_replies() in whatever order the services answer. Synchronous
+ * calls can still be made on the same connection in the meantime.
+ */
+bbus_call_token bbus_callmethod_async(bbus_client_connection* conn,
+		const char* method, bbus_object* arg) BBUS_PUBLIC;
+
+/**
+ * @brief Calls a method asynchronously using its handle.
+ * @param conn The client connection.
+ * @param handle Method handle returned by bbus_resolvemethod().
+ * @param arg Marshalled arguments.
+ * @return Token identifying the call or BBUS_CALL_NOTOKEN if error.
+ */
+bbus_call_token bbus_callmethod_id_async(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg) BBUS_PUBLIC;
+
+/**
+ * @brief Function called for every received asynchronous reply.
+ *
+ * Takes the token of the call, the returned data and the private pointer
+ * passed to bbus_poll_replies(). The returned object is a read-only view,
+ * which must not be freed and stays valid only until the function
+ * returns. If the call failed it's NULL and bbus_lasterror() tells why.
+ */
+typedef void (*bbus_reply_func)(bbus_call_token, bbus_object*, void*);
+
+/**
+ * @brief Receives the replies to asynchronous calls.
+ * @param conn The client connection.
+ * @param tv Maximum time to wait for the first reply.
+ * @param func Function called for every reply.
+ * @param priv Private data passed to func.
+ * @return Number of replies handled, 0 on timeout, -1 on error.
+ *
+ * Waits at most 'tv' for a reply, then handles all replies that can be
+ * received without waiting any longer. With a zero timeout the function
+ * never blocks and can be called whenever the descriptor returned by
+ * bbus_getfd() becomes readable.
+ */
+int bbus_poll_replies(bbus_client_connection* conn, struct bbus_timeval* tv,
+			bbus_reply_func func, void* priv) BBUS_PUBLIC;
+
 /**
  * @brief Emits a signal.
  * @param conn The client connection.
@@ -1185,6 +1748,18 @@ bbus_object* bbus_callmethod(bbus_client_connection* conn,
 int bbus_emitsignal(bbus_client_connection* conn,
 		const char* signame, bbus_object* obj) BBUS_PUBLIC;
 
+/**
+ * @brief Sets the timeout of method calls made using this connection.
+ * @param conn The client connection.
+ * @param msec Timeout in milliseconds, 0 restores the daemon's default.
+ *
+ * Calls not replied to in time fail with BBUS_ETIMEDOUT. The timeout is
+ * enforced by the busybus daemon and only applies to methods provided by
+ * services.
+ */
+void bbus_setcalltimeout(bbus_client_connection* conn,
+				unsigned msec) BBUS_PUBLIC;
+
 /**
  * @brief Closes the client connection.
  * @param conn The client connection to close.
@@ -1192,6 +1767,21 @@ int bbus_emitsignal(bbus_client_connection* conn,
  */
 int bbus_closeconn(bbus_client_connection* conn) BBUS_PUBLIC;
 
+/**
+ * @brief Returns the file descriptor of a client connection.
+ * @param conn The client or monitor connection.
+ * @return Socket descriptor, which can be polled for readability.
+ *
+ * Allows waiting for replies or monitoring messages in an external event
+ * loop, also edge-triggered: after a readability event, bbus_poll_replies()
+ * or bbus_mon_recvmsg() called with a zero timeout consume everything that
+ * has arrived. Replies received during a synchronous call are stored in the
+ * connection without making the descriptor readable, so bbus_poll_replies()
+ * should be called after synchronous calls too. The descriptor must not be
+ * read from, written to or closed.
+ */
+int bbus_getfd(bbus_client_connection* conn) BBUS_PUBLIC;
+
 /**
  * @defgroup __monctl__ Control and monitoring
  * @{
@@ -1243,6 +1833,9 @@ typedef struct __bbus_service_connection bbus_service_connection;
 
 /**
  * @brief Represents a function that is actually being called on method call.
+ *
+ * The argument is a read-only view of the received message and is only
+ * valid until the function returns.
  */
 typedef bbus_object* (*bbus_method_func)(bbus_object*);
 
@@ -1304,6 +1897,74 @@ int bbus_srvc_closeconn(bbus_service_connection* conn) BBUS_PUBLIC;
 int bbus_srvc_listencalls(bbus_service_connection* conn,
 		struct bbus_timeval* tv) BBUS_PUBLIC;
 
+/**
+ * @brief Handles all the method calls already received on a connection.
+ * @param conn The service publisher connection.
+ * @param tv Time after which the function will exit with a timeout status.
+ * @param maxcalls Maximum number of calls handled at once.
+ * @return Number of calls handled, 0 if timed out or -1 on error.
+ *
+ * Waits for the first call like bbus_srvc_listencalls(), but then keeps
+ * handling the calls, which have already arrived, until there are none
+ * left or maxcalls is reached. The replies are sent together, so the
+ * callers may wait for them longer with a bigger maxcalls. Failing
+ * methods are reported to the callers and don't count as errors.
+ */
+int bbus_srvc_draincalls(bbus_service_connection* conn,
+		struct bbus_timeval* tv, unsigned maxcalls) BBUS_PUBLIC;
+
+/**
+ * @brief Handles the method calls, that have arrived, without blocking.
+ * @param conn The service publisher connection.
+ * @param maxcalls Maximum number of calls handled at once.
+ * @return Number of calls handled or -1 on error.
+ *
+ * Same as bbus_srvc_draincalls(), but doesn't wait for the first call,
+ * nor for the rest of a call, that has only partially arrived. Meant to be
+ * called when the descriptor returned by bbus_srvc_getfd() becomes
+ * readable. Returning less than maxcalls means that the socket has been
+ * emptied, otherwise more calls may be pending and the function should be
+ * called again before waiting for the next readability event.
+ */
+int bbus_srvc_processcalls(bbus_service_connection* conn,
+		unsigned maxcalls) BBUS_PUBLIC;
+
+/**
+ * @brief Returns the file descriptor of a service connection.
+ * @param conn The service publisher connection.
+ * @return Socket descriptor, which can be polled for readability.
+ *
+ * Allows integrating the service into an external event loop, see
+ * bbus_srvc_processcalls(). The descriptor must not be read from, written
+ * to or closed.
+ */
+int bbus_srvc_getfd(bbus_service_connection* conn) BBUS_PUBLIC;
+
+/**
+ * @brief Serves method calls using a pool of worker threads.
+ * @param conn The service publisher connection.
+ * @param nthreads Number of worker threads executing the methods.
+ * @return 0 if stopped with bbus_srvc_stop(), -1 on error.
+ *
+ * The calling thread reads the calls and hands them over to the workers,
+ * so that a slow method doesn't hold up the others. Replies are sent back
+ * in the order in which the methods complete. Method functions must be
+ * thread-safe and no methods may be registered or unregistered while
+ * this function is running. Returns only when stopped or when the
+ * connection fails, after the calls already received have been served.
+ */
+int bbus_srvc_run(bbus_service_connection* conn,
+		unsigned nthreads) BBUS_PUBLIC;
+
+/**
+ * @brief Makes bbus_srvc_run() return.
+ * @param conn The service publisher connection.
+ *
+ * Can be called from any thread, including the method functions. If
+ * bbus_srvc_run() isn't running, its next invocation returns immediately.
+ */
+void bbus_srvc_stop(bbus_service_connection* conn) BBUS_PUBLIC;
+
 /* TODO Listening on multiple connections. */
 
 /**
@@ -1375,6 +2036,20 @@ int bbus_client_gettype(bbus_client* cli) BBUS_PUBLIC;
  */
 const char* bbus_client_getname(bbus_client* cli) BBUS_PUBLIC;
 
+/**
+ * @brief Associates user data with a client object.
+ * @param cli The client.
+ * @param priv Pointer to the user data.
+ */
+void bbus_client_setpriv(bbus_client* cli, void* priv) BBUS_PUBLIC;
+
+/**
+ * @brief Returns the user data associated with a client object.
+ * @param cli The client.
+ * @return Pointer set with bbus_client_setpriv() or NULL if none was set.
+ */
+void* bbus_client_getpriv(bbus_client* cli) BBUS_PUBLIC;
+
 /**
  * @brief Receive a full message from client.
  * @param cli The client.
@@ -1385,17 +2060,138 @@ const char* bbus_client_getname(bbus_client* cli) BBUS_PUBLIC;
 int bbus_client_rcvmsg(bbus_client* cli, struct bbus_msg* buf,
 		size_t bufsize) BBUS_PUBLIC;
 
+/**
+ * @brief Receive a message from client without blocking.
+ * @param cli The client.
+ * @param buf Address of the buffer for the message to be stored in.
+ * @param bufsize Address of the size of the buffer.
+ * @return 1 if a full message has been received, 0 if more data is needed,
+ * -1 on error.
+ *
+ * The buffer must be either NULL or allocated with bbus_malloc(). It's
+ * reallocated if the message doesn't fit, in which case both '*buf' and
+ * '*bufsize' are updated. The caller is responsible for freeing it.
+ *
+ * Data is read from the socket in large chunks, so a single read can bring
+ * in several messages - those are returned by subsequent calls without
+ * touching the socket. Parts of a message, that arrived so far are kept in
+ * the client object, so the function can simply be called again once the
+ * client becomes readable. The buffer doesn't need to be preserved between
+ * calls. Must not be mixed with bbus_client_rcvmsg() while any data remains
+ * buffered.
+ *
+ * A return value of 0 means the caller should wait until the socket is
+ * readable before calling this function again.
+ */
+int bbus_client_tryrcvmsg(bbus_client* cli, struct bbus_msg** buf,
+		size_t* bufsize) BBUS_PUBLIC;
+
+/**
+ * @brief Checks whether a complete message is already buffered.
+ * @param cli The client.
+ * @return BBUS_TRUE if bbus_client_tryrcvmsg() can return a message without
+ * reading from the socket, BBUS_FALSE otherwise.
+ *
+ * Buffered messages don't make the socket readable, so a caller, that
+ * stops receiving before bbus_client_tryrcvmsg() returns 0 must check this
+ * before going back to polling.
+ */
+int bbus_client_rcvpending(bbus_client* cli) BBUS_PUBLIC;
+
 /**
  * @brief Send a full message to the client.
  * @param cli The client.
  * @param hdr Header of the message to send.
  * @param meta Meta data of the message (can be NULL).
  * @param obj Marshalled data to send (can be NULL).
- * @return 0 if a full message has been properly sent, -1 on error.
+ * @return 0 if a full message has been sent or queued, -1 on error.
+ *
+ * This function never blocks. Whatever can't be written to the socket
+ * immediately is stored in the client's outbound queue and sent from
+ * within bbus_poll() once the socket becomes writable, provided the client
+ * is stored in a pollset. If there's no room left in the queue, the
+ * function fails with BBUS_EQUEUEFULL and nothing is sent.
+ *
+ * Can be called for the same client from several threads at once.
  */
 int bbus_client_sendmsg(bbus_client* cli, struct bbus_msg_hdr* hdr,
 		const char* meta, bbus_object* obj) BBUS_PUBLIC;
 
+/**
+ * @brief Send a message with already marshalled object data.
+ * @param cli The client.
+ * @param hdr Header of the message to send.
+ * @param meta Meta data of the message (can be NULL).
+ * @param obj Marshalled object data (can be NULL).
+ * @param objsize Size of the object data.
+ * @return 0 if a full message has been sent or queued, -1 on error.
+ *
+ * Works exactly like bbus_client_sendmsg(), but allows to pass on object
+ * data received with another message (see bbus_prot_rawobj()) without
+ * unmarshalling it first.
+ */
+int bbus_client_sendraw(bbus_client* cli, struct bbus_msg_hdr* hdr,
+		const char* meta, const void* obj, size_t objsize) BBUS_PUBLIC;
+
+/**
+ * @brief Default limit of data waiting in the client's outbound queue.
+ */
+#define BBUS_CLIENT_DEFMAXQUEUED	(256 * 1024)
+
+/**
+ * @brief Sets the maximum number of bytes waiting in the outbound queue.
+ * @param cli The client.
+ * @param max New limit.
+ *
+ * Once the socket refuses data and more than this many bytes are still
+ * waiting, further messages are rejected by bbus_client_sendmsg(). Data
+ * queued only because the sending thread is corked doesn't count, nor does
+ * the message being sent. A partially sent message is always queued in full
+ * and so is any message if the queue is empty. Every message received from
+ * the client lets one more message over the limit - a client, that keeps
+ * sending is busy, not stuck - but never once twice as many bytes are
+ * waiting.
+ */
+void bbus_client_setmaxqueued(bbus_client* cli, size_t max) BBUS_PUBLIC;
+
+/**
+ * @brief Returns the number of bytes waiting in the outbound queue.
+ * @param cli The client.
+ * @return Number of queued bytes.
+ */
+size_t bbus_client_queued(bbus_client* cli) BBUS_PUBLIC;
+
+/**
+ * @brief Starts batching messages sent by the calling thread.
+ *
+ * Until bbus_client_uncork() is called, bbus_client_sendmsg() only appends
+ * messages to the outbound queues. This way several messages for the same
+ * client are written with a single system call. Calls can be nested.
+ *
+ * Clients, that messages were sent to must not be freed before
+ * bbus_client_uncork() is called.
+ */
+void bbus_client_cork(void) BBUS_PUBLIC;
+
+/**
+ * @brief Sends all messages batched since bbus_client_cork().
+ *
+ * Does nothing but decrease the nesting level if called from within nested
+ * bbus_client_cork() calls. Whatever can't be sent without blocking is left
+ * in the outbound queues, same as in bbus_client_sendmsg().
+ */
+void bbus_client_uncork(void) BBUS_PUBLIC;
+
+/**
+ * @brief Shuts down the client connection without closing the socket.
+ * @param cli The client.
+ * @return 0 on success, -1 on error.
+ *
+ * Can be used to disconnect a client handled by another thread - the
+ * connection will be reported as readable and subsequent reads will fail.
+ */
+int bbus_client_shutdown(bbus_client* cli) BBUS_PUBLIC;
+
 /**
  * @brief Closes the client connection.
  * @param cli The client.
@@ -1505,6 +2301,10 @@ void bbus_srv_free(bbus_server* srv) BBUS_PUBLIC;
  * Set of functions and data structures allowing for easy polling for events
  * on multiple server and client objects. Used by the busybus daemon
  * implementation to limit it to a single thread only.
+ *
+ * Objects are registered with a pollset once and stay there until they're
+ * explicitly removed, so the cost of a single poll depends on the number
+ * of objects ready for I/O, not on the number of registered objects.
  */
 
 /**
@@ -1516,12 +2316,12 @@ typedef struct __bbus_pollset bbus_pollset;
 
 /**
  * @brief Creates and empty pollset object.
- * @return Pointer to a new pollset object or NULL if no memory.
+ * @return Pointer to a new pollset object or NULL on error.
  */
 bbus_pollset* bbus_pollset_make(void) BBUS_PUBLIC;
 
 /**
- * @brief Clears an existing pollset object.
+ * @brief Removes all objects from an existing pollset object.
  * @param pset The pollset.
  */
 void bbus_pollset_clear(bbus_pollset* pset) BBUS_PUBLIC;
@@ -1529,16 +2329,30 @@ void bbus_pollset_clear(bbus_pollset* pset) BBUS_PUBLIC;
 /**
  * @brief Adds a server object to the pollset.
  * @param pset The pollset.
- * @param src The server.
+ * @param srv The server.
+ * @return 0 on success, -1 on error.
  */
-void bbus_pollset_addsrv(bbus_pollset* pset, bbus_server* src) BBUS_PUBLIC;
+int bbus_pollset_addsrv(bbus_pollset* pset, bbus_server* srv) BBUS_PUBLIC;
 
 /**
  * @brief Adds a client to the pollset.
  * @param pset The pollset.
  * @param cli The client.
+ * @return 0 on success, -1 on error.
+ *
+ * A client object can be stored in only one pollset at a time.
  */
-void bbus_pollset_addcli(bbus_pollset* pset, bbus_client* cli) BBUS_PUBLIC;
+int bbus_pollset_addcli(bbus_pollset* pset, bbus_client* cli) BBUS_PUBLIC;
+
+/**
+ * @brief Removes a client from the pollset.
+ * @param pset The pollset.
+ * @param cli The client.
+ * @return 0 on success, -1 on error.
+ *
+ * Must be called before the client connection is closed.
+ */
+int bbus_pollset_rmcli(bbus_pollset* pset, bbus_client* cli) BBUS_PUBLIC;
 
 /**
  * @brief Performs an I/O poll on all the objects set within 'pset'.
@@ -1566,6 +2380,17 @@ int bbus_pollset_srvisset(bbus_pollset* pset, bbus_server* srv) BBUS_PUBLIC;
  */
 int bbus_pollset_cliisset(bbus_pollset* pset, bbus_client* cli) BBUS_PUBLIC;
 
+/**
+ * @brief Returns the next client found ready by the last call to bbus_poll().
+ * @param pset The pollset.
+ * @return Next ready client or NULL if there are no more ready clients.
+ *
+ * Allows to iterate over ready clients only, without checking every client
+ * stored in the pollset. Clients removed from the pollset after the poll
+ * are skipped.
+ */
+bbus_client* bbus_pollset_nextcli(bbus_pollset* pset) BBUS_PUBLIC;
+
 /**
  * @brief Disposes of a pollset object.
  * @param pset The pollset to free.
@@ -17,10 +17,37 @@
 #include "socket.h"
 #include "error.h"
 #include <string.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
 
 struct __bbus_client_connection
 {
 	int sock;
+	/* Grown to fit the biggest message received so far. */
+	struct bbus_msg* rcvbuf;
+	size_t rcvbufsize;
+	/* Messages read ahead from the socket. */
+	struct __bbus_prot_rcvctx rcvctx;
+	/* Reused to view the objects received in rcvbuf. */
+	bbus_object* view;
+	/* Identifier of the last asynchronous call. */
+	bbus_call_token curcallid;
+	/* Async replies received while waiting for a synchronous one. */
+	struct bbus_list queued;
+	/* Call timeout in milliseconds, 0 if the daemon decides. */
+	unsigned timeout;
+};
+
+struct queued_msg
+{
+	struct queued_msg* next;
+	struct queued_msg* prev;
+	struct bbus_msg* msg;
+	/* Size of the buffer msg points to. */
+	size_t bufsize;
 };
 
 struct __bbus_service_connection
@@ -28,8 +55,36 @@ struct __bbus_service_connection
 	int sock;
 	char* srvname;
 	bbus_hashmap* methods;
+	/* Grown to fit the biggest message received so far. */
+	struct bbus_msg* rcvbuf;
+	size_t rcvbufsize;
+	/* Calls read ahead from the socket. */
+	struct __bbus_prot_rcvctx rcvctx;
+	/* Reused to view the objects received in rcvbuf. */
+	bbus_object* view;
+	/* Serializes the replies sent by bbus_srvc_run() workers. */
+	pthread_mutex_t sendlock;
+	/* Set by bbus_srvc_stop(). */
+	int stop;
+	/* Wakes bbus_srvc_run() up when it's stopped. */
+	int wakefd;
 };
 
+/*
+ * Points the view at the data in the receive buffer, the view is only
+ * allocated once per connection.
+ */
+static bbus_object* view_data(bbus_object** view,
+				const void* buf, size_t size)
+{
+	if (*view == NULL)
+		*view = bbus_obj_mkview(buf, size);
+	else
+		bbus_obj_setview(*view, buf, size);
+
+	return *view;
+}
+
 static int do_session_open(const char* path, int clitype, const char* name)
 {
 	int r;
@@ -106,55 +161,350 @@ bbus_client_connection* bbus_connect(const char* name)
 	if (sock < 0)
 		return NULL;
 
-	conn = bbus_malloc(sizeof(struct __bbus_client_connection));
+	conn = bbus_malloc0(sizeof(struct __bbus_client_connection));
 	if (conn == NULL)
 		return NULL;
 	conn->sock = sock;
+	__bbus_prot_rcvctx_init(&conn->rcvctx);
 	return conn;
 }
 
-bbus_object* bbus_callmethod(bbus_client_connection* conn,
-		const char* method, bbus_object* arg)
+/*
+ * Copies a message out of the receive buffer, so that it can be handled
+ * after the buffer has been reused.
+ */
+static struct queued_msg* copy_msg(const struct bbus_msg* msg)
 {
-	int r;
-	struct bbus_msg_hdr hdr;
-	size_t metasize;
-	size_t objsize;
-	char buf[BBUS_MAXMSGSIZE];
+	struct queued_msg* qmsg;
+	size_t msgsize;
 
-	metasize = strlen(method) + 1;
-	objsize = bbus_obj_rawsize(arg);
-	memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
-	__bbus_prot_hdrsetmagic(&hdr);
-	hdr.msgtype = BBUS_MSGTYPE_CLICALL;
-	bbus_hdr_setpsize(&hdr, metasize + objsize);
-	BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
-	BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+	qmsg = bbus_malloc(sizeof(struct queued_msg));
+	if (qmsg == NULL)
+		return NULL;
 
-	r = __bbus_prot_sendvmsg(conn->sock, &hdr, method,
-			bbus_obj_rawdata(arg), objsize);
-	if (r < 0)
+	msgsize = BBUS_MSGHDR_SIZE + bbus_hdr_getpsize(&msg->hdr);
+	qmsg->msg = bbus_malloc(msgsize);
+	if (qmsg->msg == NULL) {
+		bbus_free(qmsg);
 		return NULL;
+	}
 
-	memset(&hdr, 0, BBUS_MSGHDR_SIZE);
-	memset(buf, 0, BBUS_MAXMSGSIZE);
-	r = __bbus_prot_recvvmsg(conn->sock, &hdr, buf,
-			BBUS_MAXMSGSIZE - BBUS_MSGHDR_SIZE);
+	memcpy(qmsg->msg, msg, msgsize);
+	qmsg->bufsize = msgsize;
+	return qmsg;
+}
+
+static void free_msg(struct queued_msg* qmsg)
+{
+	bbus_free(qmsg->msg);
+	bbus_free(qmsg);
+}
+
+static void free_msglist(struct bbus_list* list)
+{
+	struct queued_msg* qmsg;
+
+	while ((qmsg = (struct queued_msg*)list->head) != NULL) {
+		bbus_list_rm(list, qmsg);
+		free_msg(qmsg);
+	}
+}
+
+static int queue_reply(bbus_client_connection* conn,
+				const struct bbus_msg* msg)
+{
+	struct queued_msg* reply;
+
+	reply = copy_msg(msg);
+	if (reply == NULL)
+		return -1;
+
+	bbus_list_push(&conn->queued, reply);
+	return 0;
+}
+
+static int send_request(bbus_client_connection* conn,
+		struct bbus_msg_hdr* hdr, const char* meta, bbus_object* arg)
+{
+	__bbus_prot_hdrsetmagic(hdr);
+	if (hdr->msgtype == BBUS_MSGTYPE_CLICALL && conn->timeout > 0)
+		bbus_hdr_settimeout(hdr, conn->timeout);
+
+	return __bbus_prot_sendvmsg(conn->sock, hdr, meta,
+			arg == NULL ? NULL : bbus_obj_rawdata(arg),
+			arg == NULL ? 0 : bbus_obj_rawsize(arg));
+}
+
+/*
+ * Receives a message into the connection's receive buffer. Waits for it no
+ * longer than tv (indefinitely if NULL). A message, that has already started
+ * arriving, is received whole, unless tv is zero - then the function never
+ * blocks. Returns 1 if a message has been received, 0 on timeout and -1 on
+ * error.
+ */
+static int recv_msg(bbus_client_connection* conn, struct bbus_timeval* tv)
+{
+	struct bbus_timeval* wait;
+	int r;
+
+	for (;;) {
+		r = __bbus_prot_tryrecvmsg(conn->sock, &conn->rcvctx,
+					&conn->rcvbuf, &conn->rcvbufsize);
+		if (r != 0)
+			return r;
+
+		wait = tv;
+		if (conn->rcvctx.len > 0 && tv != NULL
+					&& (tv->sec > 0 || tv->usec > 0))
+			wait = NULL;
+
+		r = __bbus_sock_rdready(conn->sock, wait);
+		if (r <= 0)
+			return r;
+	}
+}
+
+/*
+ * Sends the message and waits for the daemon's reply. Returns the reply
+ * stored in the connection's receive buffer. Replies to asynchronous calls
+ * received in the meantime are queued for bbus_poll_replies().
+ */
+static struct bbus_msg* do_request(bbus_client_connection* conn,
+		struct bbus_msg_hdr* hdr, const char* meta, bbus_object* arg)
+{
+	int r;
+	struct bbus_msg* msg;
+
+	r = send_request(conn, hdr, meta, arg);
 	if (r < 0)
 		return NULL;
 
-	if (hdr.msgtype == BBUS_MSGTYPE_CLIREPLY) {
-		if (hdr.errcode != 0) {
-			__bbus_seterr(__bbus_prot_errtoerrnum(hdr.errcode));
+	for (;;) {
+		r = recv_msg(conn, NULL);
+		if (r < 0)
+			return NULL;
+
+		msg = conn->rcvbuf;
+		if (!BBUS_HDR_ISFLAGSET(&msg->hdr, BBUS_PROT_HASCALLID))
+			break;
+
+		r = queue_reply(conn, msg);
+		if (r < 0)
+			return NULL;
+	}
+
+	if (msg->hdr.msgtype == BBUS_MSGTYPE_CLIREPLY) {
+		if (msg->hdr.errcode != 0) {
+			__bbus_seterr(
+				__bbus_prot_errtoerrnum(msg->hdr.errcode));
 			return NULL;
 		}
-		return bbus_obj_frombuf(buf, BBUS_MAXMSGSIZE);
+		return msg;
 	} else {
 		__bbus_seterr(BBUS_EMSGINVTYPRCVD);
 		return NULL;
 	}
 }
 
+static void mkcallhdr(struct bbus_msg_hdr* hdr,
+		const char* method, bbus_object* arg)
+{
+	memset(hdr, 0, sizeof(struct bbus_msg_hdr));
+	hdr->msgtype = BBUS_MSGTYPE_CLICALL;
+	bbus_hdr_setpsize(hdr, strlen(method) + 1 + bbus_obj_rawsize(arg));
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASMETA);
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASOBJECT);
+}
+
+static void mkcallhdr_id(struct bbus_msg_hdr* hdr,
+		bbus_method_handle handle, bbus_object* arg)
+{
+	memset(hdr, 0, sizeof(struct bbus_msg_hdr));
+	hdr->msgtype = BBUS_MSGTYPE_CLICALL;
+	bbus_hdr_settoken(hdr, handle);
+	bbus_hdr_setpsize(hdr, bbus_obj_rawsize(arg));
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_METHODHANDLE);
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASOBJECT);
+}
+
+static struct bbus_msg* do_callmethod(bbus_client_connection* conn,
+		const char* method, bbus_object* arg)
+{
+	struct bbus_msg_hdr hdr;
+
+	mkcallhdr(&hdr, method, arg);
+	return do_request(conn, &hdr, method, arg);
+}
+
+static struct bbus_msg* do_callmethod_id(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg)
+{
+	struct bbus_msg_hdr hdr;
+
+	mkcallhdr_id(&hdr, handle, arg);
+	return do_request(conn, &hdr, NULL, arg);
+}
+
+bbus_object* bbus_callmethod(bbus_client_connection* conn,
+		const char* method, bbus_object* arg)
+{
+	struct bbus_msg* msg;
+
+	msg = do_callmethod(conn, method, arg);
+	if (msg == NULL)
+		return NULL;
+
+	return bbus_obj_frombuf(msg->payload, bbus_hdr_getpsize(&msg->hdr));
+}
+
+bbus_object* bbus_callmethod_view(bbus_client_connection* conn,
+		const char* method, bbus_object* arg)
+{
+	struct bbus_msg* msg;
+
+	msg = do_callmethod(conn, method, arg);
+	if (msg == NULL)
+		return NULL;
+
+	return view_data(&conn->view, msg->payload,
+				bbus_hdr_getpsize(&msg->hdr));
+}
+
+bbus_method_handle bbus_resolvemethod(bbus_client_connection* conn,
+		const char* method)
+{
+	struct bbus_msg_hdr hdr;
+	struct bbus_msg* msg;
+
+	memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
+	hdr.msgtype = BBUS_MSGTYPE_CLIRESOLVE;
+	bbus_hdr_setpsize(&hdr, strlen(method) + 1);
+	BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
+
+	msg = do_request(conn, &hdr, method, NULL);
+	if (msg == NULL)
+		return BBUS_METHOD_NOHANDLE;
+
+	return bbus_hdr_gettoken(&msg->hdr);
+}
+
+bbus_object* bbus_callmethod_id(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg)
+{
+	struct bbus_msg* msg;
+
+	msg = do_callmethod_id(conn, handle, arg);
+	if (msg == NULL)
+		return NULL;
+
+	return bbus_obj_frombuf(msg->payload, bbus_hdr_getpsize(&msg->hdr));
+}
+
+bbus_object* bbus_callmethod_id_view(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg)
+{
+	struct bbus_msg* msg;
+
+	msg = do_callmethod_id(conn, handle, arg);
+	if (msg == NULL)
+		return NULL;
+
+	return view_data(&conn->view, msg->payload,
+				bbus_hdr_getpsize(&msg->hdr));
+}
+
+static bbus_call_token send_async(bbus_client_connection* conn,
+		struct bbus_msg_hdr* hdr, const char* meta, bbus_object* arg)
+{
+	int r;
+
+	if (++conn->curcallid == BBUS_CALL_NOTOKEN)
+		++conn->curcallid;
+	bbus_hdr_setcallid(hdr, conn->curcallid);
+
+	r = send_request(conn, hdr, meta, arg);
+	if (r < 0)
+		return BBUS_CALL_NOTOKEN;
+
+	return conn->curcallid;
+}
+
+bbus_call_token bbus_callmethod_async(bbus_client_connection* conn,
+		const char* method, bbus_object* arg)
+{
+	struct bbus_msg_hdr hdr;
+
+	mkcallhdr(&hdr, method, arg);
+	return send_async(conn, &hdr, method, arg);
+}
+
+bbus_call_token bbus_callmethod_id_async(bbus_client_connection* conn,
+		bbus_method_handle handle, bbus_object* arg)
+{
+	struct bbus_msg_hdr hdr;
+
+	mkcallhdr_id(&hdr, handle, arg);
+	return send_async(conn, &hdr, NULL, arg);
+}
+
+static void deliver_reply(bbus_client_connection* conn,
+		const struct bbus_msg* msg, bbus_reply_func func, void* priv)
+{
+	bbus_object* ret = NULL;
+
+	if (msg->hdr.errcode != 0) {
+		__bbus_seterr(__bbus_prot_errtoerrnum(msg->hdr.errcode));
+	} else {
+		ret = view_data(&conn->view, msg->payload,
+					bbus_hdr_getpsize(&msg->hdr));
+	}
+
+	func(bbus_hdr_getcallid(&msg->hdr), ret, priv);
+}
+
+int bbus_poll_replies(bbus_client_connection* conn, struct bbus_timeval* tv,
+					bbus_reply_func func, void* priv)
+{
+	struct bbus_timeval nowait = { 0, 0 };
+	struct queued_msg* reply;
+	struct bbus_msg* msg;
+	int handled = 0;
+	int r;
+
+	while ((reply = (struct queued_msg*)conn->queued.head) != NULL) {
+		bbus_list_rm(&conn->queued, reply);
+		deliver_reply(conn, reply->msg, func, priv);
+		free_msg(reply);
+		++handled;
+	}
+
+	/* Only wait for the first reply, then take what's already there. */
+	for (;;) {
+		r = recv_msg(conn, handled ? &nowait : tv);
+		if (r < 0)
+			return -1;
+		else if (r == 0)
+			break;
+
+		msg = conn->rcvbuf;
+		if (msg->hdr.msgtype != BBUS_MSGTYPE_CLIREPLY
+			|| !BBUS_HDR_ISFLAGSET(&msg->hdr, BBUS_PROT_HASCALLID)) {
+			__bbus_seterr(BBUS_EMSGINVTYPRCVD);
+			return -1;
+		}
+
+		deliver_reply(conn, msg, func, priv);
+		++handled;
+	}
+
+	return handled;
+}
+
+void bbus_setcalltimeout(bbus_client_connection* conn, unsigned msec)
+{
+	conn->timeout = msec;
+}
+
 /* TODO Refactor common code for bbus_connect and this. */
 bbus_client_connection* bbus_mon_connect(void)
 {
@@ -165,10 +515,11 @@ bbus_client_connection* bbus_mon_connect(void)
 	if (sock < 0)
 		return NULL;
 
-	conn = bbus_malloc(sizeof(struct __bbus_client_connection));
+	conn = bbus_malloc0(sizeof(struct __bbus_client_connection));
 	if (conn == NULL)
 		return NULL;
 	conn->sock = sock;
+	__bbus_prot_rcvctx_init(&conn->rcvctx);
 	return conn;
 }
 
@@ -176,16 +527,21 @@ int bbus_mon_recvmsg(bbus_client_connection* conn,
 		struct bbus_msg* msg, size_t bufsize,
 		struct bbus_timeval* tv, const char** meta, bbus_object** obj)
 {
+	size_t msgsize;
 	int r;
 
-	r = __bbus_sock_rdready(conn->sock, tv);
+	r = recv_msg(conn, tv);
 	if (r <= 0) {
 		return r;
 	} else {
-		memset(msg, 0, bufsize);
-		r = __bbus_prot_recvmsg(conn->sock, msg, bufsize);
-		if (r < 0)
+		msgsize = BBUS_MSGHDR_SIZE
+				+ bbus_hdr_getpsize(&conn->rcvbuf->hdr);
+		if (msgsize > bufsize) {
+			__bbus_seterr(BBUS_EMSGINVFMT);
 			return -1;
+		}
+		memset(msg, 0, bufsize);
+		memcpy(msg, conn->rcvbuf, msgsize);
 		if (msg->hdr.msgtype != BBUS_MSGTYPE_MON) {
 			__bbus_seterr(BBUS_EMSGINVTYPRCVD);
 			return -1;
@@ -223,11 +579,20 @@ int bbus_closeconn(bbus_client_connection* conn)
 	r = send_session_close(conn->sock);
 	if (r < 0)
 		r = -1;
+	free_msglist(&conn->queued);
+	bbus_obj_free(conn->view);
+	bbus_free(conn->rcvbuf);
+	__bbus_prot_rcvctx_free(&conn->rcvctx);
 	bbus_free(conn);
 
 	return r;
 }
 
+int bbus_getfd(bbus_client_connection* conn)
+{
+	return conn->sock;
+}
+
 bbus_service_connection* bbus_srvc_connect(const char* name)
 {
 	int sock;
@@ -237,7 +602,7 @@ bbus_service_connection* bbus_srvc_connect(const char* name)
 	if (sock < 0)
 		return NULL;
 
-	conn = bbus_malloc(sizeof(struct __bbus_service_connection));
+	conn = bbus_malloc0(sizeof(struct __bbus_service_connection));
 	if (conn == NULL)
 		return NULL;
 	conn->sock = sock;
@@ -249,6 +614,17 @@ bbus_service_connection* bbus_srvc_connect(const char* name)
 		bbus_free(conn);
 		return NULL;
 	}
+	conn->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (conn->wakefd < 0) {
+		__bbus_seterr(errno);
+		__bbus_sock_close(conn->sock);
+		bbus_hmap_free(conn->methods);
+		bbus_str_free(conn->srvname);
+		bbus_free(conn);
+		return NULL;
+	}
+	__bbus_prot_rcvctx_init(&conn->rcvctx);
+	pthread_mutex_init(&conn->sendlock, NULL);
 	return conn;
 }
 
@@ -309,85 +685,499 @@ int bbus_srvc_regmethod(bbus_service_connection* conn,
 	return 0;
 }
 
-int bbus_srvc_listencalls(bbus_service_connection* conn,
-		struct bbus_timeval* tv)
+/*
+ * Runs the method requested in msg and fills in the reply header. The
+ * returned object (NULL if the method failed) must be freed once the reply
+ * has been sent. Returns -1 if the message is malformed.
+ */
+static int exec_call(bbus_service_connection* conn,
+		const struct bbus_msg* msg, bbus_object** view,
+		struct bbus_msg_hdr* hdr, bbus_object** ret)
 {
-	int r;
-	struct bbus_msg_hdr hdr;
-	char buf[BBUS_MAXMSGSIZE];
 	const char* meta;
+	const void* rawarg;
+	size_t argsize;
 	bbus_object* objarg;
-	bbus_object* objret;
 	void* callback;
-	unsigned token;
-	struct bbus_msg* msg;
 
-	msg = (struct bbus_msg*)buf;
-	r = __bbus_sock_rdready(conn->sock, tv);
+	*ret = NULL;
+	meta = bbus_prot_extractmeta(msg);
+	if (meta == NULL) {
+		__bbus_seterr(BBUS_EMSGINVFMT);
+		return -1;
+	}
+
+	rawarg = bbus_prot_rawobj(msg, &argsize);
+	if (rawarg == NULL) {
+		__bbus_seterr(BBUS_EMSGINVFMT);
+		return -1;
+	}
+
+	objarg = view_data(view, rawarg, argsize);
+	if (objarg == NULL)
+		return -1;
+
+	memset(hdr, 0, sizeof(struct bbus_msg_hdr));
+	__bbus_prot_hdrsetmagic(hdr);
+	hdr->msgtype = BBUS_MSGTYPE_SRVREPLY;
+	/* The token is all bbusd needs to match the reply with its call. */
+	bbus_hdr_settoken(hdr, bbus_hdr_gettoken(&msg->hdr));
+	callback = bbus_hmap_findstr(conn->methods, meta);
+	if (callback == NULL) {
+		hdr->errcode = BBUS_PROT_ENOMETHOD;
+		__bbus_seterr(BBUS_ENOMETHOD);
+		return 0;
+	}
+
+	*ret = ((bbus_method_func)callback)(objarg);
+	if (*ret == NULL) {
+		hdr->errcode = BBUS_PROT_EMETHODERR;
+		__bbus_seterr(BBUS_EMETHODERR);
+		return 0;
+	}
+
+	bbus_hdr_setpsize(hdr, bbus_obj_rawsize(*ret));
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASOBJECT);
+
+	return 0;
+}
+
+/*
+ * Runs the method requested in msg and sends back the reply. Returns -1 if
+ * the message is malformed or the reply couldn't be sent, 1 if the method
+ * failed or doesn't exist and 0 on success.
+ */
+static int serve_call(bbus_service_connection* conn,
+		const struct bbus_msg* msg, bbus_object** view)
+{
+	struct bbus_msg_hdr hdr;
+	bbus_object* objret;
+	int r;
+
+	r = exec_call(conn, msg, view, &hdr, &objret);
+	if (r < 0)
+		return -1;
+
+	pthread_mutex_lock(&conn->sendlock);
+	r = __bbus_prot_sendvmsg(conn->sock, &hdr, NULL,
+		objret == NULL ? NULL : bbus_obj_rawdata(objret),
+		objret == NULL ? 0 : bbus_obj_rawsize(objret));
+	pthread_mutex_unlock(&conn->sendlock);
+	bbus_obj_free(objret);
+	if (r < 0)
+		return -1;
+
+	return hdr.errcode == 0 ? 0 : 1;
+}
+
+/*
+ * Takes the next call out of the data already received, reading more
+ * without blocking if needed. Returns 1 if a call has been stored in
+ * rcvbuf, 0 if there's no complete call yet and -1 on error.
+ */
+static int tryrecv_call(bbus_service_connection* conn)
+{
+	int r;
+
+	r = __bbus_prot_tryrecvmsg(conn->sock, &conn->rcvctx,
+				&conn->rcvbuf, &conn->rcvbufsize);
+	if (r <= 0)
+		return r;
+
+	if (conn->rcvbuf->hdr.msgtype != BBUS_MSGTYPE_SRVCALL) {
+		__bbus_seterr(BBUS_EMSGINVTYPRCVD);
+		return -1;
+	}
+
+	return 1;
+}
+
+/* Blocks until a whole call has been received. */
+static int recv_call(bbus_service_connection* conn)
+{
+	int r;
+
+	for (;;) {
+		r = tryrecv_call(conn);
+		if (r != 0)
+			return r < 0 ? -1 : 0;
+
+		r = __bbus_sock_rdready(conn->sock, NULL);
+		if (r < 0)
+			return -1;
+	}
+}
+
+/*
+ * Same as __bbus_sock_rdready(), but doesn't wait if a call has already
+ * been read ahead.
+ */
+static int call_ready(bbus_service_connection* conn, struct bbus_timeval* tv)
+{
+	if (__bbus_prot_rcvpending(&conn->rcvctx))
+		return 1;
+
+	return __bbus_sock_rdready(conn->sock, tv);
+}
+
+int bbus_srvc_listencalls(bbus_service_connection* conn,
+		struct bbus_timeval* tv)
+{
+	int r;
+
+	r = call_ready(conn, tv);
 	if (r < 0) {
 		return -1;
 	} else
 	if (r == 0) {
 		/* Timeout */
 		return 0;
-	} else {
-		/* Message incoming */
-		memset(buf, 0, BBUS_MAXMSGSIZE);
-		r = __bbus_prot_recvmsg(conn->sock, msg, BBUS_MAXMSGSIZE);
+	}
+
+	/* Message incoming */
+	r = recv_call(conn);
+	if (r < 0)
+		return -1;
+
+	r = serve_call(conn, conn->rcvbuf, &conn->view);
+	return r == 0 ? 0 : -1;
+}
+
+/* Maximum number of replies sent with a single system call. */
+#define SRVC_REPLYBATCH		64
+
+struct reply_batch
+{
+	unsigned char wirehdrs[SRVC_REPLYBATCH][__BBUS_PROT_MAXWIREHDR];
+	struct iovec iov[SRVC_REPLYBATCH * __BBUS_PROT_MAXNUMIOV];
+	/* Return values of the methods, referenced by iov. */
+	bbus_object* objs[SRVC_REPLYBATCH];
+	unsigned num;
+	int numiov;
+	size_t size;
+};
+
+static int flush_replies(bbus_service_connection* conn,
+				struct reply_batch* batch)
+{
+	unsigned i;
+	int r = 0;
+
+	if (batch->num > 0)
+		r = __bbus_prot_sendbatch(conn->sock, batch->iov,
+				batch->numiov, batch->size, batch->num);
+
+	for (i = 0; i < batch->num; ++i)
+		bbus_obj_free(batch->objs[i]);
+	batch->num = 0;
+	batch->numiov = 0;
+	batch->size = 0;
+
+	return r;
+}
+
+static int batch_reply(bbus_service_connection* conn,
+		struct reply_batch* batch, const struct bbus_msg_hdr* hdr,
+		bbus_object* objret)
+{
+	ssize_t msgsize;
+	int numiov;
+
+	msgsize = __bbus_prot_mkiov(hdr, batch->wirehdrs[batch->num], NULL,
+			objret == NULL ? NULL : bbus_obj_rawdata(objret),
+			objret == NULL ? 0 : bbus_obj_rawsize(objret),
+			batch->iov + batch->numiov, &numiov);
+	if (msgsize < 0) {
+		bbus_obj_free(objret);
+		return -1;
+	}
+
+	batch->objs[batch->num++] = objret;
+	batch->numiov += numiov;
+	batch->size += msgsize;
+	if (batch->num == SRVC_REPLYBATCH)
+		return flush_replies(conn, batch);
+
+	return 0;
+}
+
+/*
+ * Handles the calls, that can be received without blocking, up to maxcalls
+ * and sends back the replies in batches. If received is set, the first call
+ * is already in rcvbuf. Returns the number of calls handled or -1 on error.
+ */
+static int serve_ready(bbus_service_connection* conn,
+				unsigned maxcalls, int received)
+{
+	struct reply_batch batch;
+	struct bbus_msg_hdr hdr;
+	bbus_object* objret;
+	unsigned handled = 0;
+	int r;
+
+	batch.num = 0;
+	batch.numiov = 0;
+	batch.size = 0;
+	r = received ? 1 : tryrecv_call(conn);
+	while (r > 0) {
+		r = exec_call(conn, conn->rcvbuf, &conn->view, &hdr, &objret);
 		if (r < 0)
-			return -1;
-		if (msg->hdr.msgtype != BBUS_MSGTYPE_SRVCALL) {
-			__bbus_seterr(BBUS_EMSGINVTYPRCVD);
-			return -1;
-		}
+			break;
 
-		token = bbus_hdr_gettoken(&msg->hdr);
-		meta = bbus_prot_extractmeta(msg);
-		if (meta == NULL) {
-			__bbus_seterr(BBUS_EMSGINVFMT);
-			return -1;
+		r = batch_reply(conn, &batch, &hdr, objret);
+		if (r < 0)
+			break;
+
+		if (++handled == maxcalls)
+			break;
+
+		/* Only take what has already arrived. */
+		r = tryrecv_call(conn);
+	}
+
+	if (flush_replies(conn, &batch) < 0)
+		r = -1;
+
+	return r < 0 ? -1 : (int)handled;
+}
+
+int bbus_srvc_draincalls(bbus_service_connection* conn,
+		struct bbus_timeval* tv, unsigned maxcalls)
+{
+	int r;
+
+	if (maxcalls == 0) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return -1;
+	}
+
+	r = call_ready(conn, tv);
+	if (r <= 0)
+		return r;
+
+	r = recv_call(conn);
+	if (r < 0)
+		return -1;
+
+	return serve_ready(conn, maxcalls, BBUS_TRUE);
+}
+
+int bbus_srvc_processcalls(bbus_service_connection* conn, unsigned maxcalls)
+{
+	if (maxcalls == 0) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return -1;
+	}
+
+	return serve_ready(conn, maxcalls, BBUS_FALSE);
+}
+
+int bbus_srvc_getfd(bbus_service_connection* conn)
+{
+	return conn->sock;
+}
+
+struct dispatcher
+{
+	bbus_service_connection* conn;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Calls read from the socket, not yet picked up by a worker. */
+	struct bbus_list calls;
+	/*
+	 * Calls already served. Their buffers are swapped with the receive
+	 * buffer of the connection for the calls read later.
+	 */
+	struct bbus_list spare;
+	int done;
+	/* Error which made a worker give up, 0 if none did. */
+	int err;
+};
+
+static void wake_reader(bbus_service_connection* conn)
+{
+	uint64_t one = 1;
+	ssize_t r;
+
+	/* Can only fail if the counter is about to overflow. */
+	r = write(conn->wakefd, &one, sizeof(one));
+	(void)r;
+}
+
+static void stop_dispatcher(struct dispatcher* disp, int err)
+{
+	pthread_mutex_lock(&disp->lock);
+	if (disp->err == 0)
+		disp->err = err;
+	disp->done = 1;
+	pthread_cond_broadcast(&disp->cond);
+	pthread_mutex_unlock(&disp->lock);
+}
+
+static void* dispatch_calls(void* arg)
+{
+	struct dispatcher* disp = arg;
+	struct queued_msg* call = NULL;
+	bbus_object* view = NULL;
+	int r;
+
+	for (;;) {
+		pthread_mutex_lock(&disp->lock);
+		if (call != NULL)
+			bbus_list_push(&disp->spare, call);
+		while (disp->calls.head == NULL && !disp->done)
+			pthread_cond_wait(&disp->cond, &disp->lock);
+		call = (struct queued_msg*)disp->calls.head;
+		if (call != NULL)
+			bbus_list_rm(&disp->calls, call);
+		pthread_mutex_unlock(&disp->lock);
+
+		/* Stopped and nothing left to do. */
+		if (call == NULL)
+			break;
+
+		r = serve_call(disp->conn, call->msg, &view);
+		if (r < 0) {
+			free_msg(call);
+			stop_dispatcher(disp, bbus_lasterror());
+			wake_reader(disp->conn);
+			break;
 		}
+	}
 
-		objarg = bbus_prot_extractobj(msg);
-		if (objarg == NULL) {
-			__bbus_seterr(BBUS_EMSGINVFMT);
+	bbus_obj_free(view);
+	return NULL;
+}
+
+/*
+ * Hands the call in the receive buffer over to the workers. The buffer
+ * itself is handed over and replaced with the buffer of an already served
+ * call, so calls are neither copied nor allocated once enough buffers are
+ * in circulation.
+ */
+static int push_call(struct dispatcher* disp)
+{
+	bbus_service_connection* conn = disp->conn;
+	struct queued_msg* call;
+	struct bbus_msg* buf;
+	size_t bufsize;
+
+	pthread_mutex_lock(&disp->lock);
+	call = (struct queued_msg*)disp->spare.head;
+	if (call != NULL) {
+		bbus_list_rm(&disp->spare, call);
+	} else {
+		pthread_mutex_unlock(&disp->lock);
+		call = bbus_malloc0(sizeof(struct queued_msg));
+		if (call == NULL)
 			return -1;
-		}
+		pthread_mutex_lock(&disp->lock);
+	}
+
+	buf = call->msg;
+	bufsize = call->bufsize;
+	call->msg = conn->rcvbuf;
+	call->bufsize = conn->rcvbufsize;
+	conn->rcvbuf = buf;
+	conn->rcvbufsize = bufsize;
 
-		memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
-		__bbus_prot_hdrsetmagic(&hdr);
-		hdr.msgtype = BBUS_MSGTYPE_SRVREPLY;
-		bbus_hdr_settoken(&hdr, token);
-		objret = NULL;
-		callback = bbus_hmap_findstr(conn->methods, meta);
-		if (callback == NULL) {
-			hdr.errcode = BBUS_PROT_ENOMETHOD;
-			__bbus_seterr(BBUS_ENOMETHOD);
-			goto send_reply;
+	bbus_list_push(&disp->calls, call);
+	pthread_cond_signal(&disp->cond);
+	pthread_mutex_unlock(&disp->lock);
+
+	return 0;
+}
+
+/*
+ * Clears the wake-up descriptor of a bbus_srvc_stop() call which came in
+ * after the stop flag was last checked.
+ */
+static void clear_wakeup(bbus_service_connection* conn)
+{
+	uint64_t val;
+	ssize_t r;
+
+	r = read(conn->wakefd, &val, sizeof(val));
+	(void)r;
+}
+
+int bbus_srvc_run(bbus_service_connection* conn, unsigned nthreads)
+{
+	struct dispatcher disp;
+	pthread_t* threads;
+	unsigned numthreads;
+	unsigned i;
+	int ret = -1;
+	int r;
+
+	if (nthreads == 0) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return -1;
+	}
+
+	threads = bbus_malloc(nthreads * sizeof(pthread_t));
+	if (threads == NULL)
+		return -1;
+
+	memset(&disp, 0, sizeof(struct dispatcher));
+	disp.conn = conn;
+	pthread_mutex_init(&disp.lock, NULL);
+	pthread_cond_init(&disp.cond, NULL);
+
+	for (numthreads = 0; numthreads < nthreads; ++numthreads) {
+		r = pthread_create(&threads[numthreads], NULL,
+						dispatch_calls, &disp);
+		if (r != 0) {
+			__bbus_seterr(r);
+			goto out;
 		}
+	}
 
-		objret = ((bbus_method_func)callback)(objarg);
-		if (objret == NULL) {
-			hdr.errcode = BBUS_PROT_EMETHODERR;
-			__bbus_seterr(BBUS_EMETHODERR);
-			goto send_reply;
+	while (!BBUS_ATOMIC_GET(conn->stop) && !BBUS_ATOMIC_GET(disp.done)) {
+		if (!__bbus_prot_rcvpending(&conn->rcvctx)) {
+			r = __bbus_sock_rdwait(conn->sock, conn->wakefd);
+			if (r < 0)
+				goto out;
+			else if (r == 0)
+				continue;
 		}
 
-		bbus_hdr_setpsize(&hdr, bbus_obj_rawsize(objret));
-		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+		r = recv_call(conn);
+		if (r < 0)
+			goto out;
 
-send_reply:
-		r = __bbus_prot_sendvmsg(conn->sock, &hdr, NULL,
-			objret == NULL ? NULL : bbus_obj_rawdata(objret),
-			objret == NULL ? 0 : bbus_obj_rawsize(objret));
+		r = push_call(&disp);
 		if (r < 0)
-			return -1;
+			goto out;
+	}
+	ret = 0;
 
-		bbus_obj_free(objret);
-		bbus_obj_free(objarg);
+out:
+	/* Let the workers finish the calls already read, then join them. */
+	stop_dispatcher(&disp, 0);
+	for (i = 0; i < numthreads; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (disp.err != 0) {
+		__bbus_seterr(disp.err);
+		ret = -1;
 	}
 
-	return hdr.errcode == 0 ? 0 : -1;
+	free_msglist(&disp.calls);
+	free_msglist(&disp.spare);
+	pthread_cond_destroy(&disp.cond);
+	pthread_mutex_destroy(&disp.lock);
+	bbus_free(threads);
+	BBUS_ATOMIC_SET(conn->stop, 0);
+	clear_wakeup(conn);
+
+	return ret;
+}
+
+void bbus_srvc_stop(bbus_service_connection* conn)
+{
+	BBUS_ATOMIC_SET(conn->stop, 1);
+	wake_reader(conn);
 }
 
 int bbus_srvc_closeconn(bbus_service_connection* conn)
@@ -399,6 +1189,11 @@ int bbus_srvc_closeconn(bbus_service_connection* conn)
 		return -1;
 	bbus_str_free(conn->srvname);
 	bbus_hmap_free(conn->methods);
+	bbus_obj_free(conn->view);
+	bbus_free(conn->rcvbuf);
+	__bbus_prot_rcvctx_free(&conn->rcvctx);
+	pthread_mutex_destroy(&conn->sendlock);
+	close(conn->wakefd);
 	bbus_free(conn);
 	return 0;
 }
@@ -13,7 +13,16 @@
  */
 
 #include <busybus.h>
+#include "crc32.h"
 #include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_CLMUL 1
+#include <immintrin.h>
+#endif
+
+#define CRC32_POLY 0x04C11DB7U
 
 static const uint32_t crc32_tab[] = {
 	0x00000000U, 0x04C11DB7U, 0x09823B6EU, 0x0D4326D9U, 0x130476DCU,
@@ -70,7 +79,14 @@ static const uint32_t crc32_tab[] = {
 	0xB1F740B4U,
 };
 
-static uint32_t update_crc32(uint32_t crc,
+/*
+ * crc32_slices[k][n] is the crc of byte n followed by k zero bytes. This
+ * allows to process 8 or 16 bytes per iteration with independent lookups.
+ * crc32_slices[0] is the same as crc32_tab.
+ */
+static uint32_t crc32_slices[16][256];
+
+static uint32_t update_bytewise(uint32_t crc,
 		const unsigned char* buf, size_t bufsize)
 {
 	while (bufsize > 0) {
@@ -82,11 +98,222 @@ static uint32_t update_crc32(uint32_t crc,
 	return crc;
 }
 
-uint32_t bbus_crc32(const void* buf, size_t bufsize)
+static uint32_t load_be32(const unsigned char* buf)
 {
-	return update_crc32(0xffffffff,
-		(const unsigned char*)buf, bufsize) ^ 0xffffffff;
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16)
+			| ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+#define SLICE(WORD, FIRST)						\
+	(crc32_slices[(FIRST)][(WORD) >> 24]				\
+	^ crc32_slices[(FIRST) - 1][((WORD) >> 16) & 0xff]		\
+	^ crc32_slices[(FIRST) - 2][((WORD) >> 8) & 0xff]		\
+	^ crc32_slices[(FIRST) - 3][(WORD) & 0xff])
+
+static uint32_t update_slice8(uint32_t crc,
+		const unsigned char* buf, size_t bufsize)
+{
+	uint32_t w1;
+	uint32_t w2;
+
+	while (bufsize >= 8) {
+		w1 = crc ^ load_be32(buf);
+		w2 = load_be32(buf + 4);
+		crc = SLICE(w1, 7) ^ SLICE(w2, 3);
+		buf += 8;
+		bufsize -= 8;
+	}
+
+	return update_bytewise(crc, buf, bufsize);
+}
+
+static uint32_t update_slice16(uint32_t crc,
+		const unsigned char* buf, size_t bufsize)
+{
+	uint32_t w1;
+	uint32_t w2;
+	uint32_t w3;
+	uint32_t w4;
+
+	while (bufsize >= 16) {
+		w1 = crc ^ load_be32(buf);
+		w2 = load_be32(buf + 4);
+		w3 = load_be32(buf + 8);
+		w4 = load_be32(buf + 12);
+		crc = SLICE(w1, 15) ^ SLICE(w2, 11)
+			^ SLICE(w3, 7) ^ SLICE(w4, 3);
+		buf += 16;
+		bufsize -= 16;
+	}
+
+	return update_slice8(crc, buf, bufsize);
+}
+
+#ifdef HAVE_CLMUL
+
+/* Returns x^n mod P. */
+static uint32_t xpow_mod(unsigned n)
+{
+	uint32_t r = 1;
+
+	while (n--)
+		r = (r & 0x80000000U) ? (r << 1) ^ CRC32_POLY : r << 1;
+
+	return r;
+}
+
+/*
+ * Folding with carry-less multiplication, as described in Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction". The
+ * data is byte-swapped, so that bit n of a 128-bit lane is the coefficient
+ * of x^n, which is what a non-reflected crc needs.
+ *
+ * A 128-bit value X followed by N bits of data is congruent to
+ * X_hi * (x^(N+64) mod P) + X_lo * (x^N mod P), which is 96 bits long.
+ */
+static uint64_t fold64_k1;	/* x^(512+64) mod P */
+static uint64_t fold64_k2;	/* x^512 mod P */
+static uint64_t fold16_k1;	/* x^(128+64) mod P */
+static uint64_t fold16_k2;	/* x^128 mod P */
+
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+
+static CLMUL_TARGET __m128i clmul_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+				_mm_clmulepi64_si128(x, k, 0x00));
+}
+
+static CLMUL_TARGET __m128i clmul_load(const unsigned char* buf,
+							__m128i bswap)
+{
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buf), bswap);
+}
+
+static CLMUL_TARGET uint32_t update_clmul(uint32_t crc,
+		const unsigned char* buf, size_t bufsize)
+{
+	__m128i bswap;
+	__m128i k64;
+	__m128i k16;
+	__m128i x0;
+	__m128i x1;
+	__m128i x2;
+	__m128i x3;
+	unsigned char tail[16];
+
+	if (bufsize < 64)
+		return update_slice16(crc, buf, bufsize);
+
+	bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15);
+	k64 = _mm_set_epi64x((long long)fold64_k1, (long long)fold64_k2);
+	k16 = _mm_set_epi64x((long long)fold16_k1, (long long)fold16_k2);
+
+	x0 = clmul_load(buf, bswap);
+	x1 = clmul_load(buf + 16, bswap);
+	x2 = clmul_load(buf + 32, bswap);
+	x3 = clmul_load(buf + 48, bswap);
+	/* The initial crc is xored with the first four bytes. */
+	x0 = _mm_xor_si128(x0, _mm_set_epi32((int)crc, 0, 0, 0));
+	buf += 64;
+	bufsize -= 64;
+
+	while (bufsize >= 64) {
+		x0 = _mm_xor_si128(clmul_fold(x0, k64),
+					clmul_load(buf, bswap));
+		x1 = _mm_xor_si128(clmul_fold(x1, k64),
+					clmul_load(buf + 16, bswap));
+		x2 = _mm_xor_si128(clmul_fold(x2, k64),
+					clmul_load(buf + 32, bswap));
+		x3 = _mm_xor_si128(clmul_fold(x3, k64),
+					clmul_load(buf + 48, bswap));
+		buf += 64;
+		bufsize -= 64;
+	}
+
+	x1 = _mm_xor_si128(clmul_fold(x0, k16), x1);
+	x2 = _mm_xor_si128(clmul_fold(x1, k16), x2);
+	x3 = _mm_xor_si128(clmul_fold(x2, k16), x3);
+
+	while (bufsize >= 16) {
+		x3 = _mm_xor_si128(clmul_fold(x3, k16),
+					clmul_load(buf, bswap));
+		buf += 16;
+		bufsize -= 16;
+	}
+
+	/*
+	 * Running the remaining 128 bits through the table with a zero
+	 * initial value reduces them modulo P.
+	 */
+	_mm_storeu_si128((__m128i*)tail, _mm_shuffle_epi8(x3, bswap));
+	crc = update_slice16(0, tail, sizeof(tail));
+
+	return update_slice16(crc, buf, bufsize);
+}
+
+static int have_clmul(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul")
+			&& __builtin_cpu_supports("ssse3");
 }
 
+#endif /* HAVE_CLMUL */
 
+static const struct __bbus_crc32_variant crc32_variants[] = {
+	{ .name = "bytewise",	.update = update_bytewise, },
+	{ .name = "slice-by-8",	.update = update_slice8, },
+	{ .name = "slice-by-16", .update = update_slice16, },
+#ifdef HAVE_CLMUL
+	{ .name = "pclmulqdq",	.update = update_clmul, },
+#endif /* HAVE_CLMUL */
+};
+
+static unsigned num_variants = 3;
+
+/* Used until the tables are initialized. */
+static __bbus_crc32_updatefunc update_crc32 = update_bytewise;
+
+static void BBUS_ATSTART crc32_init(void)
+{
+	unsigned i;
+	unsigned k;
+	uint32_t crc;
 
+	memcpy(crc32_slices[0], crc32_tab, sizeof(crc32_tab));
+	for (k = 1; k < 16; ++k) {
+		for (i = 0; i < 256; ++i) {
+			crc = crc32_slices[k - 1][i];
+			crc32_slices[k][i] = (crc << 8)
+					^ crc32_tab[(crc >> 24) & 0xff];
+		}
+	}
+
+#ifdef HAVE_CLMUL
+	if (have_clmul()) {
+		fold64_k1 = xpow_mod(512 + 64);
+		fold64_k2 = xpow_mod(512);
+		fold16_k1 = xpow_mod(128 + 64);
+		fold16_k2 = xpow_mod(128);
+		num_variants++;
+		update_crc32 = update_clmul;
+		return;
+	}
+#endif /* HAVE_CLMUL */
+
+	update_crc32 = update_slice16;
+}
+
+unsigned __bbus_crc32_getvariants(const struct __bbus_crc32_variant** vars)
+{
+	*vars = crc32_variants;
+	return num_variants;
+}
+
+uint32_t bbus_crc32(const void* buf, size_t bufsize)
+{
+	return update_crc32(0xffffffff,
+		(const unsigned char*)buf, bufsize) ^ 0xffffffff;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BBUS_CRC32__
+#define __BBUS_CRC32__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t (*__bbus_crc32_updatefunc)(uint32_t,
+					const unsigned char*, size_t);
+
+/*
+ * Implementation of the crc32 update step. All variants give the same
+ * results, bbus_crc32() uses the fastest one supported by the CPU.
+ */
+struct __bbus_crc32_variant
+{
+	const char* name;
+	__bbus_crc32_updatefunc update;
+};
+
+/*
+ * Returns the number of variants available on this machine.
+ */
+unsigned __bbus_crc32_getvariants(const struct __bbus_crc32_variant** vars);
+
+#endif /* __BBUS_CRC32__ */
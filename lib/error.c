@@ -46,7 +46,12 @@ static const char* const error_descr[] = {
 	"error registering the method",
 	"invalid key type used on a hashmap",
 	"invalid regular expression pattern",
-	"client unauthorized"
+	"client unauthorized",
+	"outbound message queue full",
+	"message too big",
+	"object is read-only",
+	"method handle no longer valid",
+	"method call timed out"
 };
 
 int bbus_lasterror(void)
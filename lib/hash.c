@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include <busybus.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Non-cryptographic hash functions used by the hashmap. Unlike bbus_crc32()
+ * their results depend on the host's byte order, so they must not be used
+ * for anything that leaves the process.
+ */
+
+#define HASH_MUL1 0x9e3779b97f4a7c15ULL
+#define HASH_MUL2 0xff51afd7ed558ccdULL
+#define HASH_MUL3 0xc4ceb9fe1a85ec53ULL
+
+static uint64_t load64(const unsigned char* buf)
+{
+	uint64_t word;
+
+	/* Compiles to a single, possibly unaligned, load. */
+	memcpy(&word, buf, sizeof(uint64_t));
+	return word;
+}
+
+static uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= HASH_MUL2;
+	h ^= h >> 33;
+	h *= HASH_MUL3;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/*
+ * Consumes the key eight bytes at a time and runs the result through
+ * the 64-bit finalizer from MurmurHash3.
+ */
+uint32_t bbus_hash_str(const void* buf, size_t bufsize)
+{
+	const unsigned char* ptr = buf;
+	uint64_t h;
+	uint64_t tail;
+
+	h = HASH_MUL1 ^ ((uint64_t)bufsize * HASH_MUL2);
+	while (bufsize >= sizeof(uint64_t)) {
+		h = (h ^ load64(ptr)) * HASH_MUL1;
+		h ^= h >> 32;
+		ptr += sizeof(uint64_t);
+		bufsize -= sizeof(uint64_t);
+	}
+
+	if (bufsize > 0) {
+		tail = 0;
+		memcpy(&tail, ptr, bufsize);
+		h = (h ^ tail) * HASH_MUL1;
+	}
+
+	return (uint32_t)mix64(h);
+}
+
+/*
+ * Finalizer from MurmurHash3 - every bit of the key affects every bit of
+ * the hash, so that sequential keys don't end up in neighbouring slots.
+ */
+uint32_t bbus_hash_uint(const void* buf, size_t bufsize)
+{
+	uint32_t h;
+
+	if (bufsize != sizeof(uint32_t))
+		return bbus_hash_str(buf, bufsize);
+
+	memcpy(&h, buf, sizeof(uint32_t));
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
+	return h;
+}
@@ -14,13 +14,24 @@
 
 #include <busybus.h>
 #include "error.h"
+#include "hashmap.h"
+#include "pool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Separate chaining implementation - every entry is a list element
+ * allocated from a pool.
+ */
 
 #define DEF_MAP_SIZE 32
 
+#define INLINE_KEYSIZE 24
+
 struct map_entry
 {
 	struct map_entry* next;
@@ -28,199 +39,414 @@ struct map_entry
 	void* key;
 	size_t ksize;
 	void* val;
+	/* Short keys are stored right in the entry. */
+	char keybuf[INLINE_KEYSIZE];
 };
 
+/* Entries of all hashmaps come from a single pool. */
+static bbus_pool entry_pool =
+		__BBUS_POOL_INITIALIZER(sizeof(struct map_entry));
+
+/*
+ * Keys are stored with a terminating null byte, so that string keys can be
+ * printed.
+ */
+static struct map_entry* make_entry(const void* key,
+					size_t ksize, void* val)
+{
+	struct map_entry* entr;
+
+	entr = bbus_pool_alloc(&entry_pool);
+	if (entr == NULL)
+		return NULL;
+
+	if (ksize < INLINE_KEYSIZE) {
+		entr->key = entr->keybuf;
+	} else {
+		entr->key = bbus_malloc(ksize + 1);
+		if (entr->key == NULL) {
+			bbus_pool_free(&entry_pool, entr);
+			return NULL;
+		}
+	}
+
+	memcpy(entr->key, key, ksize);
+	((char*)entr->key)[ksize] = '\0';
+	entr->ksize = ksize;
+	entr->val = val;
+
+	return entr;
+}
+
+static void free_entry(struct map_entry* entr)
+{
+	if (entr->key != entr->keybuf)
+		bbus_free(entr->key);
+	bbus_pool_free(&entry_pool, entr);
+}
+
 struct entry_list
 {
 	struct map_entry* head;
 	struct map_entry* tail;
 };
 
-struct __bbus_hashmap
+/*
+ * When the map grows, the entries are moved to the new buckets a few at
+ * a time by every insert and removal, so that no single operation has to
+ * rehash the whole map. Until that's done lookups check both tables.
+ */
+struct chained_map
 {
+	struct __bbus_hashmap base;
 	size_t size;
-	size_t numstored;
 	struct entry_list* buckets;
-	enum bbus_hmap_type type;
+	/* Old buckets and the number of those already moved, if growing. */
+	size_t oldsize;
+	struct entry_list* oldbuckets;
+	size_t migrated;
+	/* Memory of the old buckets below this address has been given back. */
+	uintptr_t released;
 };
 
-static bbus_hashmap* create_hashmap(enum bbus_hmap_type type, size_t size)
+#define to_chained(MAP) ((struct chained_map*)(MAP))
+
+/* Minimum number of old buckets moved per operation. */
+#define MIGRATE_STEP 4
+
+static const struct __bbus_hmap_ops chained_ops;
+
+bbus_hashmap* __bbus_hmap_chained_create(enum bbus_hmap_type type)
 {
-	bbus_hashmap* hmap;
-	unsigned i;
+	struct chained_map* hmap;
 
-	hmap = bbus_malloc(sizeof(struct __bbus_hashmap));
+	hmap = bbus_malloc0(sizeof(struct chained_map));
 	if (hmap == NULL)
 		return NULL;
 
-	hmap->buckets = bbus_malloc(size * sizeof(struct entry_list));
+	hmap->buckets = __bbus_hmap_alloctable(
+				DEF_MAP_SIZE * sizeof(struct entry_list));
 	if (hmap->buckets == NULL) {
 		bbus_free(hmap);
 		return NULL;
 	}
 
+	hmap->base.ops = &chained_ops;
+	hmap->base.type = type;
+	hmap->base.hash = __BBUS_HMAP_DEFHASH(type);
+	hmap->base.maxload = chained_ops.defmaxload;
+	hmap->size = DEF_MAP_SIZE;
+
+	return (bbus_hashmap*)hmap;
+}
+
+static void free_buckets(struct entry_list* buckets, size_t size)
+{
+	struct map_entry* el;
+	struct map_entry* tmpel;
+	size_t i;
+
 	for (i = 0; i < size; ++i) {
-		hmap->buckets[i].head = NULL;
-		hmap->buckets[i].tail = NULL;
+		el = buckets[i].head;
+		while (el != NULL) {
+			tmpel = el;
+			el = el->next;
+			free_entry(tmpel);
+		}
+		buckets[i].head = NULL;
+		buckets[i].tail = NULL;
 	}
-	hmap->size = size;
-	hmap->numstored = 0;
-	hmap->type = type;
-
-	return hmap;
 }
 
-bbus_hashmap* bbus_hmap_create(enum bbus_hmap_type type)
+static void chained_reset(bbus_hashmap* map)
 {
-	return create_hashmap(type, DEF_MAP_SIZE);
+	struct chained_map* hmap = to_chained(map);
+
+	free_buckets(hmap->buckets, hmap->size);
+	if (hmap->oldbuckets != NULL) {
+		free_buckets(hmap->oldbuckets, hmap->oldsize);
+		__bbus_hmap_freetable(hmap->oldbuckets,
+				hmap->oldsize * sizeof(struct entry_list));
+		hmap->oldbuckets = NULL;
+	}
+	hmap->base.numstored = 0;
 }
 
-/* Prototype for enlarge_map(). */
-static int hmap_set(bbus_hashmap* hmap, const void* key,
-					size_t ksize, void* val);
+static void chained_free(bbus_hashmap* map)
+{
+	struct chained_map* hmap = to_chained(map);
 
-static int enlarge_map(bbus_hashmap* hmap)
+	chained_reset(map);
+	__bbus_hmap_freetable(hmap->buckets,
+				hmap->size * sizeof(struct entry_list));
+	bbus_free(hmap);
+}
+
+/*
+ * Moves up to 'num' old buckets to the new table. Entries are relinked,
+ * the keys aren't copied.
+ */
+static void migrate_buckets(struct chained_map* hmap, size_t num)
 {
-	bbus_hashmap* newmap;
+	struct entry_list* bucket;
 	struct map_entry* el;
-	unsigned i;
-	int r;
+	unsigned ind;
 
-	newmap = create_hashmap(hmap->type, hmap->size * 2);
-	if (newmap == NULL)
-		return -1;
-	for (i = 0; i < hmap->size; ++i) {
-		for (el = hmap->buckets[i].head; el != NULL; el = el->next) {
-			r = hmap_set(newmap, el->key, el->ksize, el->val);
-			if (r < 0) {
-				bbus_hmap_free(newmap);
-				return -1;
-			}
+	while (num-- > 0 && hmap->migrated < hmap->oldsize) {
+		bucket = &hmap->oldbuckets[hmap->migrated++];
+		while ((el = bucket->head) != NULL) {
+			bbus_list_rm(bucket, el);
+			ind = hmap->base.hash(el->key, el->ksize) % hmap->size;
+			bbus_list_push(&hmap->buckets[ind], el);
 		}
 	}
 
-	bbus_hmap_reset(hmap);
-	bbus_free(hmap->buckets);
-	hmap->size = newmap->size;
-	hmap->numstored = newmap->numstored;
-	hmap->buckets = newmap->buckets;
-	bbus_free(newmap); /* Free only the pointer to avoid a memory leak. */
+	if (hmap->migrated == hmap->oldsize) {
+		__bbus_hmap_freetable(hmap->oldbuckets,
+				hmap->oldsize * sizeof(struct entry_list));
+		hmap->oldbuckets = NULL;
+	} else {
+		__bbus_hmap_release(&hmap->released,
+				&hmap->oldbuckets[hmap->migrated]);
+	}
+}
+
+static int enlarge_map(struct chained_map* hmap)
+{
+	struct entry_list* newbuckets;
+
+	/*
+	 * The previous resize must be complete. Inserts move enough buckets
+	 * for that to be the case already, unless the load factor has been
+	 * lowered in the meantime.
+	 */
+	if (hmap->oldbuckets != NULL)
+		migrate_buckets(hmap, hmap->oldsize);
+
+	newbuckets = __bbus_hmap_alloctable(
+				hmap->size * 2 * sizeof(struct entry_list));
+	if (newbuckets == NULL)
+		return -1;
+
+	hmap->oldbuckets = hmap->buckets;
+	hmap->oldsize = hmap->size;
+	hmap->migrated = 0;
+	hmap->released = __bbus_hmap_pagealign(hmap->oldbuckets);
+	hmap->buckets = newbuckets;
+	hmap->size *= 2;
 
 	return 0;
 }
 
-static int hmap_set(bbus_hashmap* hmap, const void* key,
-					size_t ksize, void* val)
+static int key_equal(const struct map_entry* entr,
+				const void* key, size_t ksize)
 {
-	uint32_t crc;
-	unsigned ind;
-	int r;
-	struct map_entry* tmpel;
-	struct map_entry* newel;
+	return entr->ksize == ksize && memcmp(entr->key, key, ksize) == 0;
+}
 
-	if (hmap->numstored == hmap->size) {
-		r = enlarge_map(hmap);
-		if (r < 0)
-			return -1;
-	}
+static struct map_entry* search_bucket(struct entry_list* bucket,
+					const void* key, size_t ksize)
+{
+	struct map_entry* entr;
 
-	crc = bbus_crc32(key, ksize);
-	ind = crc % hmap->size;
-	if (hmap->buckets[ind].head == NULL) {
-		newel = bbus_malloc(sizeof(struct map_entry));
-		if (newel == NULL)
-			return -1;
-		newel->key = bbus_memdup(key, ksize);
-		if (newel->key == NULL) {
-			bbus_free(newel);
-			return -1;
-		}
-		newel->ksize = ksize;
-		newel->val = val;
-		bbus_list_push(&hmap->buckets[ind], newel);
-	} else {
-		for (tmpel = hmap->buckets[ind].head;
-				tmpel != NULL; tmpel = tmpel->next) {
-			if (memcmp(tmpel->key, key,
-					BBUS_MIN(tmpel->ksize, ksize)) == 0) {
-				tmpel->val = val;
-				return 0;
-			}
-		}
-		newel = bbus_malloc(sizeof(struct map_entry));
-		if (newel == NULL)
-			return -1;
-		newel->key = bbus_memdup(key, ksize);
-		if (newel->key == NULL) {
-			bbus_free(newel);
-			return -1;
-		}
-		newel->ksize = ksize;
-		newel->val = val;
-		bbus_list_push(&hmap->buckets[ind], newel);
+	for (entr = bucket->head; entr != NULL; entr = entr->next) {
+		if (key_equal(entr, key, ksize))
+			return entr;
 	}
 
-	hmap->numstored++;
-	return 0;
+	return NULL;
 }
 
-static struct map_entry* locate_entry(bbus_hashmap* hmap,
+static struct map_entry* locate_entry(struct chained_map* hmap,
 		const void* key, size_t ksize, struct entry_list** list)
 {
-	uint32_t crc;
-	unsigned ind;
+	struct entry_list* bucket;
 	struct map_entry* entr;
+	uint32_t hash;
+	unsigned ind;
 
-	crc = bbus_crc32(key, ksize);
-	ind = crc % hmap->size;
-	if (hmap->buckets[ind].head == NULL)
-		goto noelem;
-
-	for (entr = hmap->buckets[ind].head;
-			entr != NULL; entr = entr->next) {
-		if (memcmp(entr->key, key,
-				BBUS_MIN(entr->ksize, ksize)) == 0) {
-			if (list != NULL) {
-				/* bbus_hmap_rm() needs to know the bucket */
-				*list = &hmap->buckets[ind];
-			}
-			return entr;
+	hash = hmap->base.hash(key, ksize);
+	bucket = &hmap->buckets[hash % hmap->size];
+	entr = search_bucket(bucket, key, ksize);
+	if (entr == NULL && hmap->oldbuckets != NULL) {
+		ind = hash % hmap->oldsize;
+		/* Buckets below 'migrated' are already empty. */
+		if (ind >= hmap->migrated) {
+			bucket = &hmap->oldbuckets[ind];
+			entr = search_bucket(bucket, key, ksize);
 		}
 	}
 
-noelem:
-	return NULL;
+	if (entr != NULL && list != NULL) {
+		/* chained_rm() needs to know the bucket */
+		*list = bucket;
+	}
+
+	return entr;
 }
 
-static void* hmap_find(bbus_hashmap* hmap, const void* key,
-		size_t ksize)
+static int chained_set(bbus_hashmap* map, const void* key,
+					size_t ksize, void* val)
 {
+	struct chained_map* hmap = to_chained(map);
 	struct map_entry* entr;
+	unsigned ind;
+	int r;
+
+	if (hmap->oldbuckets != NULL)
+		migrate_buckets(hmap,
+			__BBUS_HMAP_MIGRATESTEP(&hmap->base, MIGRATE_STEP));
 
 	entr = locate_entry(hmap, key, ksize, NULL);
+	if (entr != NULL) {
+		entr->val = val;
+		return 0;
+	}
+
+	if ((hmap->base.numstored + 1) * 100
+				> hmap->size * hmap->base.maxload) {
+		r = enlarge_map(hmap);
+		if (r < 0)
+			return -1;
+	}
+
+	entr = make_entry(key, ksize, val);
+	if (entr == NULL)
+		return -1;
+
+	ind = hmap->base.hash(key, ksize) % hmap->size;
+	bbus_list_push(&hmap->buckets[ind], entr);
+	hmap->base.numstored++;
+
+	return 0;
+}
+
+static void* chained_find(bbus_hashmap* map, const void* key, size_t ksize)
+{
+	struct map_entry* entr;
+
+	entr = locate_entry(to_chained(map), key, ksize, NULL);
 	if (entr == NULL)
 		return NULL;
 	return entr->val;
 }
 
-static void* hmap_rm(bbus_hashmap* hmap, const void* key, size_t ksize)
+static void* chained_rm(bbus_hashmap* map, const void* key, size_t ksize)
 {
+	struct chained_map* hmap = to_chained(map);
 	struct map_entry* entr;
 	struct entry_list* bucket;
 	void* ret;
 
+	if (hmap->oldbuckets != NULL)
+		migrate_buckets(hmap,
+			__BBUS_HMAP_MIGRATESTEP(&hmap->base, MIGRATE_STEP));
+
 	entr = locate_entry(hmap, key, ksize, &bucket);
 	if (entr == NULL)
 		return NULL;
 	ret = entr->val;
 	bbus_list_rm(bucket, entr);
-	bbus_free(entr->key);
-	bbus_free(entr);
-	hmap->numstored--;
+	free_entry(entr);
+	hmap->base.numstored--;
 
 	return ret;
 }
 
+static int dump_buckets(char** buf, size_t* bufsize,
+		struct entry_list* buckets, size_t first, size_t size)
+{
+	struct map_entry* el;
+	size_t i;
+	int r;
+
+	for (i = first; i < size; ++i) {
+		r = __bbus_hmap_dumpappend(buf, bufsize,
+				"Bucket nr %u:\n%s", (unsigned)i,
+				buckets[i].head == NULL ? "" : "| ");
+		if (r < 0)
+			return -1;
+		el = buckets[i].head;
+		while (el != NULL) {
+			r = __bbus_hmap_dumpappend(buf, bufsize,
+				" [\"%s\"]->[0x%p] |%s",
+				__bbus_hmap_keyrepr(el->key),
+				el->val,
+				el->next == NULL ? "\n" : "");
+			if (r < 0)
+				return -1;
+			el = el->next;
+		}
+	}
+
+	return 0;
+}
+
+static int chained_dump(bbus_hashmap* map, char** buf, size_t* bufsize)
+{
+	struct chained_map* hmap = to_chained(map);
+	int r;
+
+	r = __bbus_hmap_dumpappend(buf, bufsize,
+			"Hashmap size: %u, objects stored: %u\n",
+			(unsigned)hmap->size, (unsigned)hmap->base.numstored);
+	if (r < 0)
+		return -1;
+
+	r = dump_buckets(buf, bufsize, hmap->buckets, 0, hmap->size);
+	if (r < 0)
+		return -1;
+
+	if (hmap->oldbuckets != NULL) {
+		r = __bbus_hmap_dumpappend(buf, bufsize,
+				"Old buckets not yet moved: %u\n",
+				(unsigned)(hmap->oldsize - hmap->migrated));
+		if (r < 0)
+			return -1;
+
+		r = dump_buckets(buf, bufsize, hmap->oldbuckets,
+					hmap->migrated, hmap->oldsize);
+		if (r < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static const struct __bbus_hmap_ops chained_ops = {
+	.defmaxload = 100,
+	.maxmaxload = 400,
+	.set = chained_set,
+	.find = chained_find,
+	.rm = chained_rm,
+	.reset = chained_reset,
+	.free = chained_free,
+	.dump = chained_dump,
+};
+
+/*
+ * Public interface.
+ */
+
+bbus_hashmap* bbus_hmap_create(enum bbus_hmap_type type)
+{
+	return bbus_hmap_create_impl(type, BBUS_HMAP_OPENADDR);
+}
+
+bbus_hashmap* bbus_hmap_create_impl(enum bbus_hmap_type type,
+						enum bbus_hmap_impl impl)
+{
+	switch (impl) {
+	case BBUS_HMAP_OPENADDR:
+		return __bbus_hmap_openaddr_create(type);
+	case BBUS_HMAP_CHAINED:
+		return __bbus_hmap_chained_create(type);
+	default:
+		__bbus_seterr(BBUS_EINVALARG);
+		return NULL;
+	}
+}
+
 #define CHECK_HMAP_TYPE(MAP, EXPECTED, RET)				\
 	do {								\
 		if ((MAP)->type != (EXPECTED)) {			\
@@ -232,75 +458,91 @@ static void* hmap_rm(bbus_hashmap* hmap, const void* key, size_t ksize)
 int bbus_hmap_setstr(bbus_hashmap* hmap, const char* key, void* val)
 {
 	CHECK_HMAP_TYPE(hmap, BBUS_HMAP_KEYSTR, -1);
-	return hmap_set(hmap, key, strlen(key), val);
+	return hmap->ops->set(hmap, key, strlen(key), val);
 }
 
 void* bbus_hmap_findstr(bbus_hashmap* hmap, const char* key)
 {
 	CHECK_HMAP_TYPE(hmap, BBUS_HMAP_KEYSTR, NULL);
-	return hmap_find(hmap, key, strlen(key));
+	return hmap->ops->find(hmap, key, strlen(key));
 }
 
 void* bbus_hmap_rmstr(bbus_hashmap* hmap, const char* key)
 {
 	CHECK_HMAP_TYPE(hmap, BBUS_HMAP_KEYSTR, NULL);
-	return hmap_rm(hmap, key, strlen(key));
+	return hmap->ops->rm(hmap, key, strlen(key));
 }
 
 int bbus_hmap_setuint(bbus_hashmap* hmap, unsigned key, void* val)
 {
 	CHECK_HMAP_TYPE(hmap, BBUS_HMAP_KEYUINT, -1);
-	return hmap_set(hmap, &key, sizeof(unsigned), val);
+	return hmap->ops->set(hmap, &key, sizeof(unsigned), val);
 }
 
 void* bbus_hmap_finduint(bbus_hashmap* hmap, unsigned key)
 {
 	CHECK_HMAP_TYPE(hmap, BBUS_HMAP_KEYUINT, NULL);
-	return hmap_find(hmap, &key, sizeof(unsigned));
+	return hmap->ops->find(hmap, &key, sizeof(unsigned));
 }
 
 void* bbus_hmap_rmuint(bbus_hashmap* hmap, unsigned key)
 {
 	CHECK_HMAP_TYPE(hmap, BBUS_HMAP_KEYUINT, NULL);
-	return hmap_rm(hmap, &key, sizeof(unsigned));
+	return hmap->ops->rm(hmap, &key, sizeof(unsigned));
 }
 
-void bbus_hmap_reset(bbus_hashmap* hmap)
+int bbus_hmap_sethashfunc(bbus_hashmap* hmap, bbus_hmap_hashfunc func)
 {
-	unsigned i;
-	struct map_entry* el;
-	struct map_entry* tmpel;
+	/* Entries are placed according to the hash, it can't change. */
+	if (hmap->numstored > 0) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return -1;
+	}
 
-	for (i = 0; i < hmap->size; ++i) {
-		el = hmap->buckets[i].head;
-		while (el != NULL) {
-			tmpel = el;
-			el = el->next;
-			bbus_free(tmpel->key);
-			bbus_free(tmpel);
-		}
-		hmap->buckets[i].head = NULL;
-		hmap->buckets[i].tail = NULL;
+	if (func == NULL)
+		func = __BBUS_HMAP_DEFHASH(hmap->type);
+	hmap->hash = func;
+
+	return 0;
+}
+
+int bbus_hmap_setmaxload(bbus_hashmap* hmap, unsigned percent)
+{
+	if (percent < 10 || percent > hmap->ops->maxmaxload) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return -1;
 	}
+
+	/* Takes effect at the next insert. */
+	hmap->maxload = percent;
+
+	return 0;
+}
+
+size_t bbus_hmap_size(bbus_hashmap* hmap)
+{
+	return hmap->numstored;
+}
+
+void bbus_hmap_reset(bbus_hashmap* hmap)
+{
+	hmap->ops->reset(hmap);
 }
 
 void bbus_hmap_free(bbus_hashmap* hmap)
 {
-	if (hmap) {
-		bbus_hmap_reset(hmap);
-		bbus_free(hmap->buckets);
-		bbus_free(hmap);
-	}
+	if (hmap)
+		hmap->ops->free(hmap);
 }
 
-static int BBUS_PRINTF_FUNC(3, 4) dump_append(char** buf,
-		size_t* bufsize, const char* fmt, ...)
+int __bbus_hmap_dumpappend(char** buf, size_t* bufsize, const char* fmt, ...)
 {
 	int r;
 	va_list va;
 
 	va_start(va, fmt);
 	r = vsnprintf(*buf, *bufsize, fmt, va);
+	va_end(va);
 	if (r >= (int)(*bufsize)) {
 		__bbus_seterr(BBUS_ENOSPACE);
 		return -1;
@@ -311,48 +553,75 @@ static int BBUS_PRINTF_FUNC(3, 4) dump_append(char** buf,
 	return 0;
 }
 
-static const char* keyrepr(const void* src, size_t srcsize BBUS_UNUSED,
-				char* dst BBUS_UNUSED,
-				size_t dstsize BBUS_UNUSED)
+/* Memory of an old table is given back in chunks at least this big. */
+#define RELEASE_BYTES (64 * 1024)
+/* Tables at least this big are mapped directly. */
+#define TABLE_MMAPBYTES (128 * 1024)
+
+static uintptr_t page_mask(void)
 {
-	return (const char*)src; /* TODO Do a proper conversion. */
+	return ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
 }
 
-int bbus_hmap_dump(bbus_hashmap* hmap, char* buf, size_t bufsize)
+/*
+ * Allocates a zeroed table of 'size' bytes. Big tables are mapped directly
+ * rather than taken from the heap, which may have to clear them first - the
+ * kernel hands out zeroed pages as they're first touched instead.
+ */
+void* __bbus_hmap_alloctable(size_t size)
 {
-	unsigned i;
-	int r;
-	struct map_entry* el;
-	char reprbuf[1024];
+	void* table;
 
-	memset(buf, 0, bufsize);
-	r = dump_append(&buf, &bufsize,
-			"Hashmap size: %u, objects stored: %u\n",
-			(unsigned)hmap->size, (unsigned)hmap->numstored);
-	if (r < 0)
-		return -1;
+	if (size < TABLE_MMAPBYTES)
+		return bbus_malloc0(size);
 
-	for (i = 0; i < hmap->size; ++i) {
-		r = dump_append(&buf, &bufsize, "Bucket nr %u:\n%s", i,
-				hmap->buckets[i].head == NULL ? "" : "| ");
-		if (r < 0)
-			return -1;
-		el = hmap->buckets[i].head;
-		while (el != NULL) {
-			r = dump_append(&buf, &bufsize,
-				" [\"%s\"]->[0x%p] |%s",
-				keyrepr(el->key, el->ksize, reprbuf,
-						sizeof(reprbuf)),
-				el->val,
-				el->next == NULL ? "\n" : "");
-			if (r < 0)
-				return -1;
-			el = el->next;
-		}
+	table = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (table == MAP_FAILED) {
+		__bbus_seterr(BBUS_ENOMEM);
+		return NULL;
 	}
 
-	return 0;
+	return table;
+}
+
+void __bbus_hmap_freetable(void* table, size_t size)
+{
+	if (size < TABLE_MMAPBYTES)
+		bbus_free(table);
+	else if (table != NULL)
+		(void)munmap(table, size);
 }
 
+/*
+ * Returns the address of the first page boundary not below addr.
+ */
+uintptr_t __bbus_hmap_pagealign(const void* addr)
+{
+	return ((uintptr_t)addr + ~page_mask()) & page_mask();
+}
+
+/*
+ * Growing maps free the old table once all entries have been moved out of
+ * it, which takes milliseconds for a big one. Instead, the whole pages
+ * between *released and end, which are known not to be read anymore, are
+ * given back to the kernel as the entries are moved. Should anything read
+ * them after all, it will find zeroes.
+ */
+void __bbus_hmap_release(uintptr_t* released, const void* end)
+{
+	uintptr_t to;
+
+	to = (uintptr_t)end & page_mask();
+	if (to < *released + RELEASE_BYTES)
+		return;
 
+	(void)madvise((void*)*released, to - *released, MADV_DONTNEED);
+	*released = to;
+}
 
+int bbus_hmap_dump(bbus_hashmap* hmap, char* buf, size_t bufsize)
+{
+	memset(buf, 0, bufsize);
+	return hmap->ops->dump(hmap, &buf, &bufsize);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BBUS_HASHMAP__
+#define __BBUS_HASHMAP__
+
+#include <busybus.h>
+#include <stdint.h>
+
+/*
+ * Every hashmap implementation provides these operations. Keys are passed
+ * as raw memory buffers, the type checks are done by the public wrappers.
+ */
+struct __bbus_hmap_ops
+{
+	/* Default and maximum load factor in percent. */
+	unsigned defmaxload;
+	unsigned maxmaxload;
+	int (*set)(bbus_hashmap*, const void*, size_t, void*);
+	void* (*find)(bbus_hashmap*, const void*, size_t);
+	void* (*rm)(bbus_hashmap*, const void*, size_t);
+	void (*reset)(bbus_hashmap*);
+	void (*free)(bbus_hashmap*);
+	int (*dump)(bbus_hashmap*, char**, size_t*);
+};
+
+/*
+ * Common part of all hashmaps, must be the first member of the
+ * implementation specific structure.
+ */
+struct __bbus_hashmap
+{
+	const struct __bbus_hmap_ops* ops;
+	enum bbus_hmap_type type;
+	bbus_hmap_hashfunc hash;
+	/* The map grows when it's fuller than this, in percent. */
+	unsigned maxload;
+	size_t numstored;
+};
+
+/*
+ * Number of old slots or buckets, that a growing map moves per operation.
+ * Growing again takes at least maxload percent of the old size in inserts,
+ * so moving 100 / maxload per insert finishes the previous resize first.
+ */
+#define __BBUS_HMAP_MIGRATESTEP(MAP, MIN)				\
+	((100 + (MAP)->maxload - 1) / (MAP)->maxload > (MIN)		\
+		? (100 + (MAP)->maxload - 1) / (MAP)->maxload : (MIN))
+
+#define __BBUS_HMAP_DEFHASH(TYPE)					\
+	((TYPE) == BBUS_HMAP_KEYUINT ? bbus_hash_uint : bbus_hash_str)
+
+bbus_hashmap* __bbus_hmap_chained_create(enum bbus_hmap_type type);
+bbus_hashmap* __bbus_hmap_openaddr_create(enum bbus_hmap_type type);
+
+int __bbus_hmap_dumpappend(char** buf, size_t* bufsize,
+		const char* fmt, ...) BBUS_PRINTF_FUNC(3, 4);
+
+void* __bbus_hmap_alloctable(size_t size);
+void __bbus_hmap_freetable(void* table, size_t size);
+uintptr_t __bbus_hmap_pagealign(const void* addr);
+void __bbus_hmap_release(uintptr_t* released, const void* end);
+
+/* TODO Do a proper conversion, uint keys are printed as strings. */
+#define __bbus_hmap_keyrepr(KEY) ((const char*)(KEY))
+
+#endif /* __BBUS_HASHMAP__ */
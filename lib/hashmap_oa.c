@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Open addressing hashmap with Robin Hood probing.
+ *
+ * All entries live in a single array of slots. Each slot stores the full
+ * hash of its key, so that growing the map doesn't require hashing the keys
+ * again and most mismatches are detected without touching the key. Keys
+ * shorter than INLINE_KEYSIZE are kept in the slot itself - a slot is
+ * exactly one cache line, so a lookup for a short key usually touches one
+ * or two of them.
+ *
+ * Robin Hood insertion keeps the probe sequences short: an entry which is
+ * further from its home slot takes the place of one which is closer to its
+ * own. Thanks to that a lookup can stop as soon as it reaches an entry
+ * closer to home than the searched key would be. Removal shifts the
+ * following entries back, so no tombstones are needed.
+ *
+ * Growing the map doesn't move all entries at once. A new, twice as large
+ * array is allocated and every insert or removal moves a few old slots to
+ * it. The old array is frozen in the meantime: nothing is inserted there,
+ * and moved or removed entries are marked instead of shifting the
+ * following ones, so that the probe sequences in it stay intact. Lookups
+ * check both arrays until all entries have been moved.
+ *
+ * The new array comes zeroed from the kernel and is only faulted in as it
+ * fills up, while the pages of the old one are given back in steps as
+ * soon as their slots have been moved. Lookups in the old array skip the
+ * moved slots instead of probing through them.
+ */
+
+#include <busybus.h>
+#include "hashmap.h"
+#include <string.h>
+#include <stdint.h>
+
+#define DEF_MAP_SIZE 16
+
+#define INLINE_KEYSIZE 40
+#define CACHELINE 64
+
+/* Minimum number of old slots moved per operation. */
+#define MIGRATE_STEP 8
+
+/* Key size of the entries moved out of, or removed from, the old array. */
+#define KSIZE_GONE UINT32_MAX
+
+struct oa_slot
+{
+	uint32_t hash;
+	/* Distance from the home slot plus one, 0 means the slot is empty. */
+	uint32_t dist;
+	uint32_t ksize;
+	void* val;
+	union
+	{
+		/* Null-terminated, just like in the chained map. */
+		char buf[INLINE_KEYSIZE];
+		char* ptr;
+	} key;
+};
+
+struct oa_table
+{
+	/* Slots are aligned to the cache line size within mem. */
+	struct oa_slot* slots;
+	void* mem;
+	size_t size;
+	size_t mask;
+};
+
+struct oa_map
+{
+	struct __bbus_hashmap base;
+	struct oa_table tbl;
+	/* Set while the entries are being moved to tbl. */
+	struct oa_table old;
+	size_t migrated;
+	/* Memory of the old array below this address has been given back. */
+	uintptr_t released;
+};
+
+#define to_oa(MAP) ((struct oa_map*)(MAP))
+
+static const struct __bbus_hmap_ops oa_ops;
+
+static int key_inline(uint32_t ksize)
+{
+	return ksize < INLINE_KEYSIZE;
+}
+
+static const char* slot_key(const struct oa_slot* slot)
+{
+	return key_inline(slot->ksize) ? slot->key.buf : slot->key.ptr;
+}
+
+static int slot_used(const struct oa_slot* slot)
+{
+	return slot->dist != 0 && slot->ksize != KSIZE_GONE;
+}
+
+static void free_key(struct oa_slot* slot)
+{
+	if (!key_inline(slot->ksize))
+		bbus_free(slot->key.ptr);
+}
+
+static size_t table_bytes(size_t size)
+{
+	return size * sizeof(struct oa_slot) + CACHELINE - 1;
+}
+
+static int alloc_table(struct oa_table* tbl, size_t size)
+{
+	uintptr_t addr;
+
+	tbl->mem = __bbus_hmap_alloctable(table_bytes(size));
+	if (tbl->mem == NULL)
+		return -1;
+
+	addr = ((uintptr_t)tbl->mem + CACHELINE - 1)
+					& ~(uintptr_t)(CACHELINE - 1);
+	tbl->slots = (struct oa_slot*)addr;
+	tbl->size = size;
+	tbl->mask = size - 1;
+
+	return 0;
+}
+
+/*
+ * Frees the keys of all entries still in the table and the table itself.
+ */
+static void free_table(struct oa_table* tbl)
+{
+	size_t i;
+
+	for (i = 0; i < tbl->size; ++i) {
+		if (slot_used(&tbl->slots[i]))
+			free_key(&tbl->slots[i]);
+	}
+	__bbus_hmap_freetable(tbl->mem, table_bytes(tbl->size));
+	memset(tbl, 0, sizeof(struct oa_table));
+}
+
+bbus_hashmap* __bbus_hmap_openaddr_create(enum bbus_hmap_type type)
+{
+	struct oa_map* hmap;
+	int r;
+
+	hmap = bbus_malloc0(sizeof(struct oa_map));
+	if (hmap == NULL)
+		return NULL;
+
+	r = alloc_table(&hmap->tbl, DEF_MAP_SIZE);
+	if (r < 0) {
+		bbus_free(hmap);
+		return NULL;
+	}
+
+	hmap->base.ops = &oa_ops;
+	hmap->base.type = type;
+	hmap->base.hash = __BBUS_HMAP_DEFHASH(type);
+	hmap->base.maxload = oa_ops.defmaxload;
+
+	return (bbus_hashmap*)hmap;
+}
+
+/*
+ * Puts an entry, which is known not to be in the table yet, in its place.
+ */
+static void place_slot(struct oa_table* tbl, struct oa_slot* entr)
+{
+	struct oa_slot tmp;
+	struct oa_slot* slot;
+	size_t ind;
+
+	entr->dist = 1;
+	ind = entr->hash & tbl->mask;
+	for (;;) {
+		slot = &tbl->slots[ind];
+		if (slot->dist == 0) {
+			*slot = *entr;
+			return;
+		}
+
+		if (slot->dist < entr->dist) {
+			tmp = *slot;
+			*slot = *entr;
+			*entr = tmp;
+		}
+
+		entr->dist++;
+		ind = (ind + 1) & tbl->mask;
+	}
+}
+
+/*
+ * Moves up to 'num' slots from the old table. The hashes are stored in
+ * the slots, so the keys aren't hashed again.
+ */
+static void migrate_slots(struct oa_map* hmap, size_t num)
+{
+	struct oa_slot* slot;
+	struct oa_slot entr;
+
+	while (num-- > 0 && hmap->migrated < hmap->old.size) {
+		slot = &hmap->old.slots[hmap->migrated++];
+		if (slot_used(slot)) {
+			entr = *slot;
+			place_slot(&hmap->tbl, &entr);
+			slot->ksize = KSIZE_GONE;
+		}
+	}
+
+	if (hmap->migrated == hmap->old.size) {
+		/* All keys have been moved, don't scan the table again. */
+		__bbus_hmap_freetable(hmap->old.mem,
+					table_bytes(hmap->old.size));
+		memset(&hmap->old, 0, sizeof(struct oa_table));
+	} else {
+		/* Moved slots read as empty once their pages are gone. */
+		__bbus_hmap_release(&hmap->released,
+				&hmap->old.slots[hmap->migrated]);
+	}
+}
+
+static int enlarge_map(struct oa_map* hmap)
+{
+	struct oa_table newtbl;
+	int r;
+
+	/*
+	 * The previous resize must be complete. Inserts move enough slots
+	 * for that to be the case already, unless the load factor has been
+	 * lowered in the meantime.
+	 */
+	if (hmap->old.slots != NULL)
+		migrate_slots(hmap, hmap->old.size);
+
+	r = alloc_table(&newtbl, hmap->tbl.size * 2);
+	if (r < 0)
+		return -1;
+
+	hmap->old = hmap->tbl;
+	hmap->tbl = newtbl;
+	hmap->migrated = 0;
+	hmap->released = __bbus_hmap_pagealign(hmap->old.slots);
+
+	return 0;
+}
+
+/*
+ * Slots below 'first' are known to be empty or gone and aren't read.
+ */
+static struct oa_slot* search_table(struct oa_table* tbl, uint32_t hash,
+			const void* key, size_t ksize, size_t first)
+{
+	struct oa_slot* slot;
+	uint32_t dist;
+	size_t ind;
+
+	ind = hash & tbl->mask;
+	for (dist = 1;; ++dist) {
+		if (ind < first) {
+			dist += first - ind;
+			ind = first;
+		}
+
+		slot = &tbl->slots[ind];
+		/*
+		 * An empty slot or an entry closer to its home than we are
+		 * to ours - the key would have been placed before it.
+		 */
+		if (slot->dist < dist)
+			return NULL;
+
+		if (slot->hash == hash && slot->ksize == ksize
+				&& memcmp(slot_key(slot), key, ksize) == 0)
+			return slot;
+
+		ind = (ind + 1) & tbl->mask;
+	}
+}
+
+static struct oa_slot* locate_slot(struct oa_map* hmap, uint32_t hash,
+			const void* key, size_t ksize, struct oa_table** tbl)
+{
+	struct oa_slot* slot;
+
+	*tbl = &hmap->tbl;
+	slot = search_table(&hmap->tbl, hash, key, ksize, 0);
+	if (slot == NULL && hmap->old.slots != NULL) {
+		*tbl = &hmap->old;
+		slot = search_table(&hmap->old, hash, key,
+					ksize, hmap->migrated);
+	}
+
+	return slot;
+}
+
+static int oa_set(bbus_hashmap* map, const void* key,
+					size_t ksize, void* val)
+{
+	struct oa_map* hmap = to_oa(map);
+	struct oa_table* tbl;
+	struct oa_slot* slot;
+	struct oa_slot entr;
+	uint32_t hash;
+	char* keybuf;
+	int r;
+
+	if (hmap->old.slots != NULL)
+		migrate_slots(hmap,
+			__BBUS_HMAP_MIGRATESTEP(&hmap->base, MIGRATE_STEP));
+
+	hash = hmap->base.hash(key, ksize);
+	slot = locate_slot(hmap, hash, key, ksize, &tbl);
+	if (slot != NULL) {
+		slot->val = val;
+		return 0;
+	}
+
+	if ((hmap->base.numstored + 1) * 100
+				> hmap->tbl.size * hmap->base.maxload) {
+		r = enlarge_map(hmap);
+		if (r < 0)
+			return -1;
+	}
+
+	memset(&entr, 0, sizeof(struct oa_slot));
+	if (key_inline(ksize)) {
+		keybuf = entr.key.buf;
+	} else {
+		keybuf = bbus_malloc(ksize + 1);
+		if (keybuf == NULL)
+			return -1;
+		entr.key.ptr = keybuf;
+	}
+
+	memcpy(keybuf, key, ksize);
+	keybuf[ksize] = '\0';
+	entr.hash = hash;
+	entr.ksize = ksize;
+	entr.val = val;
+	place_slot(&hmap->tbl, &entr);
+	hmap->base.numstored++;
+
+	return 0;
+}
+
+static void* oa_find(bbus_hashmap* map, const void* key, size_t ksize)
+{
+	struct oa_table* tbl;
+	struct oa_slot* slot;
+
+	slot = locate_slot(to_oa(map), map->hash(key, ksize),
+							key, ksize, &tbl);
+	if (slot == NULL)
+		return NULL;
+	return slot->val;
+}
+
+static void* oa_rm(bbus_hashmap* map, const void* key, size_t ksize)
+{
+	struct oa_map* hmap = to_oa(map);
+	struct oa_table* tbl;
+	struct oa_slot* slot;
+	struct oa_slot* next;
+	size_t ind;
+	void* ret;
+
+	if (hmap->old.slots != NULL)
+		migrate_slots(hmap,
+			__BBUS_HMAP_MIGRATESTEP(&hmap->base, MIGRATE_STEP));
+
+	slot = locate_slot(hmap, map->hash(key, ksize), key, ksize, &tbl);
+	if (slot == NULL)
+		return NULL;
+
+	ret = slot->val;
+	free_key(slot);
+	hmap->base.numstored--;
+
+	if (tbl == &hmap->old) {
+		/* Don't break the probe sequences in the frozen table. */
+		slot->ksize = KSIZE_GONE;
+		return ret;
+	}
+
+	/* Shift the following entries back until one is at its home. */
+	ind = slot - tbl->slots;
+	for (;;) {
+		next = &tbl->slots[(ind + 1) & tbl->mask];
+		if (next->dist <= 1)
+			break;
+
+		*slot = *next;
+		slot->dist--;
+		slot = next;
+		ind = (ind + 1) & tbl->mask;
+	}
+	memset(slot, 0, sizeof(struct oa_slot));
+
+	return ret;
+}
+
+static void oa_reset(bbus_hashmap* map)
+{
+	struct oa_map* hmap = to_oa(map);
+	size_t i;
+
+	for (i = 0; i < hmap->tbl.size; ++i) {
+		if (slot_used(&hmap->tbl.slots[i]))
+			free_key(&hmap->tbl.slots[i]);
+	}
+	memset(hmap->tbl.slots, 0, hmap->tbl.size * sizeof(struct oa_slot));
+	if (hmap->old.slots != NULL)
+		free_table(&hmap->old);
+	hmap->base.numstored = 0;
+}
+
+static void oa_free(bbus_hashmap* map)
+{
+	struct oa_map* hmap = to_oa(map);
+
+	if (hmap->old.slots != NULL)
+		free_table(&hmap->old);
+	free_table(&hmap->tbl);
+	bbus_free(hmap);
+}
+
+static int dump_table(char** buf, size_t* bufsize, struct oa_table* tbl)
+{
+	struct oa_slot* slot;
+	size_t i;
+	int r;
+
+	for (i = 0; i < tbl->size; ++i) {
+		slot = &tbl->slots[i];
+		if (!slot_used(slot))
+			continue;
+
+		r = __bbus_hmap_dumpappend(buf, bufsize,
+				"Slot nr %u: [\"%s\"]->[0x%p] (distance: %u)\n",
+				(unsigned)i,
+				__bbus_hmap_keyrepr(slot_key(slot)),
+				slot->val, slot->dist - 1);
+		if (r < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int oa_dump(bbus_hashmap* map, char** buf, size_t* bufsize)
+{
+	struct oa_map* hmap = to_oa(map);
+	int r;
+
+	r = __bbus_hmap_dumpappend(buf, bufsize,
+			"Hashmap size: %u, objects stored: %u\n",
+			(unsigned)hmap->tbl.size,
+			(unsigned)hmap->base.numstored);
+	if (r < 0)
+		return -1;
+
+	r = dump_table(buf, bufsize, &hmap->tbl);
+	if (r < 0)
+		return -1;
+
+	if (hmap->old.slots != NULL) {
+		r = __bbus_hmap_dumpappend(buf, bufsize,
+				"Old slots not yet moved: %u\n",
+				(unsigned)(hmap->old.size - hmap->migrated));
+		if (r < 0)
+			return -1;
+
+		r = dump_table(buf, bufsize, &hmap->old);
+		if (r < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static const struct __bbus_hmap_ops oa_ops = {
+	.defmaxload = 87,
+	.maxmaxload = 95,
+	.set = oa_set,
+	.find = oa_find,
+	.rm = oa_rm,
+	.reset = oa_reset,
+	.free = oa_free,
+	.dump = oa_dump,
+};
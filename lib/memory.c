@@ -15,6 +15,7 @@
 #include <busybus.h>
 #include "memory.h"
 #include "error.h"
+#include "stats.h"
 
 void* bbus_malloc(size_t size)
 {
@@ -25,6 +26,8 @@ void* bbus_malloc(size_t size)
 	p = malloc(size);
 	if (p == NULL)
 		__bbus_seterr(BBUS_ENOMEM);
+	else
+		__BBUS_MEMSTATS_ADD(allocs, 1);
 	return p;
 }
 
@@ -32,10 +35,17 @@ void* bbus_malloc0(size_t size)
 {
 	void* p;
 
-	p = bbus_malloc(size);
-	if (p)
-		memset(p, 0, size);
-
+	/*
+	 * Large blocks come zeroed from the kernel, calloc() avoids touching
+	 * them.
+	 */
+	if (size == 0)
+		size = 1;
+	p = calloc(1, size);
+	if (p == NULL)
+		__bbus_seterr(BBUS_ENOMEM);
+	else
+		__BBUS_MEMSTATS_ADD(allocs, 1);
 	return p;
 }
 
@@ -48,13 +58,17 @@ void* bbus_realloc(void* ptr, size_t size)
 	p = realloc(ptr, size);
 	if (p == NULL)
 		__bbus_seterr(BBUS_ENOMEM);
+	else
+		__BBUS_MEMSTATS_ADD(allocs, 1);
 	return p;
 }
 
 void bbus_free(void* ptr)
 {
-	if (ptr != NULL)
+	if (ptr != NULL) {
 		free(ptr);
+		__BBUS_MEMSTATS_ADD(frees, 1);
+	}
 }
 
 void* bbus_memdup(const void* src, size_t size)
@@ -68,3 +82,117 @@ void* bbus_memdup(const void* src, size_t size)
 	return newp;
 }
 
+struct arena_chunk
+{
+	struct arena_chunk* next;
+	size_t size;
+	size_t used;
+};
+
+struct __bbus_arena
+{
+	/* The newest chunk comes first, the first one is never freed. */
+	struct arena_chunk* chunks;
+	size_t chunksize;
+};
+
+/* Good enough for any type we store. */
+#define ARENA_ALIGN		(2 * sizeof(void*))
+#define ARENA_ROUNDUP(SIZE)						\
+	(((SIZE) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define CHUNK_HDRSIZE		ARENA_ROUNDUP(sizeof(struct arena_chunk))
+#define CHUNK_DATA(CHUNK)	((char*)(CHUNK) + CHUNK_HDRSIZE)
+
+static struct arena_chunk* add_chunk(bbus_arena* arena, size_t size)
+{
+	struct arena_chunk* chunk;
+
+	chunk = bbus_malloc(CHUNK_HDRSIZE + size);
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	return chunk;
+}
+
+bbus_arena* bbus_arena_create(size_t chunksize)
+{
+	bbus_arena* arena;
+
+	arena = bbus_malloc0(sizeof(struct __bbus_arena));
+	if (arena == NULL)
+		return NULL;
+
+	arena->chunksize = ARENA_ROUNDUP(chunksize);
+	if (add_chunk(arena, arena->chunksize) == NULL) {
+		bbus_free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void bbus_arena_free(bbus_arena* arena)
+{
+	struct arena_chunk* chunk;
+
+	if (arena == NULL)
+		return;
+
+	while (arena->chunks != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		bbus_free(chunk);
+	}
+
+	bbus_free(arena);
+}
+
+void* bbus_arena_alloc(bbus_arena* arena, size_t size)
+{
+	struct arena_chunk* chunk;
+	void* p;
+
+	size = size == 0 ? ARENA_ALIGN : ARENA_ROUNDUP(size);
+	chunk = arena->chunks;
+	if (chunk->size - chunk->used < size) {
+		chunk = add_chunk(arena, size > arena->chunksize
+						? size : arena->chunksize);
+		if (chunk == NULL)
+			return NULL;
+	}
+
+	p = CHUNK_DATA(chunk) + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
+
+void* bbus_arena_memdup(bbus_arena* arena, const void* src, size_t size)
+{
+	void* newp;
+
+	newp = bbus_arena_alloc(arena, size);
+	if (newp)
+		memcpy(newp, src, size);
+
+	return newp;
+}
+
+void bbus_arena_reset(bbus_arena* arena)
+{
+	struct arena_chunk* chunk;
+
+	while (arena->chunks->next != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		bbus_free(chunk);
+	}
+
+	arena->chunks->used = 0;
+}
+
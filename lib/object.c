@@ -28,7 +28,8 @@ struct __bbus_object
 	/* These fields are used for data extraction. */
 	int extracting;	/* 0 if not currently extracting, 1 otherwise. */
 	char* at;	/* Current position during extraction. */
-
+	int borrowed;	/* 1 if buf belongs to someone else, 0 otherwise. */
+	bbus_arena* arena;	/* Arena holding the object or NULL. */
 };
 
 #define BUFFER_BASE	64
@@ -39,10 +40,26 @@ bbus_object* bbus_obj_alloc(void)
 	return bbus_malloc0(sizeof(struct __bbus_object));
 }
 
+bbus_object* bbus_obj_arena_alloc(bbus_arena* arena)
+{
+	bbus_object* obj;
+
+	obj = bbus_arena_alloc(arena, sizeof(struct __bbus_object));
+	if (obj == NULL)
+		return NULL;
+
+	memset(obj, 0, sizeof(struct __bbus_object));
+	obj->arena = arena;
+
+	return obj;
+}
+
 void bbus_obj_free(bbus_object* obj)
 {
-	if (obj) {
-		bbus_free(obj->buf);
+	/* Objects in arenas are released all at once. */
+	if (obj && obj->arena == NULL) {
+		if (!obj->borrowed)
+			bbus_free(obj->buf);
 		bbus_free(obj);
 	}
 }
@@ -108,8 +125,29 @@ static int has_needed_space(bbus_object* obj, size_t needed)
 	return (obj->bufsize - obj->bufused) >= needed ? 1 : 0;
 }
 
+static int enlarge_arena_buffer(bbus_object* obj)
+{
+	size_t newsize;
+	char* newbuf;
+
+	newsize = obj->buf == NULL ? BUFFER_BASE : obj->bufsize*2;
+	newbuf = bbus_arena_alloc(obj->arena, newsize);
+	if (newbuf == NULL)
+		return -1;
+
+	if (obj->buf != NULL)
+		memcpy(newbuf, obj->buf, obj->bufused);
+	obj->buf = newbuf;
+	obj->bufsize = newsize;
+
+	return 0;
+}
+
 static int enlarge_buffer(bbus_object* obj)
 {
+	if (obj->arena != NULL)
+		return enlarge_arena_buffer(obj);
+
 	if (obj->buf == NULL) {
 		obj->buf = bbus_malloc0(BUFFER_BASE);
 		if (obj->buf == NULL)
@@ -145,6 +183,11 @@ static int insert_data(bbus_object* obj, const void* data, size_t size)
 {
 	int r;
 
+	if (obj->borrowed) {
+		__bbus_seterr(BBUS_EOBJRDONLY);
+		return -1;
+	}
+
 	r = make_enough_space(obj, size);
 	if (r < 0) {
 		__bbus_seterr(BBUS_ENOMEM);
@@ -343,6 +386,36 @@ bbus_object* bbus_obj_frombuf(const void* buf, size_t bufsize)
 	return obj;
 }
 
+bbus_object* bbus_obj_mkview(const void* buf, size_t bufsize)
+{
+	bbus_object* obj;
+
+	obj = bbus_obj_alloc();
+	if (obj == NULL)
+		return NULL;
+
+	bbus_obj_setview(obj, buf, bufsize);
+	return obj;
+}
+
+void bbus_obj_setview(bbus_object* obj, const void* buf, size_t bufsize)
+{
+	if (!obj->borrowed && obj->arena == NULL)
+		bbus_free(obj->buf);
+
+	/* The buffer is never written to through a view. */
+	obj->buf = (char*)buf;
+	obj->bufsize = bufsize;
+	obj->bufused = bufsize;
+	obj->extracting = 0;
+	obj->borrowed = 1;
+}
+
+int bbus_obj_isview(const bbus_object* obj)
+{
+	return obj->borrowed ? BBUS_TRUE : BBUS_FALSE;
+}
+
 struct va_list_box
 {
 	va_list va;
@@ -450,21 +523,11 @@ bbus_object* bbus_obj_build(const char* descr, ...)
 	return obj;
 }
 
-bbus_object* bbus_obj_vbuild(const char* descr, va_list va)
+static int build_obj(bbus_object* obj, const char* descr, va_list va)
 {
-	bbus_object* obj;
-	int ret;
+	int ret = 0;
 	struct va_list_box va_box;
 
-	if (!bbus_obj_descrvalid(descr)) {
-		__bbus_seterr(BBUS_EINVALARG);
-		return NULL;
-	}
-
-	obj = bbus_obj_alloc();
-	if (obj == NULL)
-		return NULL;
-
 	va_copy(va_box.va, va);
 
 	while (*descr) {
@@ -487,15 +550,54 @@ bbus_object* bbus_obj_vbuild(const char* descr, va_list va)
 			break;
 		}
 		if (ret < 0)
-			goto out;
+			break;
+	}
+
+	va_end(va_box.va);
+	return ret;
+}
+
+bbus_object* bbus_obj_vbuild(const char* descr, va_list va)
+{
+	bbus_object* obj;
+
+	if (!bbus_obj_descrvalid(descr)) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return NULL;
+	}
+
+	obj = bbus_obj_alloc();
+	if (obj == NULL)
+		return NULL;
+
+	if (build_obj(obj, descr, va) < 0) {
+		bbus_obj_free(obj);
+		return NULL;
 	}
 
 	return obj;
+}
 
-out:
-	va_end(va_box.va);
-	bbus_obj_free(obj);
-	return NULL;
+bbus_object* bbus_obj_arena_build(bbus_arena* arena, const char* descr, ...)
+{
+	bbus_object* obj;
+	va_list va;
+	int ret;
+
+	if (!bbus_obj_descrvalid(descr)) {
+		__bbus_seterr(BBUS_EINVALARG);
+		return NULL;
+	}
+
+	obj = bbus_obj_arena_alloc(arena);
+	if (obj == NULL)
+		return NULL;
+
+	va_start(va, descr);
+	ret = build_obj(obj, descr, va);
+	va_end(va);
+
+	return ret < 0 ? NULL : obj;
 }
 
 static int parse_simple_type(char descr, bbus_object* obj,
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include <busybus.h>
+#include "pool.h"
+#include <string.h>
+
+/*
+ * Objects are carved out of slabs, which are only returned to the heap
+ * when the pool is destroyed, unless the pool caps the number of cached
+ * objects. Freed objects are kept on a singly-linked list threaded through
+ * their first bytes.
+ */
+
+#define SLAB_SIZE	4096
+#define SLAB_MINOBJS	8
+
+struct pool_slab
+{
+	struct pool_slab* next;
+	struct pool_slab* prev;
+};
+
+#define SLAB_HDRSIZE	__BBUS_POOL_OBJSIZE(sizeof(struct pool_slab))
+
+bbus_pool* bbus_pool_create(size_t size)
+{
+	bbus_pool* pool;
+
+	pool = bbus_malloc0(sizeof(struct __bbus_pool));
+	if (pool == NULL)
+		return NULL;
+
+	__bbus_spinlock_init(&pool->lock);
+	pool->objsize = __BBUS_POOL_OBJSIZE(size);
+
+	return pool;
+}
+
+void bbus_pool_destroy(bbus_pool* pool)
+{
+	struct pool_slab* slab;
+
+	if (pool == NULL)
+		return;
+
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = slab->next;
+		bbus_free(slab);
+	}
+
+	bbus_free(pool);
+}
+
+/*
+ * Must be called with the pool lock held.
+ */
+static int add_slab(bbus_pool* pool)
+{
+	struct pool_slab* slab;
+	char* obj;
+	unsigned i;
+
+	if (pool->objsperslab == 0) {
+		pool->objsperslab = (SLAB_SIZE - SLAB_HDRSIZE) / pool->objsize;
+		if (pool->objsperslab < SLAB_MINOBJS)
+			pool->objsperslab = SLAB_MINOBJS;
+	}
+
+	slab = bbus_malloc(SLAB_HDRSIZE + pool->objsperslab * pool->objsize);
+	if (slab == NULL)
+		return -1;
+
+	slab->next = pool->slabs;
+	slab->prev = NULL;
+	if (pool->slabs != NULL)
+		pool->slabs->prev = slab;
+	pool->slabs = slab;
+	++pool->stats.slabs;
+
+	obj = (char*)slab + SLAB_HDRSIZE;
+	for (i = 0; i < pool->objsperslab; ++i, obj += pool->objsize) {
+		*(void**)obj = pool->freelist;
+		pool->freelist = obj;
+	}
+	pool->stats.cached += pool->objsperslab;
+
+	return 0;
+}
+
+void* bbus_pool_alloc(bbus_pool* pool)
+{
+	void* obj = NULL;
+
+	__bbus_spinlock_lock(&pool->lock);
+	if (pool->freelist == NULL && add_slab(pool) < 0)
+		goto out;
+
+	obj = pool->freelist;
+	pool->freelist = *(void**)obj;
+	--pool->stats.cached;
+	++pool->stats.inuse;
+	++pool->stats.allocs;
+
+out:
+	__bbus_spinlock_unlock(&pool->lock);
+	return obj;
+}
+
+void* bbus_pool_alloc0(bbus_pool* pool)
+{
+	void* obj;
+
+	obj = bbus_pool_alloc(pool);
+	if (obj != NULL)
+		memset(obj, 0, pool->objsize);
+
+	return obj;
+}
+
+/*
+ * Must be called with the pool lock held. Only works for pools with a single
+ * object per slab.
+ */
+static struct pool_slab* take_slab(bbus_pool* pool, void* obj)
+{
+	struct pool_slab* slab;
+
+	slab = (struct pool_slab*)((char*)obj - SLAB_HDRSIZE);
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		pool->slabs = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+	--pool->stats.slabs;
+
+	return slab;
+}
+
+void bbus_pool_free(bbus_pool* pool, void* obj)
+{
+	struct pool_slab* slab = NULL;
+
+	if (obj == NULL)
+		return;
+
+	__bbus_spinlock_lock(&pool->lock);
+	--pool->stats.inuse;
+	++pool->stats.frees;
+	if (pool->maxcached > 0 && pool->stats.cached >= pool->maxcached) {
+		slab = take_slab(pool, obj);
+	} else {
+		*(void**)obj = pool->freelist;
+		pool->freelist = obj;
+		++pool->stats.cached;
+	}
+	__bbus_spinlock_unlock(&pool->lock);
+
+	bbus_free(slab);
+}
+
+void bbus_pool_getstats(bbus_pool* pool, struct bbus_poolstats* stats)
+{
+	__bbus_spinlock_lock(&pool->lock);
+	memcpy(stats, &pool->stats, sizeof(struct bbus_poolstats));
+	__bbus_spinlock_unlock(&pool->lock);
+}
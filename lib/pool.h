@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BBUS_POOL__
+#define __BBUS_POOL__
+
+#include <busybus.h>
+#include "spinlock.h"
+
+struct pool_slab;
+
+struct __bbus_pool
+{
+	struct __bbus_spinlock lock;
+	size_t objsize;
+	unsigned objsperslab;
+	/* Free objects kept for reuse at most, 0 for no limit. */
+	unsigned long maxcached;
+	void* freelist;
+	struct pool_slab* slabs;
+	struct bbus_poolstats stats;
+};
+
+#define __BBUS_POOL_ALIGN	(2 * sizeof(void*))
+#define __BBUS_POOL_OBJSIZE(SIZE)					\
+	((((SIZE) < sizeof(void*) ? sizeof(void*) : (SIZE))		\
+		+ __BBUS_POOL_ALIGN - 1) & ~(__BBUS_POOL_ALIGN - 1))
+
+/*
+ * Allows to define pools statically, so that they can't fail to be created.
+ * Such pools must not be passed to bbus_pool_destroy().
+ */
+#define __BBUS_POOL_INITIALIZER(SIZE)					\
+	{								\
+		.lock = __BBUS_SPINLOCK_INITIALIZER,			\
+		.objsize = __BBUS_POOL_OBJSIZE(SIZE),			\
+	}
+
+/*
+ * Same as above, but the pool keeps at most MAXCACHED free objects and
+ * returns the rest to the heap. Every object gets a slab of its own, so
+ * that it can be freed on its own - it's meant for big objects.
+ */
+#define __BBUS_POOL_CAPPED_INITIALIZER(SIZE, MAXCACHED)			\
+	{								\
+		.lock = __BBUS_SPINLOCK_INITIALIZER,			\
+		.objsize = __BBUS_POOL_OBJSIZE(SIZE),			\
+		.objsperslab = 1,					\
+		.maxcached = (MAXCACHED),				\
+	}
+
+#endif /* __BBUS_POOL__ */
@@ -17,13 +17,13 @@
 #include "error.h"
 #include "protocol.h"
 #include "spinlock.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdint.h>
 
-#define MAX_NUMIOV (BBUS_MSGHDR_NUMFIELDS + 2) /* Header + meta + object. */
 
 static struct __bbus_spinlock sockpath_lock;
 static char sockpath[BBUS_PROT_SOCKPATHMAX];
@@ -65,30 +65,246 @@ static int hdr_check_magic(const struct bbus_msg_hdr* hdr)
 						? BBUS_TRUE : BBUS_FALSE;
 }
 
-static void header_to_iovec(const struct bbus_msg_hdr* hdr,
-				struct iovec* iov, int* numiov)
-{
-	iov[*numiov].iov_base = (void*)&hdr->magic;
-	iov[*numiov].iov_len = sizeof(hdr->magic);
-	++*numiov;
-	iov[*numiov].iov_base = (void*)&hdr->msgtype;
-	iov[*numiov].iov_len = sizeof(hdr->msgtype);
-	++*numiov;
-	iov[*numiov].iov_base = (void*)&hdr->sotype;
-	iov[*numiov].iov_len = sizeof(hdr->sotype);
-	++*numiov;
-	iov[*numiov].iov_base = (void*)&hdr->errcode;
-	iov[*numiov].iov_len = sizeof(hdr->errcode);
-	++*numiov;
-	iov[*numiov].iov_base = (void*)&hdr->token;
-	iov[*numiov].iov_len = sizeof(hdr->token);
-	++*numiov;
-	iov[*numiov].iov_base = (void*)&hdr->psize;
-	iov[*numiov].iov_len = sizeof(hdr->psize);
-	++*numiov;
-	iov[*numiov].iov_base = (void*)&hdr->flags;
-	iov[*numiov].iov_len = sizeof(hdr->flags);
-	++*numiov;
+/* The last field must end exactly where the header does. */
+typedef char __wirehdr_size_check[(__BBUS_PROT_WIREOFF_FLAGS + 1
+				== BBUS_MSGHDR_REALSIZE) ? 1 : -1];
+
+static size_t maxpload = BBUS_PROT_DEFMAXPLOAD;
+
+static void BBUS_ATSTART maxpload_init(void)
+{
+	char* env;
+	char* end;
+	unsigned long val;
+
+	env = getenv(BBUS_ENV_MAXPLOAD);
+	if (env == NULL)
+		return;
+
+	val = strtoul(env, &end, 10);
+	if (*env != '\0' && *end == '\0')
+		bbus_prot_setmaxpload((size_t)val);
+}
+
+void bbus_prot_setmaxpload(size_t size)
+{
+	if (size < BBUS_MAXPLOADSIZE)
+		size = BBUS_MAXPLOADSIZE;
+	else
+	if (size > UINT32_MAX)
+		size = UINT32_MAX;
+
+	BBUS_ATOMIC_SET(maxpload, size);
+}
+
+size_t bbus_prot_getmaxpload(void)
+{
+	return BBUS_ATOMIC_GET(maxpload);
+}
+
+static int check_psize(size_t psize)
+{
+	if (psize > bbus_prot_getmaxpload()) {
+		__bbus_seterr(BBUS_EMSGTOOBIG);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Stores the header in its on-wire format in a buffer of at least
+ * __BBUS_PROT_MAXWIREHDR bytes and returns the number of bytes used.
+ * Payload sizes not fitting in 16 bits are stored after the header and
+ * signalled with the BBUS_PROT_EXTLEN flag, the call identifier and the
+ * call timeout come next if there are any.
+ */
+size_t __bbus_prot_hdrencode(const struct bbus_msg_hdr* hdr,
+				unsigned char* wirehdr)
+{
+	uint32_t psize;
+	uint16_t psize16;
+	uint8_t flags;
+
+	psize = (uint32_t)bbus_hdr_getpsize(hdr);
+	flags = hdr->flags & ~BBUS_PROT_EXTLEN;
+	if (psize > UINT16_MAX) {
+		flags |= BBUS_PROT_EXTLEN;
+		psize16 = 0;
+	} else {
+		psize16 = htons((uint16_t)psize);
+	}
+
+	memcpy(wirehdr + __BBUS_PROT_WIREOFF_MAGIC,
+				&hdr->magic, sizeof(hdr->magic));
+	wirehdr[__BBUS_PROT_WIREOFF_MSGTYPE] = hdr->msgtype;
+	wirehdr[__BBUS_PROT_WIREOFF_SOTYPE] = hdr->sotype;
+	wirehdr[__BBUS_PROT_WIREOFF_ERRCODE] = hdr->errcode;
+	memcpy(wirehdr + __BBUS_PROT_WIREOFF_TOKEN,
+				&hdr->token, sizeof(hdr->token));
+	memcpy(wirehdr + __BBUS_PROT_WIREOFF_PSIZE,
+				&psize16, sizeof(psize16));
+	wirehdr[__BBUS_PROT_WIREOFF_FLAGS] = flags;
+
+	if (flags & BBUS_PROT_EXTLEN) {
+		memcpy(wirehdr + __BBUS_PROT_WIREOFF_EXTPSIZE,
+					&hdr->psize, sizeof(hdr->psize));
+	}
+
+	if (flags & BBUS_PROT_HASCALLID) {
+		memcpy(wirehdr + __BBUS_PROT_WIREOFF_CALLID(flags),
+					&hdr->callid, sizeof(hdr->callid));
+	}
+
+	if (flags & BBUS_PROT_HASTIMEOUT) {
+		memcpy(wirehdr + __BBUS_PROT_WIREOFF_TIMEOUT(flags),
+					&hdr->timeout, sizeof(hdr->timeout));
+	}
+
+	return __bbus_prot_wirehdrsize(wirehdr);
+}
+
+/*
+ * Returns the size of the on-wire header, whose first BBUS_MSGHDR_REALSIZE
+ * bytes are stored in wirehdr.
+ */
+size_t __bbus_prot_wirehdrsize(const unsigned char* wirehdr)
+{
+	uint8_t flags;
+
+	flags = wirehdr[__BBUS_PROT_WIREOFF_FLAGS];
+	return __BBUS_PROT_WIREOFF_TIMEOUT(flags)
+		+ (flags & BBUS_PROT_HASTIMEOUT ? sizeof(uint32_t) : 0);
+}
+
+/*
+ * The whole header as indicated by __bbus_prot_wirehdrsize() must be
+ * present in wirehdr.
+ */
+void __bbus_prot_hdrdecode(struct bbus_msg_hdr* hdr,
+				const unsigned char* wirehdr)
+{
+	uint16_t psize16;
+
+	memset(hdr, 0, sizeof(struct bbus_msg_hdr));
+	memcpy(&hdr->magic, wirehdr + __BBUS_PROT_WIREOFF_MAGIC,
+						sizeof(hdr->magic));
+	hdr->msgtype = wirehdr[__BBUS_PROT_WIREOFF_MSGTYPE];
+	hdr->sotype = wirehdr[__BBUS_PROT_WIREOFF_SOTYPE];
+	hdr->errcode = wirehdr[__BBUS_PROT_WIREOFF_ERRCODE];
+	memcpy(&hdr->token, wirehdr + __BBUS_PROT_WIREOFF_TOKEN,
+						sizeof(hdr->token));
+	hdr->flags = wirehdr[__BBUS_PROT_WIREOFF_FLAGS];
+
+	if (hdr->flags & BBUS_PROT_EXTLEN) {
+		memcpy(&hdr->psize, wirehdr + __BBUS_PROT_WIREOFF_EXTPSIZE,
+							sizeof(hdr->psize));
+	} else {
+		memcpy(&psize16, wirehdr + __BBUS_PROT_WIREOFF_PSIZE,
+							sizeof(psize16));
+		bbus_hdr_setpsize(hdr, ntohs(psize16));
+	}
+
+	if (hdr->flags & BBUS_PROT_HASCALLID) {
+		memcpy(&hdr->callid,
+			wirehdr + __BBUS_PROT_WIREOFF_CALLID(hdr->flags),
+			sizeof(hdr->callid));
+	}
+
+	if (hdr->flags & BBUS_PROT_HASTIMEOUT) {
+		memcpy(&hdr->timeout,
+			wirehdr + __BBUS_PROT_WIREOFF_TIMEOUT(hdr->flags),
+			sizeof(hdr->timeout));
+	}
+}
+
+/*
+ * Makes sure the buffer can hold a message with a payload of given size.
+ */
+int __bbus_prot_growbuf(struct bbus_msg** buf, size_t* bufsize, size_t psize)
+{
+	struct bbus_msg* newbuf;
+	size_t newsize;
+
+	newsize = BBUS_MSGHDR_SIZE + psize;
+	if (*buf != NULL && *bufsize >= newsize)
+		return 0;
+
+	/* Don't bother with reallocating for small messages later. */
+	if (newsize < BBUS_MAXMSGSIZE)
+		newsize = BBUS_MAXMSGSIZE;
+
+	newbuf = bbus_realloc(*buf, newsize);
+	if (newbuf == NULL)
+		return -1;
+
+	*buf = newbuf;
+	*bufsize = newsize;
+
+	return 0;
+}
+
+static int recv_header(int sock, struct bbus_msg_hdr* hdr)
+{
+	unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+	struct iovec iov;
+	size_t hdrsize;
+	ssize_t rcvd;
+
+	iov.iov_base = wirehdr;
+	iov.iov_len = BBUS_MSGHDR_REALSIZE;
+	rcvd = __bbus_sock_recv(sock, &iov, 1);
+	if (rcvd < 0) {
+		return -1;
+	} else
+	if (rcvd < (ssize_t)BBUS_MSGHDR_REALSIZE) {
+		__bbus_seterr(BBUS_EMSGINVFMT);
+		return -1;
+	}
+
+	hdrsize = __bbus_prot_wirehdrsize(wirehdr);
+	if (hdrsize > BBUS_MSGHDR_REALSIZE) {
+		iov.iov_base = wirehdr + BBUS_MSGHDR_REALSIZE;
+		iov.iov_len = hdrsize - BBUS_MSGHDR_REALSIZE;
+		rcvd = __bbus_sock_recv(sock, &iov, 1);
+		if (rcvd < 0) {
+			return -1;
+		} else
+		if (rcvd < (ssize_t)iov.iov_len) {
+			__bbus_seterr(BBUS_ERCVDLESS);
+			return -1;
+		}
+	}
+
+	__bbus_prot_hdrdecode(hdr, wirehdr);
+	if (!hdr_check_magic(hdr)) {
+		__bbus_seterr(BBUS_EMSGMAGIC);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int recv_payload(int sock, void* payload, size_t psize)
+{
+	struct iovec iov;
+	ssize_t rcvd;
+
+	if (psize == 0)
+		return 0;
+
+	iov.iov_base = payload;
+	iov.iov_len = psize;
+	rcvd = __bbus_sock_recv(sock, &iov, 1);
+	if (rcvd < 0) {
+		return -1;
+	} else
+	if (rcvd < (ssize_t)psize) {
+		__bbus_seterr(BBUS_ERCVDLESS);
+		return -1;
+	}
+
+	return 0;
 }
 
 int __bbus_prot_recvmsg(int sock, struct bbus_msg* buf, size_t bufsize)
@@ -100,56 +316,320 @@ int __bbus_prot_recvmsg(int sock, struct bbus_msg* buf, size_t bufsize)
 int __bbus_prot_recvvmsg(int sock, struct bbus_msg_hdr* hdr,
 					void* payload, size_t psize)
 {
-	ssize_t rcv1;
-	ssize_t rcv2 = 0;
-	ssize_t rcvsum;
-	struct iovec iov[MAX_NUMIOV];
-	int numiov;
 	size_t exppsize;
 
-	numiov = 0;
-	header_to_iovec(hdr, iov, &numiov);
-	rcv1 = __bbus_sock_recv(sock, iov, numiov);
-	if (rcv1 < 0)
+	if (recv_header(sock, hdr) < 0)
 		return -1;
+
 	exppsize = bbus_hdr_getpsize(hdr);
-	if ((exppsize > psize) || (exppsize > BBUS_MAXPLOADSIZE)) {
+	if (check_psize(exppsize) < 0)
+		return -1;
+
+	if (exppsize > psize) {
 		__bbus_seterr(BBUS_EMSGINVFMT);
 		return -1;
 	}
 
-	numiov = 0;
-	if (payload && (exppsize > 0)) {
-		iov[numiov].iov_base = payload;
-		iov[numiov].iov_len = exppsize;
-		++numiov;
+	if (payload && recv_payload(sock, payload, exppsize) < 0)
+		return -1;
 
-		rcv2 = __bbus_sock_recv(sock, iov, numiov);
-		if (rcv2 < 0)
-			return -1;
-	}
+	__BBUS_STATS_ADD(rcvmsgs, 1);
+	return 0;
+}
 
-	rcvsum = rcv1 + rcv2;
-	if (rcvsum < (ssize_t)BBUS_MSGHDR_REALSIZE) {
-		__bbus_seterr(BBUS_EMSGINVFMT);
+/*
+ * Same as __bbus_prot_recvmsg(), but grows the buffer if needed.
+ */
+int __bbus_prot_recvmsg_grow(int sock, struct bbus_msg** buf,
+						size_t* bufsize)
+{
+	struct bbus_msg_hdr hdr;
+	size_t psize;
+
+	if (recv_header(sock, &hdr) < 0)
 		return -1;
-	} else
-	if (rcvsum < (ssize_t)(BBUS_MSGHDR_REALSIZE
-				+ bbus_hdr_getpsize(hdr))) {
-		__bbus_seterr(BBUS_ERCVDLESS);
+
+	psize = bbus_hdr_getpsize(&hdr);
+	if (check_psize(psize) < 0)
+		return -1;
+
+	if (__bbus_prot_growbuf(buf, bufsize, psize) < 0)
 		return -1;
-	}
 
+	memcpy(&(*buf)->hdr, &hdr, sizeof(struct bbus_msg_hdr));
+	if (recv_payload(sock, (*buf)->payload, psize) < 0)
+		return -1;
+
+	__BBUS_STATS_ADD(rcvmsgs, 1);
+	return 0;
+}
+
+void __bbus_prot_rcvctx_init(struct __bbus_prot_rcvctx* ctx)
+{
+	memset(ctx, 0, sizeof(struct __bbus_prot_rcvctx));
+}
+
+void __bbus_prot_rcvctx_free(struct __bbus_prot_rcvctx* ctx)
+{
+	bbus_free(ctx->data);
+	__bbus_prot_rcvctx_init(ctx);
+}
+
+/*
+ * Every read goes here first, only the data left over after parsing is
+ * copied to the client's context. This way idle clients don't hold
+ * large buffers.
+ */
+static BBUS_THREAD_LOCAL char rdbuf[__BBUS_PROT_RDBUFSIZE];
+
+/*
+ * Checks the header of the message at the beginning of src. Returns the
+ * size of the whole message, 0 if the header is incomplete or -1 if it's
+ * invalid.
+ */
+static ssize_t peek_msgsize(const char* src, size_t len,
+				struct bbus_msg_hdr* hdr)
+{
+	size_t hdrsize;
+	size_t psize;
+
+	if (len < BBUS_MSGHDR_REALSIZE)
+		return 0;
+
+	hdrsize = __bbus_prot_wirehdrsize((const unsigned char*)src);
+	if (len < hdrsize)
+		return 0;
+
+	__bbus_prot_hdrdecode(hdr, (const unsigned char*)src);
 	if (!hdr_check_magic(hdr)) {
 		__bbus_seterr(BBUS_EMSGMAGIC);
 		return -1;
 	}
 
+	psize = bbus_hdr_getpsize(hdr);
+	if (check_psize(psize) < 0)
+		return -1;
+
+	return hdrsize + psize;
+}
+
+/*
+ * Looks for a complete message at the beginning of src. Returns the size
+ * of the message, 0 if it's incomplete or -1 if the data is invalid. The
+ * message is stored in buf, which is grown if needed.
+ */
+static ssize_t parse_msg(const char* src, size_t len,
+				struct bbus_msg** buf, size_t* bufsize)
+{
+	struct bbus_msg_hdr hdr;
+	ssize_t msgsize;
+	size_t psize;
+
+	msgsize = peek_msgsize(src, len, &hdr);
+	if (msgsize <= 0 || len < (size_t)msgsize)
+		return msgsize < 0 ? -1 : 0;
+
+	psize = bbus_hdr_getpsize(&hdr);
+	if (__bbus_prot_growbuf(buf, bufsize, psize) < 0)
+		return -1;
+
+	memcpy(&(*buf)->hdr, &hdr, sizeof(struct bbus_msg_hdr));
+	memcpy((*buf)->payload, src + msgsize - psize, psize);
+
+	return msgsize;
+}
+
+static void release_data(struct __bbus_prot_rcvctx* ctx)
+{
+	bbus_free(ctx->data);
+	ctx->data = NULL;
+	ctx->size = 0;
+	ctx->off = 0;
+	ctx->len = 0;
+}
+
+static int reserve_data(struct __bbus_prot_rcvctx* ctx, size_t size)
+{
+	char* data;
+
+	if (size <= ctx->size)
+		return 0;
+
+	data = bbus_realloc(ctx->data, size);
+	if (data == NULL)
+		return -1;
+
+	ctx->data = data;
+	ctx->size = size;
+
 	return 0;
 }
 
+static int stash_data(struct __bbus_prot_rcvctx* ctx,
+				const char* src, size_t len)
+{
+	if (len == 0) {
+		release_data(ctx);
+		return 0;
+	}
+
+	if (reserve_data(ctx, len) < 0)
+		return -1;
+
+	memcpy(ctx->data, src, len);
+	ctx->off = 0;
+	ctx->len = len;
+
+	return 0;
+}
+
+static int take_msg(struct __bbus_prot_rcvctx* ctx,
+			struct bbus_msg** buf, size_t* bufsize)
+{
+	ssize_t msgsize;
+
+	msgsize = parse_msg(ctx->data + ctx->off, ctx->len, buf, bufsize);
+	if (msgsize <= 0)
+		return msgsize;
+
+	ctx->off += msgsize;
+	ctx->len -= msgsize;
+	if (ctx->len == 0)
+		release_data(ctx);
+	__BBUS_STATS_ADD(rcvmsgs, 1);
+
+	return 1;
+}
+
+/*
+ * Messages not fitting in the read buffer are received directly into the
+ * context, which is grown to hold the whole message.
+ */
+static int rcv_large(int sock, struct __bbus_prot_rcvctx* ctx,
+			struct bbus_msg** buf, size_t* bufsize, size_t msgsize)
+{
+	struct iovec iov;
+	ssize_t rcvd;
+
+	if (ctx->off > 0) {
+		memmove(ctx->data, ctx->data + ctx->off, ctx->len);
+		ctx->off = 0;
+	}
+
+	if (reserve_data(ctx, msgsize) < 0)
+		return -1;
+
+	/* Don't read past the end of the message. */
+	iov.iov_base = ctx->data + ctx->len;
+	iov.iov_len = msgsize - ctx->len;
+	rcvd = __bbus_sock_tryrecv(sock, &iov, 1);
+	if (rcvd <= 0)
+		return rcvd;
+
+	ctx->len += rcvd;
+	ctx->drained = (size_t)rcvd < iov.iov_len;
+	return take_msg(ctx, buf, bufsize);
+}
+
+/*
+ * Returns a single message at a time, but reads as much data as is available
+ * (up to __BBUS_PROT_RDBUFSIZE) in a single system call, so that messages
+ * arriving in bursts can be handled without going back to the socket.
+ * Returns 1 if a whole message has been stored in buf, 0 if more data is
+ * needed and -1 on error. The buffer is grown if needed. Unconsumed data is
+ * kept in ctx, which must be used exclusively with a single socket.
+ *
+ * Returning 0 doesn't necessarily mean there's no data in the socket - the
+ * read is skipped if the previous one drained it, so the caller must poll
+ * for readability before trying again. It does mean, however, that the
+ * socket has been found empty since the last time it was polled.
+ */
+int __bbus_prot_tryrecvmsg(int sock, struct __bbus_prot_rcvctx* ctx,
+				struct bbus_msg** buf, size_t* bufsize)
+{
+	struct bbus_msg_hdr hdr;
+	struct iovec iov;
+	ssize_t rcvd;
+	ssize_t msgsize;
+	size_t have;
+	int r;
+
+	msgsize = 0;
+	if (ctx->len > 0) {
+		r = take_msg(ctx, buf, bufsize);
+		if (r != 0)
+			return r;
+
+		msgsize = peek_msgsize(ctx->data + ctx->off, ctx->len, &hdr);
+	}
+
+	if (ctx->drained) {
+		/* Don't waste a system call on an empty socket. */
+		ctx->drained = 0;
+		return 0;
+	}
+
+	if ((size_t)msgsize > sizeof(rdbuf))
+		return rcv_large(sock, ctx, buf, bufsize, msgsize);
+
+	/*
+	 * Only an incomplete message can be left at this point and it fits
+	 * in the read buffer.
+	 */
+	have = ctx->len;
+	if (have > 0)
+		memcpy(rdbuf, ctx->data + ctx->off, have);
+	iov.iov_base = rdbuf + have;
+	iov.iov_len = sizeof(rdbuf) - have;
+	rcvd = __bbus_sock_tryrecv(sock, &iov, 1);
+	if (rcvd <= 0)
+		return rcvd;
+
+	have += rcvd;
+	msgsize = parse_msg(rdbuf, have, buf, bufsize);
+	if (msgsize < 0)
+		return -1;
+
+	if (stash_data(ctx, rdbuf + msgsize, have - msgsize) < 0)
+		return -1;
+
+	if (msgsize == 0) {
+		/*
+		 * Filled the buffer without completing a message - it must be
+		 * a big one. Read the rest now: callers polling edge-triggered
+		 * won't be woken up for data, that's already in the socket.
+		 */
+		if ((size_t)rcvd == iov.iov_len)
+			return __bbus_prot_tryrecvmsg(sock, ctx, buf, bufsize);
+
+		return 0;
+	}
+
+	ctx->drained = (size_t)rcvd < iov.iov_len;
+	__BBUS_STATS_ADD(rcvmsgs, 1);
+	return 1;
+}
+
+/*
+ * Returns BBUS_TRUE if the next call to __bbus_prot_tryrecvmsg() can return
+ * without reading from the socket. Invalid data counts as pending too, so
+ * that the error gets reported.
+ */
+int __bbus_prot_rcvpending(const struct __bbus_prot_rcvctx* ctx)
+{
+	struct bbus_msg_hdr hdr;
+	ssize_t msgsize;
+
+	if (ctx->len == 0)
+		return BBUS_FALSE;
+
+	msgsize = peek_msgsize(ctx->data + ctx->off, ctx->len, &hdr);
+	return msgsize < 0 || (msgsize > 0 && ctx->len >= (size_t)msgsize)
+						? BBUS_TRUE : BBUS_FALSE;
+}
+
 static int do_send(int sock, const struct iovec* iov,
-				int numiov, size_t msgsize)
+			int numiov, size_t msgsize, unsigned nummsgs)
 {
 	ssize_t r;
 
@@ -163,72 +643,105 @@ static int do_send(int sock, const struct iovec* iov,
 		return -1;
 	}
 
+	__BBUS_STATS_ADD(sndmsgs, nummsgs);
 	return 0;
 }
 
 int __bbus_prot_sendmsg(int sock, const struct bbus_msg* msg)
 {
+	unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
 	ssize_t r;
-	size_t msgsize;
-	struct iovec iov[MAX_NUMIOV];
-	int numiov;
+	size_t psize;
+	struct iovec iov[__BBUS_PROT_MAXNUMIOV];
 
-	msgsize = BBUS_MSGHDR_REALSIZE + bbus_hdr_getpsize(&msg->hdr);
-	if (msgsize > BBUS_MAXMSGSIZE) {
-		__bbus_seterr(BBUS_EINVALARG);
+	psize = bbus_hdr_getpsize(&msg->hdr);
+	if (check_psize(psize) < 0)
 		return -1;
-	}
 
-	numiov = 0;
-	header_to_iovec(&msg->hdr, iov, &numiov);
-	iov[numiov].iov_base = (void*)msg->payload;
-	iov[numiov].iov_len = bbus_hdr_getpsize(&msg->hdr);
-	++numiov;
-	r = do_send(sock, iov, numiov, msgsize);
+	iov[0].iov_base = wirehdr;
+	iov[0].iov_len = __bbus_prot_hdrencode(&msg->hdr, wirehdr);
+	iov[1].iov_base = (void*)msg->payload;
+	iov[1].iov_len = psize;
+	r = do_send(sock, iov, 2, iov[0].iov_len + psize, 1);
 	if (r < 0)
 		return -1;
 
 	return 0;
 }
 
-int __bbus_prot_sendvmsg(int sock, const struct bbus_msg_hdr* hdr,
-			const char* meta, const char* obj, size_t objsize)
+/*
+ * Fills the iovec array with the header and payload of a message and returns
+ * the size of the whole message. The array must be able to hold at least
+ * __BBUS_PROT_MAXNUMIOV elements. The header is encoded into wirehdr, which
+ * must be __BBUS_PROT_MAXWIREHDR bytes long and stay valid as long as the
+ * iovec array is used.
+ */
+ssize_t __bbus_prot_mkiov(const struct bbus_msg_hdr* hdr,
+		unsigned char* wirehdr, const char* meta, const char* obj,
+		size_t objsize, struct iovec* iov, int* numiov)
 {
-	ssize_t r;
-	size_t msgsize;
-	struct iovec iov[MAX_NUMIOV];
-	int numiov;
+	size_t psize;
 	size_t metasize;
 
 	metasize = meta == NULL ? 0 : strlen(meta)+1;
-	msgsize = BBUS_MSGHDR_REALSIZE + metasize + objsize;
-	if ((msgsize != (BBUS_MSGHDR_REALSIZE + bbus_hdr_getpsize(hdr)))
-				|| (msgsize > BBUS_MAXMSGSIZE)) {
+	psize = metasize + objsize;
+	if (psize != bbus_hdr_getpsize(hdr)) {
 		__bbus_seterr(BBUS_EINVALARG);
 		return -1;
 	}
 
-	numiov = 0;
-	header_to_iovec(hdr, iov, &numiov);
+	if (check_psize(psize) < 0)
+		return -1;
+
+	iov[0].iov_base = wirehdr;
+	iov[0].iov_len = __bbus_prot_hdrencode(hdr, wirehdr);
+	*numiov = 1;
 	if (meta != NULL) {
-		iov[numiov].iov_base = (void*)meta;
-		iov[numiov].iov_len = metasize;
-		++numiov;
+		iov[*numiov].iov_base = (void*)meta;
+		iov[*numiov].iov_len = metasize;
+		++*numiov;
 	}
 	if (obj != NULL) {
-		iov[numiov].iov_base = (void*)obj;
-		iov[numiov].iov_len = objsize;
-		++numiov;
+		iov[*numiov].iov_base = (void*)obj;
+		iov[*numiov].iov_len = objsize;
+		++*numiov;
 	}
 
-	r = do_send(sock, iov, numiov, msgsize);
-	if (r < 0)
+	return (ssize_t)(iov[0].iov_len + psize);
+}
+
+int __bbus_prot_sendvmsg(int sock, const struct bbus_msg_hdr* hdr,
+			const char* meta, const char* obj, size_t objsize)
+{
+	unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+	ssize_t r;
+	ssize_t msgsize;
+	struct iovec iov[__BBUS_PROT_MAXNUMIOV];
+	int numiov;
+
+	msgsize = __bbus_prot_mkiov(hdr, wirehdr, meta, obj,
+					objsize, iov, &numiov);
+	if (msgsize < 0)
 		return -1;
 
+	r = do_send(sock, iov, numiov, (size_t)msgsize, 1);
+	if (r < 0)
+		return -1;
 
 	return 0;
 }
 
+/*
+ * Sends nummsgs messages, laid out in the iovec array by subsequent calls to
+ * __bbus_prot_mkiov(), with a single system call. Size is the sum of the
+ * sizes of all the messages.
+ */
+int __bbus_prot_sendbatch(int sock, const struct iovec* iov,
+			int numiov, size_t size, unsigned nummsgs)
+{
+	return do_send(sock, iov, numiov, size, nummsgs);
+}
+
 void __bbus_prot_hdrsetmagic(struct bbus_msg_hdr* hdr)
 {
 	memcpy(&hdr->magic, BBUS_MAGIC, BBUS_MAGIC_SIZE);
@@ -252,6 +765,12 @@ int __bbus_prot_errtoerrnum(uint8_t errcode)
 	case BBUS_PROT_EMREGERR:
 		errnum = BBUS_EMREGERR;
 		break;
+	case BBUS_PROT_ESTALEHANDLE:
+		errnum = BBUS_ESTALEHANDLE;
+		break;
+	case BBUS_PROT_ETIMEDOUT:
+		errnum = BBUS_ETIMEDOUT;
+		break;
 	default:
 		errnum = BBUS_EINVALARG;
 		break;
@@ -280,7 +799,7 @@ err:
 	return NULL;
 }
 
-bbus_object* bbus_prot_extractobj(const struct bbus_msg* msg)
+const void* bbus_prot_rawobj(const struct bbus_msg* msg, size_t* size)
 {
 	const char* meta;
 	const void* payload;
@@ -303,7 +822,20 @@ bbus_object* bbus_prot_extractobj(const struct bbus_msg* msg)
 		return NULL;
 	}
 
-	return bbus_obj_frombuf(payload, psize);
+	*size = psize;
+	return payload;
+}
+
+bbus_object* bbus_prot_extractobj(const struct bbus_msg* msg)
+{
+	const void* payload;
+	size_t size;
+
+	payload = bbus_prot_rawobj(msg, &size);
+	if (payload == NULL)
+		return NULL;
+
+	return bbus_obj_frombuf(payload, size);
 }
 
 void bbus_hdr_build(struct bbus_msg_hdr* hdr, int typ, int err)
@@ -324,13 +856,35 @@ void bbus_hdr_settoken(struct bbus_msg_hdr* hdr, unsigned tok)
 	hdr->token = (uint32_t)htonl(tok);
 }
 
+uint32_t bbus_hdr_getcallid(const struct bbus_msg_hdr* hdr)
+{
+	return ntohl(hdr->callid);
+}
+
+void bbus_hdr_setcallid(struct bbus_msg_hdr* hdr, uint32_t callid)
+{
+	hdr->callid = htonl(callid);
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASCALLID);
+}
+
+uint32_t bbus_hdr_gettimeout(const struct bbus_msg_hdr* hdr)
+{
+	return ntohl(hdr->timeout);
+}
+
+void bbus_hdr_settimeout(struct bbus_msg_hdr* hdr, uint32_t msec)
+{
+	hdr->timeout = htonl(msec);
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASTIMEOUT);
+}
+
 size_t bbus_hdr_getpsize(const struct bbus_msg_hdr* hdr)
 {
-	return (size_t)ntohs(hdr->psize);
+	return (size_t)ntohl(hdr->psize);
 }
 
 void bbus_hdr_setpsize(struct bbus_msg_hdr* hdr, size_t size)
 {
-	hdr->psize = size > UINT16_MAX ? UINT16_MAX : htons((uint16_t)size);
+	hdr->psize = size > UINT32_MAX ? UINT32_MAX : htonl((uint32_t)size);
 }
 
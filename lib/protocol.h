@@ -16,13 +16,81 @@
 #define __BBUS_PROTO__
 
 #include <busybus.h>
+#include <sys/uio.h>
 
+/*
+ * Offsets of the header fields on the wire. There's no padding, multi-byte
+ * fields are stored in the same byte order as in struct bbus_msg_hdr.
+ */
+#define __BBUS_PROT_WIREOFF_MAGIC	0
+#define __BBUS_PROT_WIREOFF_MSGTYPE	2
+#define __BBUS_PROT_WIREOFF_SOTYPE	3
+#define __BBUS_PROT_WIREOFF_ERRCODE	4
+#define __BBUS_PROT_WIREOFF_TOKEN	5
+#define __BBUS_PROT_WIREOFF_PSIZE	9
+#define __BBUS_PROT_WIREOFF_FLAGS	11
+/* Only present if BBUS_PROT_EXTLEN is set. */
+#define __BBUS_PROT_WIREOFF_EXTPSIZE	12
+/*
+ * Only present if BBUS_PROT_HASCALLID is set, follows the extended payload
+ * size if there's one.
+ */
+#define __BBUS_PROT_WIREOFF_CALLID(FLAGS)				\
+	(BBUS_MSGHDR_REALSIZE						\
+		+ ((FLAGS) & BBUS_PROT_EXTLEN ? sizeof(uint32_t) : 0))
+/* Only present if BBUS_PROT_HASTIMEOUT is set, follows the call id. */
+#define __BBUS_PROT_WIREOFF_TIMEOUT(FLAGS)				\
+	(__BBUS_PROT_WIREOFF_CALLID(FLAGS)				\
+		+ ((FLAGS) & BBUS_PROT_HASCALLID ? sizeof(uint32_t) : 0))
+
+/* Size of the biggest on-wire header. */
+#define __BBUS_PROT_MAXWIREHDR						\
+	(BBUS_MSGHDR_REALSIZE + 3*sizeof(uint32_t))
+
+/* Header + meta + object. */
+#define __BBUS_PROT_MAXNUMIOV 3
+
+/* Number of bytes read from a non-blocking socket at once. */
+#define __BBUS_PROT_RDBUFSIZE (64 * 1024)
+
+/*
+ * Data received from a non-blocking socket, that hasn't been consumed yet:
+ * messages read ahead and/or the beginning of an incomplete message.
+ */
+struct __bbus_prot_rcvctx
+{
+	char* data;
+	size_t size;
+	size_t off;
+	size_t len;
+	/* The last read didn't fill the buffer - the socket is empty. */
+	int drained;
+};
+
+void __bbus_prot_rcvctx_init(struct __bbus_prot_rcvctx* ctx);
+void __bbus_prot_rcvctx_free(struct __bbus_prot_rcvctx* ctx);
+int __bbus_prot_tryrecvmsg(int sock, struct __bbus_prot_rcvctx* ctx,
+		struct bbus_msg** buf, size_t* bufsize);
+int __bbus_prot_rcvpending(const struct __bbus_prot_rcvctx* ctx);
 int __bbus_prot_recvmsg(int sock, struct bbus_msg* buf, size_t bufsize);
+int __bbus_prot_recvmsg_grow(int sock, struct bbus_msg** buf,
+		size_t* bufsize);
+int __bbus_prot_growbuf(struct bbus_msg** buf, size_t* bufsize, size_t psize);
 int __bbus_prot_recvvmsg(int sock, struct bbus_msg_hdr* hdr,
 		void* payload, size_t psize);
 int __bbus_prot_sendmsg(int sock, const struct bbus_msg* buf);
 int __bbus_prot_sendvmsg(int sock, const struct bbus_msg_hdr* hdr,
 		const char* meta, const char* obj, size_t objsize);
+int __bbus_prot_sendbatch(int sock, const struct iovec* iov,
+		int numiov, size_t size, unsigned nummsgs);
+ssize_t __bbus_prot_mkiov(const struct bbus_msg_hdr* hdr,
+		unsigned char* wirehdr, const char* meta, const char* obj,
+		size_t objsize, struct iovec* iov, int* numiov);
+size_t __bbus_prot_hdrencode(const struct bbus_msg_hdr* hdr,
+		unsigned char* wirehdr);
+size_t __bbus_prot_wirehdrsize(const unsigned char* wirehdr);
+void __bbus_prot_hdrdecode(struct bbus_msg_hdr* hdr,
+		const unsigned char* wirehdr);
 void __bbus_prot_hdrsetmagic(struct bbus_msg_hdr* hdr);
 int __bbus_prot_errtoerrnum(uint8_t errcode);
 
@@ -17,11 +17,81 @@
 #include "socket.h"
 #include "protocol.h"
 #include "cred.h"
+#include "stats.h"
+#include "pool.h"
 #include <string.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 
 #define DEF_LISTEN_QUEUE 5
+#define POLL_MAXEVENTS 64
+#define CORK_MAXCLIENTS 64
+
+/* Limits of data sent to a single client with one system call... */
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define FLUSH_MAXIOV IOV_MAX
+#else
+#define FLUSH_MAXIOV 256
+#endif
+/* ...and during a single flush. */
+#define FLUSH_MAXBYTES (256 * 1024)
+/*
+ * Queue size above which messages are rejected even if received messages
+ * would let them over the limit.
+ */
+#define QUEUE_HARDLIMIT(cli) ((cli)->maxqueued * 2)
+/* Size of the chunks outbound queues are made of, header included. */
+#define OUTBUF_SIZE 4096
+
+/*
+ * Embedded in every object, that can be stored in a pollset. Its address is
+ * what epoll hands back to us for a ready socket.
+ */
+struct pollent
+{
+	/* Number of the last poll in which the object was ready. */
+	unsigned rev;
+	/* Owner of this entry, NULL for servers. */
+	bbus_client* cli;
+};
+
+/*
+ * Chunk of data waiting to be sent to a client. Messages are packed back to
+ * back, a big one spans several chunks.
+ */
+struct outbuf
+{
+	struct outbuf* next;
+	struct outbuf* prev;
+	/* Number of bytes stored. */
+	size_t size;
+	/* Number of bytes already sent. */
+	size_t offset;
+	char data[0];
+};
+
+#define OUTBUF_DATASIZE (OUTBUF_SIZE - sizeof(struct outbuf))
+
+/* Free chunks kept for reuse at most, the rest goes back to the heap. */
+#define OUTBUF_MAXCACHED 64
+
+/*
+ * Chunks of all outbound queues come from a single pool, so that queueing
+ * a message doesn't touch the heap once the pool has grown big enough.
+ * The pool doesn't keep more than OUTBUF_MAXCACHED free chunks though, so
+ * that queues filling up for a while don't pin the memory for good.
+ */
+static bbus_pool outbuf_pool =
+	__BBUS_POOL_CAPPED_INITIALIZER(OUTBUF_SIZE, OUTBUF_MAXCACHED);
+
+struct outqueue
+{
+	struct outbuf* head;
+	struct outbuf* tail;
+};
 
 struct __bbus_client
 {
@@ -30,19 +100,62 @@ struct __bbus_client
 	uint32_t token;
 	struct bbus_client_cred cred;
 	char* name;
+	void* priv;
+	struct pollent pent;
+	/* Only accessed by the thread receiving messages from this client. */
+	struct __bbus_prot_rcvctx rcvctx;
+	/* Number of messages received, only written by the receiving thread. */
+	unsigned long rcvd;
+	/*
+	 * Protects the fields below. Held across send system calls and
+	 * copies of whole messages - workers waiting for it must sleep.
+	 */
+	pthread_mutex_t lock;
+	struct outqueue outq;
+	size_t queued;
+	size_t maxqueued;
+	/*
+	 * The socket refused data and hasn't been emptied since. Messages
+	 * queued only because the sending thread is corked don't count
+	 * against maxqueued.
+	 */
+	int blocked;
+	/* Received messages, that let a message over the limit. */
+	unsigned long excused;
+	/* Pollset this client is stored in or NULL. */
+	bbus_pollset* pset;
+	/* EPOLLOUT is armed for this client. */
+	int pollout;
 };
 
 struct __bbus_server
 {
 	int sock;
+	struct pollent pent;
 };
 
 struct __bbus_pollset
 {
-	fd_set fdset;
-	int highsock;
+	int epfd;
+	unsigned rev;
+	struct epoll_event events[POLL_MAXEVENTS];
+	int numevents;
+	int curevent;
 };
 
+/* Prototype for client functions arming EPOLLOUT. */
+static int pollset_ctl(bbus_pollset* pset, int op, int sock,
+			struct pollent* pent, uint32_t events);
+
+/*
+ * Clients, that the calling thread queued messages for while corked. Only
+ * clients with queues, that were empty before, are stored here - anything
+ * queued after them is sent along.
+ */
+static BBUS_THREAD_LOCAL int corked;
+static BBUS_THREAD_LOCAL bbus_client* dirty[CORK_MAXCLIENTS];
+static BBUS_THREAD_LOCAL unsigned numdirty;
+
 uint32_t bbus_client_gettoken(bbus_client* cli)
 {
 	return cli->token;
@@ -63,18 +176,327 @@ const char* bbus_client_getname(bbus_client* cli)
 	return cli->name;
 }
 
+void bbus_client_setpriv(bbus_client* cli, void* priv)
+{
+	cli->priv = priv;
+}
+
+void* bbus_client_getpriv(bbus_client* cli)
+{
+	return cli->priv;
+}
+
 int bbus_client_rcvmsg(bbus_client* cli,
 				struct bbus_msg* buf, size_t bufsize)
 {
 	return __bbus_prot_recvmsg(cli->sock, buf, bufsize);
 }
 
+int bbus_client_tryrcvmsg(bbus_client* cli,
+				struct bbus_msg** buf, size_t* bufsize)
+{
+	int ret;
+
+	ret = __bbus_prot_tryrecvmsg(cli->sock, &cli->rcvctx, buf, bufsize);
+	if (ret > 0)
+		++cli->rcvd;
+
+	return ret;
+}
+
+int bbus_client_rcvpending(bbus_client* cli)
+{
+	return __bbus_prot_rcvpending(&cli->rcvctx);
+}
+
+/*
+ * Must be called with the client lock held.
+ */
+static void set_pollout(bbus_client* cli, int enable)
+{
+	int r;
+
+	if (cli->pset == NULL || cli->pollout == enable)
+		return;
+
+	r = pollset_ctl(cli->pset, EPOLL_CTL_MOD, cli->sock, &cli->pent,
+				enable ? EPOLLIN | EPOLLOUT : EPOLLIN);
+	if (r == 0)
+		cli->pollout = enable;
+}
+
+/*
+ * Copies the unsent part of a message to the outbound queue, filling up the
+ * last chunk first. Must be called with the client lock held.
+ */
+static int queue_msg(bbus_client* cli, const struct iovec* iov,
+				int numiov, size_t skip, size_t size)
+{
+	struct outbuf* tail = cli->outq.tail;
+	size_t tailsize = tail == NULL ? 0 : tail->size;
+	struct outbuf* buf = tail;
+	const char* src;
+	size_t left;
+	size_t len;
+	int i;
+
+	for (i = 0; i < numiov; ++i) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+
+		src = (const char*)iov[i].iov_base + skip;
+		left = iov[i].iov_len - skip;
+		skip = 0;
+		while (left > 0) {
+			if (buf == NULL || buf->size == OUTBUF_DATASIZE) {
+				buf = bbus_pool_alloc(&outbuf_pool);
+				if (buf == NULL)
+					goto err;
+
+				buf->size = 0;
+				buf->offset = 0;
+				bbus_list_push(&cli->outq, buf);
+			}
+
+			len = OUTBUF_DATASIZE - buf->size;
+			if (len > left)
+				len = left;
+			memcpy(buf->data + buf->size, src, len);
+			buf->size += len;
+			src += len;
+			left -= len;
+		}
+	}
+
+	cli->queued += size;
+
+	return 0;
+
+err:
+	/* Don't leave a part of the message behind. */
+	while (cli->outq.tail != tail) {
+		buf = cli->outq.tail;
+		bbus_list_rm(&cli->outq, buf);
+		bbus_pool_free(&outbuf_pool, buf);
+	}
+	if (tail != NULL)
+		tail->size = tailsize;
+
+	return -1;
+}
+
+/*
+ * Sends as much of the outbound queue as possible without blocking, but no
+ * more than FLUSH_MAXBYTES. EPOLLOUT is armed if anything is left. Must be
+ * called with the client lock held.
+ */
+static int flush_queue(bbus_client* cli)
+{
+	struct iovec iov[FLUSH_MAXIOV];
+	struct outbuf* buf;
+	size_t budget = FLUSH_MAXBYTES;
+	ssize_t sent;
+	size_t total;
+	size_t left;
+	size_t len;
+	int numiov;
+
+	cli->blocked = 0;
+	while (cli->outq.head != NULL && budget > 0) {
+		total = 0;
+		numiov = 0;
+		for (buf = cli->outq.head; buf != NULL && numiov < FLUSH_MAXIOV
+					&& total < budget; buf = buf->next) {
+			iov[numiov].iov_base = buf->data + buf->offset;
+			iov[numiov].iov_len = buf->size - buf->offset;
+			total += iov[numiov].iov_len;
+			++numiov;
+		}
+
+		sent = __bbus_sock_trysend(cli->sock, iov, numiov);
+		if (sent < 0)
+			return -1;
+
+		cli->queued -= sent;
+		budget -= (size_t)sent < budget ? (size_t)sent : budget;
+		for (left = sent; left > 0;) {
+			buf = cli->outq.head;
+			len = buf->size - buf->offset;
+			if (left < len) {
+				buf->offset += left;
+				break;
+			}
+
+			left -= len;
+			bbus_list_rm(&cli->outq, buf);
+			bbus_pool_free(&outbuf_pool, buf);
+		}
+
+		/* Socket buffer full. */
+		if ((size_t)sent < total) {
+			cli->blocked = 1;
+			break;
+		}
+	}
+
+	set_pollout(cli, cli->outq.head != NULL);
+
+	return 0;
+}
+
+static void flush_dirty(void)
+{
+	bbus_client* cli;
+	unsigned i;
+
+	for (i = 0; i < numdirty; ++i) {
+		cli = dirty[i];
+		pthread_mutex_lock(&cli->lock);
+		/*
+		 * Errors are ignored - a broken connection will be reported
+		 * as readable and the next receive will fail.
+		 */
+		(void)flush_queue(cli);
+		pthread_mutex_unlock(&cli->lock);
+	}
+
+	numdirty = 0;
+}
+
+static void mark_dirty(bbus_client* cli)
+{
+	if (numdirty == CORK_MAXCLIENTS)
+		flush_dirty();
+
+	dirty[numdirty++] = cli;
+}
+
+void bbus_client_cork(void)
+{
+	++corked;
+}
+
+void bbus_client_uncork(void)
+{
+	if (corked == 0 || --corked > 0)
+		return;
+
+	flush_dirty();
+}
+
 int bbus_client_sendmsg(bbus_client* cli, struct bbus_msg_hdr* hdr,
 		const char* meta, bbus_object* obj)
 {
-	return __bbus_prot_sendvmsg(cli->sock, hdr, meta,
-				obj == NULL ? NULL : bbus_obj_rawdata(obj),
-				obj == NULL ? 0 : bbus_obj_rawsize(obj));
+	return bbus_client_sendraw(cli, hdr, meta,
+			obj == NULL ? NULL : bbus_obj_rawdata(obj),
+			obj == NULL ? 0 : bbus_obj_rawsize(obj));
+}
+
+int bbus_client_sendraw(bbus_client* cli, struct bbus_msg_hdr* hdr,
+		const char* meta, const void* obj, size_t objsize)
+{
+	unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+	struct iovec iov[__BBUS_PROT_MAXNUMIOV];
+	ssize_t msgsize;
+	ssize_t sent = 0;
+	int wasempty;
+	int numiov;
+	int ret = 0;
+
+	msgsize = __bbus_prot_mkiov(hdr, wirehdr, meta, (const char*)obj,
+						objsize, iov, &numiov);
+	if (msgsize < 0)
+		return -1;
+
+	pthread_mutex_lock(&cli->lock);
+	/* Give a peer, that refused data before, a chance to catch up. */
+	if (cli->blocked && flush_queue(cli) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	wasempty = cli->outq.head == NULL;
+	/* Don't reorder messages - only send directly if nothing's queued. */
+	if (wasempty && !corked) {
+		sent = __bbus_sock_trysend(cli->sock, iov, numiov);
+		if (sent < 0) {
+			ret = -1;
+			goto out;
+		} else
+		if (sent == msgsize) {
+			goto out;
+		}
+
+		cli->blocked = 1;
+	}
+
+	/*
+	 * Only data the socket has just refused counts against the limit,
+	 * an empty queue takes any message, however big.
+	 */
+	if (sent == 0 && cli->blocked && cli->queued > cli->maxqueued) {
+		/*
+		 * Each message received from the client lets one more over
+		 * the limit. A peer, that keeps sending isn't stuck - it may
+		 * be blocked writing and unable to read its replies. Nothing
+		 * gets past the hard limit though, so a peer that only sends
+		 * can't make the queue grow without bounds.
+		 */
+		if (cli->excused == BBUS_ATOMIC_GET(cli->rcvd)
+				|| cli->queued > QUEUE_HARDLIMIT(cli)) {
+			__bbus_seterr(BBUS_EQUEUEFULL);
+			ret = -1;
+			goto out;
+		}
+
+		++cli->excused;
+	}
+
+	ret = queue_msg(cli, iov, numiov, sent, msgsize - sent);
+	if (ret < 0)
+		goto out;
+
+	if (wasempty && !corked) {
+		set_pollout(cli, 1);
+	} else
+	if (corked && !cli->blocked && cli->queued >= FLUSH_MAXBYTES) {
+		/* Don't let corking hold back more than a flush's worth. */
+		ret = flush_queue(cli);
+	}
+
+out:
+	pthread_mutex_unlock(&cli->lock);
+	if (ret == 0) {
+		if (wasempty && corked)
+			mark_dirty(cli);
+		__BBUS_STATS_ADD(sndmsgs, 1);
+	}
+	return ret;
+}
+
+void bbus_client_setmaxqueued(bbus_client* cli, size_t max)
+{
+	pthread_mutex_lock(&cli->lock);
+	cli->maxqueued = max;
+	pthread_mutex_unlock(&cli->lock);
+}
+
+size_t bbus_client_queued(bbus_client* cli)
+{
+	size_t queued;
+
+	pthread_mutex_lock(&cli->lock);
+	queued = cli->queued;
+	pthread_mutex_unlock(&cli->lock);
+
+	return queued;
+}
+
+int bbus_client_shutdown(bbus_client* cli)
+{
+	return __bbus_sock_shutdown(cli->sock);
 }
 
 int bbus_client_close(bbus_client* cli)
@@ -84,6 +506,14 @@ int bbus_client_close(bbus_client* cli)
 
 void bbus_client_free(bbus_client* cli)
 {
+	struct outbuf* buf;
+
+	while ((buf = cli->outq.head) != NULL) {
+		bbus_list_rm(&cli->outq, buf);
+		bbus_pool_free(&outbuf_pool, buf);
+	}
+	__bbus_prot_rcvctx_free(&cli->rcvctx);
+	pthread_mutex_destroy(&cli->lock);
 	bbus_str_free(cli->name);
 	bbus_free(cli);
 }
@@ -107,6 +537,8 @@ bbus_server* bbus_srv_create(void)
 		goto err;
 
 	srv->sock = sock;
+	srv->pent.rev = 0;
+	srv->pent.cli = NULL;
 	return srv;
 
 err:
@@ -199,6 +631,20 @@ bbus_client* bbus_srv_accept(bbus_server* srv,
 	cli->sock = sock;
 	cli->token = 0;
 	cli->type = clitype;
+	cli->priv = NULL;
+	cli->pent.rev = 0;
+	cli->pent.cli = cli;
+	__bbus_prot_rcvctx_init(&cli->rcvctx);
+	pthread_mutex_init(&cli->lock, NULL);
+	cli->outq.head = NULL;
+	cli->outq.tail = NULL;
+	cli->queued = 0;
+	cli->maxqueued = BBUS_CLIENT_DEFMAXQUEUED;
+	cli->blocked = 0;
+	cli->rcvd = 0;
+	cli->excused = 0;
+	cli->pset = NULL;
+	cli->pollout = 0;
 	__bbus_cred_copy(&cli->cred, &cred);
 	cli->name = bbus_str_build("%s", strlen(clinamebuf) == 0
 					? "<unknown>" : clinamebuf);
@@ -229,68 +675,180 @@ bbus_pollset* bbus_pollset_make(void)
 	pset = bbus_malloc0(sizeof(struct __bbus_pollset));
 	if (pset == NULL)
 		return NULL;
-	bbus_pollset_clear(pset);
+
+	pset->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (pset->epfd < 0) {
+		__bbus_seterr(errno);
+		bbus_free(pset);
+		return NULL;
+	}
+	pset->rev = 0;
+	pset->numevents = 0;
+	pset->curevent = 0;
 
 	return pset;
 }
 
 void bbus_pollset_clear(bbus_pollset* pset)
 {
-	FD_ZERO(&pset->fdset);
-	pset->highsock = 0;
+	/*
+	 * There's no way to enumerate the descriptors registered with an
+	 * epoll instance, so just replace it with a new one.
+	 */
+	close(pset->epfd);
+	pset->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (pset->epfd < 0)
+		__bbus_seterr(errno);
+	pset->numevents = 0;
+	pset->curevent = 0;
 }
 
-static inline void update_highsock(bbus_pollset* pset, int sock)
+static int pollset_ctl(bbus_pollset* pset, int op, int sock,
+			struct pollent* pent, uint32_t events)
 {
-	if (pset->highsock < (sock+1))
-		pset->highsock = sock+1;
+	struct epoll_event ev;
+	int r;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.ptr = pent;
+	r = epoll_ctl(pset->epfd, op, sock, &ev);
+	if (r < 0) {
+		__bbus_seterr(errno);
+		return -1;
+	}
+
+	return 0;
 }
 
-void bbus_pollset_addsrv(bbus_pollset* pset, bbus_server* src)
+int bbus_pollset_addsrv(bbus_pollset* pset, bbus_server* srv)
 {
-	FD_SET(src->sock, &pset->fdset);
-	update_highsock(pset, src->sock);
+	return pollset_ctl(pset, EPOLL_CTL_ADD, srv->sock,
+					&srv->pent, EPOLLIN);
 }
 
-void bbus_pollset_addcli(bbus_pollset* pset, bbus_client* cli)
+int bbus_pollset_addcli(bbus_pollset* pset, bbus_client* cli)
 {
-	FD_SET(cli->sock, &pset->fdset);
-	update_highsock(pset, cli->sock);
+	int r;
+
+	pthread_mutex_lock(&cli->lock);
+	r = pollset_ctl(pset, EPOLL_CTL_ADD, cli->sock, &cli->pent,
+			cli->outq.head == NULL ? EPOLLIN : EPOLLIN | EPOLLOUT);
+	if (r == 0) {
+		cli->pset = pset;
+		cli->pollout = cli->outq.head != NULL;
+	}
+	pthread_mutex_unlock(&cli->lock);
+
+	return r;
 }
 
-int bbus_poll(bbus_pollset* pset, struct bbus_timeval* tv)
+int bbus_pollset_rmcli(bbus_pollset* pset, bbus_client* cli)
 {
-	struct timeval stv;
-	int ret;
+	int i;
+	int r;
+
+	/* Make sure bbus_pollset_nextcli() won't return this client. */
+	for (i = pset->curevent; i < pset->numevents; ++i) {
+		if (pset->events[i].data.ptr == &cli->pent)
+			pset->events[i].data.ptr = NULL;
+	}
 
-	memset(&stv, 0, sizeof(struct timeval));
-	stv.tv_sec = tv->sec;
-	stv.tv_usec = tv->usec;
+	cli->pent.rev = 0;
+	pthread_mutex_lock(&cli->lock);
+	cli->pset = NULL;
+	cli->pollout = 0;
+	r = pollset_ctl(pset, EPOLL_CTL_DEL, cli->sock, &cli->pent, 0);
+	pthread_mutex_unlock(&cli->lock);
 
-	ret = select(pset->highsock, &pset->fdset, NULL, NULL, &stv);
-	tv->sec = stv.tv_sec;
-	tv->usec = stv.tv_usec;
+	return r;
+}
+
+/*
+ * Sends queued data if the client became writable. Returns non-zero if the
+ * client should be reported as ready to the user.
+ */
+static int handle_pollout(struct pollent* pent, uint32_t events)
+{
+	bbus_client* cli = pent->cli;
+	int r;
 
+	if (cli == NULL || !(events & EPOLLOUT))
+		return 1;
+
+	pthread_mutex_lock(&cli->lock);
+	r = flush_queue(cli);
+	pthread_mutex_unlock(&cli->lock);
+
+	/*
+	 * On write errors report the client as ready anyway - the user will
+	 * see the error when trying to receive data.
+	 */
+	return r < 0 || (events & ~EPOLLOUT);
+}
+
+int bbus_poll(bbus_pollset* pset, struct bbus_timeval* tv)
+{
+	struct pollent* pent;
+	int timeout;
+	int ret;
+	int numready = 0;
+	int i;
+
+	timeout = tv->sec * 1000 + tv->usec / 1000;
+	pset->numevents = 0;
+	pset->curevent = 0;
+	ret = epoll_wait(pset->epfd, pset->events, POLL_MAXEVENTS, timeout);
 	if (ret < 0) {
 		__bbus_seterr(errno == EINTR ? BBUS_EPOLLINTR : errno);
 		return -1;
 	}
 
-	return ret;
+	/* Revision 0 is reserved for objects, that have never been ready. */
+	if (++pset->rev == 0)
+		++pset->rev;
+
+	for (i = 0; i < ret; ++i) {
+		pent = pset->events[i].data.ptr;
+		if (handle_pollout(pent, pset->events[i].events)) {
+			pent->rev = pset->rev;
+			++numready;
+		} else {
+			/* Only became writable - nothing to report. */
+			pset->events[i].data.ptr = NULL;
+		}
+	}
+	pset->numevents = ret;
+
+	return numready;
 }
 
 int bbus_pollset_srvisset(bbus_pollset* pset, bbus_server* srv)
 {
-	return FD_ISSET(srv->sock, &pset->fdset);
+	return pset->rev != 0 && srv->pent.rev == pset->rev;
 }
 
 int bbus_pollset_cliisset(bbus_pollset* pset, bbus_client* cli)
 {
-	return FD_ISSET(cli->sock, &pset->fdset);
+	return pset->rev != 0 && cli->pent.rev == pset->rev;
+}
+
+bbus_client* bbus_pollset_nextcli(bbus_pollset* pset)
+{
+	struct pollent* pent;
+
+	while (pset->curevent < pset->numevents) {
+		pent = pset->events[pset->curevent++].data.ptr;
+		/* Skip servers and clients removed after the poll. */
+		if (pent != NULL && pent->cli != NULL)
+			return pent->cli;
+	}
+
+	return NULL;
 }
 
 void bbus_pollset_free(bbus_pollset* pset)
 {
+	close(pset->epfd);
 	bbus_free(pset);
 }
-
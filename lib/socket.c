@@ -14,9 +14,10 @@
 
 #include "socket.h"
 #include "error.h"
+#include "stats.h"
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/un.h>
 #include <errno.h>
 #include <string.h>
@@ -138,6 +139,19 @@ int __bbus_sock_close(int sock)
 	return 0;
 }
 
+int __bbus_sock_shutdown(int sock)
+{
+	int r;
+
+	r = shutdown(sock, SHUT_RDWR);
+	if (r < 0) {
+		__bbus_seterr(errno);
+		return -1;
+	}
+
+	return 0;
+}
+
 static inline void prepare_msghdr(struct msghdr* hdr,
 				const struct iovec* iov, int numiov)
 {
@@ -150,6 +164,20 @@ static inline void prepare_msghdr(struct msghdr* hdr,
 	hdr->msg_flags = 0;
 }
 
+static void count_send(ssize_t b)
+{
+	__BBUS_STATS_ADD(sndcalls, 1);
+	if (b > 0)
+		__BBUS_STATS_ADD(sndbytes, b);
+}
+
+static void count_recv(ssize_t b)
+{
+	__BBUS_STATS_ADD(rcvcalls, 1);
+	if (b > 0)
+		__BBUS_STATS_ADD(rcvbytes, b);
+}
+
 ssize_t __bbus_sock_send(int sock, const struct iovec* iov, int numiov)
 {
 	ssize_t b;
@@ -157,7 +185,31 @@ ssize_t __bbus_sock_send(int sock, const struct iovec* iov, int numiov)
 
 	prepare_msghdr(&hdr, iov, numiov);
 	b = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+	count_send(b);
+	if (b < 0) {
+		__bbus_seterr(errno);
+		return -1;
+	}
+
+	return b;
+}
+
+/*
+ * Same as __bbus_sock_send(), but never blocks. Returns 0 if no data could
+ * be sent without blocking.
+ */
+ssize_t __bbus_sock_trysend(int sock, const struct iovec* iov, int numiov)
+{
+	ssize_t b;
+	struct msghdr hdr;
+
+	prepare_msghdr(&hdr, iov, numiov);
+	b = sendmsg(sock, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+	count_send(b);
 	if (b < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+
 		__bbus_seterr(errno);
 		return -1;
 	}
@@ -171,7 +223,9 @@ ssize_t __bbus_sock_recv(int sock, struct iovec* iov, int numiov)
 	struct msghdr hdr;
 
 	prepare_msghdr(&hdr, iov, numiov);
-	b = recvmsg(sock, &hdr, MSG_NOSIGNAL);
+	/* Don't return partial data to callers expecting whole messages. */
+	b = recvmsg(sock, &hdr, MSG_NOSIGNAL | MSG_WAITALL);
+	count_recv(b);
 	if (b < 0) {
 		__bbus_seterr(errno);
 		return -1;
@@ -180,52 +234,87 @@ ssize_t __bbus_sock_recv(int sock, struct iovec* iov, int numiov)
 	return b;
 }
 
-#define SELECT_INIT(FDSET, SOCK, TV, BBTV)				\
-	do {								\
-		FD_ZERO(&(FDSET));					\
-		FD_SET((SOCK), &(FDSET));				\
-		(TV).tv_sec = (BBTV)->sec;				\
-		(TV).tv_usec = (BBTV)->usec;				\
-	} while (0)
-
-#define SELECT_CHECKERR(RETVAL)						\
-	do {								\
-		if ((RETVAL) < 0) {					\
-			__bbus_seterr(errno == EINTR			\
-					? BBUS_EPOLLINTR : errno);	\
-			return -1;					\
-		}							\
-	} while (0)
-
-#define SELECT_COPYTV(TV, BBTV)						\
-	do {								\
-		(BBTV)->sec = (TV).tv_sec;				\
-		(BBTV)->usec = (TV).tv_usec;				\
-	} while (0)
+/*
+ * Receives whatever data is available without blocking. Returns 0 if there's
+ * no data to read and -1 with BBUS_ECONNCLOSED set if the peer closed the
+ * connection.
+ */
+ssize_t __bbus_sock_tryrecv(int sock, struct iovec* iov, int numiov)
+{
+	ssize_t b;
+	struct msghdr hdr;
 
-int __bbus_sock_wrready(int sock, struct bbus_timeval* tv)
+	prepare_msghdr(&hdr, iov, numiov);
+	b = recvmsg(sock, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+	count_recv(b);
+	if (b < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+
+		__bbus_seterr(errno);
+		return -1;
+	} else
+	if (b == 0) {
+		__bbus_seterr(BBUS_ECONNCLOSED);
+		return -1;
+	}
+
+	return b;
+}
+
+/*
+ * poll() is used instead of select() as the latter can't handle descriptors
+ * with values greater than FD_SETSIZE.
+ */
+static int wait_for_event(int sock, short events, struct bbus_timeval* tv)
 {
-	fd_set wr_set;
-	struct timeval timeout;
+	struct pollfd pfd;
+	int timeout;
 	int r;
 
-	SELECT_INIT(wr_set, sock, timeout, tv);
-	r = select(sock+1, NULL, &wr_set, NULL, &timeout);
-	SELECT_CHECKERR(r);
-	SELECT_COPYTV(timeout, tv);
+	pfd.fd = sock;
+	pfd.events = events;
+	pfd.revents = 0;
+	timeout = tv == NULL ? -1 : tv->sec * 1000 + tv->usec / 1000;
+	r = poll(&pfd, 1, timeout);
+	if (r < 0) {
+		__bbus_seterr(errno == EINTR ? BBUS_EPOLLINTR : errno);
+		return -1;
+	}
+
 	return r;
 }
 
+int __bbus_sock_wrready(int sock, struct bbus_timeval* tv)
+{
+	return wait_for_event(sock, POLLOUT, tv);
+}
+
 int __bbus_sock_rdready(int sock, struct bbus_timeval* tv)
 {
-	fd_set rd_set;
-	struct timeval timeout;
+	return wait_for_event(sock, POLLIN, tv);
+}
+
+/*
+ * Waits until either the socket or the wake-up descriptor becomes readable.
+ * Returns 1 if the socket is readable, 0 if only the wake-up descriptor is.
+ */
+int __bbus_sock_rdwait(int sock, int wakefd)
+{
+	struct pollfd pfd[2];
 	int r;
 
-	SELECT_INIT(rd_set, sock, timeout, tv);
-	r = select(sock+1, &rd_set, NULL, NULL, &timeout);
-	SELECT_CHECKERR(r);
-	SELECT_COPYTV(timeout, tv);
-	return r;
-}
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = wakefd;
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+	r = poll(pfd, 2, -1);
+	if (r < 0) {
+		__bbus_seterr(errno == EINTR ? BBUS_EPOLLINTR : errno);
+		return -1;
+	}
 
+	return pfd[0].revents != 0 ? 1 : 0;
+}
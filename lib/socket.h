@@ -31,8 +31,12 @@ int __bbus_sock_un_rm(const char* path);
 int __bbus_sock_listen(int sock, int backlog);
 int __bbus_sock_close(int sock);
 ssize_t __bbus_sock_send(int sock, const struct iovec* iov, int numiov);
+ssize_t __bbus_sock_trysend(int sock, const struct iovec* iov, int numiov);
 ssize_t __bbus_sock_recv(int sock, struct iovec* iov, int numiov);
+ssize_t __bbus_sock_tryrecv(int sock, struct iovec* iov, int numiov);
+int __bbus_sock_shutdown(int sock);
 int __bbus_sock_wrready(int sock, struct bbus_timeval* tv);
 int __bbus_sock_rdready(int sock, struct bbus_timeval* tv);
+int __bbus_sock_rdwait(int sock, int wakefd);
 
 #endif /* __BBUS_SOCKET__ */
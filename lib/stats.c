@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+
+#include <busybus.h>
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define NUM_COUNTERS(TYPE) (sizeof(TYPE) / sizeof(unsigned long))
+
+/* Sums up all counters of the FIELD group of struct __bbus_thread_stats. */
+#define SUM_COUNTERS(DST, FIELD)					\
+	sum_counters((DST),						\
+		offsetof(struct __bbus_thread_stats, FIELD),		\
+		NUM_COUNTERS(((struct __bbus_thread_stats*)0)->FIELD))
+
+struct stats_list
+{
+	struct __bbus_thread_stats* head;
+	struct __bbus_thread_stats* tail;
+};
+
+BBUS_THREAD_LOCAL struct __bbus_thread_stats* __bbus_mystats;
+
+/*
+ * Counters are only ever written by the threads owning them. Counts of
+ * threads, that exited are moved to 'retired' and resetting just records
+ * the current totals as the new baseline.
+ */
+static struct stats_list threads;
+static struct __bbus_thread_stats retired;
+static struct __bbus_thread_stats base;
+/* Shared by threads, that couldn't allocate counters of their own. */
+static struct __bbus_thread_stats fallback;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static int key_ok;
+
+static void add_counters(void* dst, void* src, size_t num)
+{
+	unsigned long* d = dst;
+	unsigned long* s = src;
+	size_t i;
+
+	for (i = 0; i < num; ++i)
+		d[i] += BBUS_ATOMIC_GET(s[i]);
+}
+
+static void sub_counters(void* dst, const void* src, size_t num)
+{
+	unsigned long* d = dst;
+	const unsigned long* s = src;
+	size_t i;
+
+	for (i = 0; i < num; ++i)
+		d[i] -= s[i];
+}
+
+static void thread_exit(void* arg)
+{
+	struct __bbus_thread_stats* st = arg;
+
+	pthread_mutex_lock(&stats_lock);
+	add_counters(&retired.io, &st->io,
+			NUM_COUNTERS(struct bbus_iostats));
+	add_counters(&retired.mem, &st->mem,
+			NUM_COUNTERS(struct bbus_memstats));
+	bbus_list_rm(&threads, st);
+	pthread_mutex_unlock(&stats_lock);
+	__bbus_mystats = NULL;
+	free(st);
+}
+
+static void make_key(void)
+{
+	key_ok = pthread_key_create(&stats_key, thread_exit) == 0;
+}
+
+/*
+ * Uses calloc() directly - bbus_malloc() would count the allocation and
+ * end up here again.
+ */
+void __bbus_stats_register(void)
+{
+	struct __bbus_thread_stats* st;
+
+	(void)pthread_once(&key_once, make_key);
+	st = calloc(1, sizeof(struct __bbus_thread_stats));
+	if (st == NULL || !key_ok || pthread_setspecific(stats_key, st) != 0) {
+		free(st);
+		__bbus_mystats = &fallback;
+		return;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	bbus_list_push(&threads, st);
+	pthread_mutex_unlock(&stats_lock);
+	__bbus_mystats = st;
+}
+
+/*
+ * Must be called with stats_lock held.
+ */
+static void sum_counters(void* dst, size_t off, size_t num)
+{
+	struct __bbus_thread_stats* st;
+
+	memcpy(dst, (char*)&retired + off, num * sizeof(unsigned long));
+	add_counters(dst, (char*)&fallback + off, num);
+	for (st = threads.head; st != NULL; st = st->next)
+		add_counters(dst, (char*)st + off, num);
+}
+
+void bbus_iostats_get(struct bbus_iostats* stats)
+{
+	pthread_mutex_lock(&stats_lock);
+	SUM_COUNTERS(stats, io);
+	sub_counters(stats, &base.io, NUM_COUNTERS(struct bbus_iostats));
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void bbus_iostats_reset(void)
+{
+	pthread_mutex_lock(&stats_lock);
+	SUM_COUNTERS(&base.io, io);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void bbus_memstats_get(struct bbus_memstats* stats)
+{
+	pthread_mutex_lock(&stats_lock);
+	SUM_COUNTERS(stats, mem);
+	sub_counters(stats, &base.mem, NUM_COUNTERS(struct bbus_memstats));
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void bbus_memstats_reset(void)
+{
+	pthread_mutex_lock(&stats_lock);
+	SUM_COUNTERS(&base.mem, mem);
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+
+#ifndef __BBUS_STATS__
+#define __BBUS_STATS__
+
+#include <busybus.h>
+
+/*
+ * Statistics are counted separately by every thread and summed up when
+ * read, so that threads don't fight over a shared cache line.
+ */
+struct __bbus_thread_stats
+{
+	struct __bbus_thread_stats* next;
+	struct __bbus_thread_stats* prev;
+	struct bbus_iostats io;
+	struct bbus_memstats mem;
+};
+
+extern BBUS_THREAD_LOCAL struct __bbus_thread_stats* __bbus_mystats;
+
+void __bbus_stats_register(void);
+
+#define __BBUS_STATS_ADD(FIELD, VAL)					\
+	do {								\
+		if (BBUS_UNLIKELY(__bbus_mystats == NULL))		\
+			__bbus_stats_register();			\
+		__bbus_mystats->io.FIELD += (unsigned long)(VAL);	\
+	} while (0)
+
+#define __BBUS_MEMSTATS_ADD(FIELD, VAL)					\
+	do {								\
+		if (BBUS_UNLIKELY(__bbus_mystats == NULL))		\
+			__bbus_stats_register();			\
+		__bbus_mystats->mem.FIELD += (unsigned long)(VAL);	\
+	} while (0)
+
+#endif /* __BBUS_STATS__ */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include <busybus.h>
+#include "bbus-bench.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+struct benchlist
+{
+	struct bbusbench_listelem* head;
+	struct bbusbench_listelem* tail;
+};
+
+static struct benchlist benchmarks;
+static unsigned benchmarks_registered = 0;
+
+static BBUS_ATSTART_FIRST void benchlist_init(void)
+{
+	benchmarks.head = NULL;
+	benchmarks.tail = NULL;
+}
+
+void bbusbench_registerbench(struct bbusbench_listelem* bench)
+{
+	if (benchmarks.tail == NULL) {
+		benchmarks.head = benchmarks.tail = bench;
+		bench->next = NULL;
+	} else {
+		benchmarks.tail->next = bench;
+		bench->next = NULL;
+		benchmarks.tail = bench;
+	}
+	++benchmarks_registered;
+}
+
+#define PRINT_FROM_VA(STREAM, HDR, FMT)					\
+	do {								\
+		va_list va;						\
+		va_start(va, FMT);					\
+		fprintf(STREAM, HDR"\t");				\
+		vfprintf(STREAM, FMT, va);				\
+		fprintf(STREAM, "\n");					\
+		va_end(va);						\
+	} while (0)
+
+void bbusbench_print(const char* fmt, ...)
+{
+	PRINT_FROM_VA(stdout, "[INFO]", fmt);
+}
+
+void bbusbench_printerr(const char* fmt, ...)
+{
+	PRINT_FROM_VA(stderr, "[ERROR]\t", fmt);
+}
+
+double bbusbench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+void bbusbench_report(const char* what, unsigned long ops, double secs)
+{
+	bbusbench_print("  %-40s %12.0f ops/s  (%lu ops in %.3f s)",
+			what, secs > 0.0 ? ops / secs : 0.0, ops, secs);
+}
+
+static int should_run(const char* name, int argc, char** argv)
+{
+	int i;
+
+	if (argc < 2)
+		return 1;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Runs all registered benchmarks or only those whose names were passed
+ * as arguments.
+ */
+int main(int argc, char** argv)
+{
+	struct bbusbench_listelem* el;
+	unsigned bench_run = 0;
+
+	bbusbench_print("##############################");
+	bbusbench_print("####> Busybus benchmarks <####");
+	bbusbench_print("##############################");
+	bbusbench_print("%u benchmarks registered.", benchmarks_registered);
+	for (el = benchmarks.head; el != NULL; el = el->next) {
+		if (!should_run(el->name, argc, argv))
+			continue;
+
+		bbusbench_print("Benchmark:\t[%s]", el->name);
+		el->benchfunc();
+		++bench_run;
+	}
+	bbusbench_print("All done! %u %s run.", bench_run,
+				bench_run == 1 ? "benchmark" : "benchmarks");
+
+	return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BBUS_BENCH__
+#define __BBUS_BENCH__
+
+#include <busybus.h>
+
+void bbusbench_print(const char* fmt, ...) BBUS_PRINTF_FUNC(1, 2);
+void bbusbench_printerr(const char* fmt, ...) BBUS_PRINTF_FUNC(1, 2);
+
+/*
+ * Returns the current value of a monotonic clock in seconds.
+ */
+double bbusbench_now(void);
+
+/*
+ * Prints the number of operations per second in a common format.
+ */
+void bbusbench_report(const char* what, unsigned long ops, double secs);
+
+typedef void (*bbusbench_func)(void);
+
+struct bbusbench_listelem
+{
+	struct bbusbench_listelem* next;
+	const char* name;
+	bbusbench_func benchfunc;
+};
+
+void bbusbench_registerbench(struct bbusbench_listelem* bench);
+
+#define BBUSBENCH_DEFINE(NAME)						\
+	static void __##NAME##_bench(void);				\
+	static struct bbusbench_listelem __##NAME##_elem = {		\
+		.name = #NAME,						\
+		.benchfunc = __##NAME##_bench,				\
+	};								\
+	static void BBUS_ATSTART_LAST __##NAME##_register(void)		\
+	{								\
+		bbusbench_registerbench(&__##NAME##_elem);		\
+	}								\
+	static void __##NAME##_bench(void)
+
+#endif /* __BBUS_BENCH__ */
+
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-bench.h"
+#include "../../bin/bbusd/callers.h"
+#include <busybus.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Cost of tracking a forwarded call in bbusd's outstanding call table.
+ * Links the daemon's callers module directly and keeps a ring of calls
+ * in flight, taking the oldest one for each new call added. All calls
+ * have a deadline, so they're also added to and removed from the timer
+ * wheel.
+ */
+
+#define NUM_CALLS	4000000
+#define MAX_INFLIGHT	4096
+#define TIMEOUT		30000
+
+static unsigned ring[MAX_INFLIGHT];
+
+BBUSBENCH_DEFINE(call_table)
+{
+	static const unsigned inflight[] = { 1, 64, MAX_INFLIGHT };
+	struct bbusd_call call;
+	struct bbus_msg_hdr hdr;
+	char what[64];
+	unsigned* slot;
+	unsigned i;
+	unsigned j;
+	double begin;
+
+	bbusd_init_caller_map();
+	bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+	bbus_hdr_setcallid(&hdr, 1);
+
+	for (i = 0; i < BBUS_ARRAY_SIZE(inflight); ++i) {
+		for (j = 0; j < inflight[i]; ++j)
+			ring[j] = bbusd_new_call(j, &hdr, NULL, TIMEOUT);
+
+		begin = bbusbench_now();
+		for (j = 0; j < NUM_CALLS; ++j) {
+			slot = &ring[j % inflight[i]];
+			if (bbusd_take_call(*slot, NULL, &call) < 0) {
+				bbusbench_printerr("Call not found");
+				goto out;
+			}
+			*slot = bbusd_new_call(j, &hdr, NULL, TIMEOUT);
+		}
+		snprintf(what, sizeof(what), "%u calls in flight",
+							inflight[i]);
+		bbusbench_report(what, NUM_CALLS, bbusbench_now() - begin);
+
+		for (j = 0; j < inflight[i]; ++j)
+			(void)bbusd_take_call(ring[j], NULL, &call);
+	}
+
+out:
+	bbusd_clean_caller_map();
+}
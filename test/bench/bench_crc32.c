@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-bench.h"
+#include "../../lib/crc32.h"
+#include <busybus.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Throughput of every crc32 variant available on this machine, for a buffer
+ * the size of a typical message and for a large payload.
+ */
+
+#define TOTAL_BYTES	(256UL * 1024 * 1024)
+
+static const size_t buf_sizes[] = { 1024, 64 * 1024 };
+
+static void report_mbps(const char* what, size_t bufsize, double secs)
+{
+	bbusbench_print("  %-40s %12.1f MB/s  (%zu byte buffer)", what,
+			secs > 0.0 ? TOTAL_BYTES / secs / (1024 * 1024) : 0.0,
+			bufsize);
+}
+
+BBUSBENCH_DEFINE(crc32_throughput)
+{
+	const struct __bbus_crc32_variant* vars;
+	volatile uint32_t crc;
+	unsigned char* buf;
+	unsigned numvars;
+	unsigned long i;
+	unsigned s;
+	unsigned v;
+	double begin;
+
+	buf = bbus_malloc(buf_sizes[BBUS_ARRAY_SIZE(buf_sizes) - 1]);
+	if (buf == NULL) {
+		bbusbench_printerr("Error allocating the buffer");
+		return;
+	}
+
+	for (i = 0; i < buf_sizes[BBUS_ARRAY_SIZE(buf_sizes) - 1]; ++i)
+		buf[i] = (unsigned char)i;
+
+	numvars = __bbus_crc32_getvariants(&vars);
+	for (s = 0; s < BBUS_ARRAY_SIZE(buf_sizes); ++s) {
+		for (v = 0; v < numvars; ++v) {
+			begin = bbusbench_now();
+			for (i = 0; i < TOTAL_BYTES / buf_sizes[s]; ++i)
+				crc = vars[v].update(0xffffffff,
+							buf, buf_sizes[s]);
+			report_mbps(vars[v].name, buf_sizes[s],
+					bbusbench_now() - begin);
+		}
+
+		begin = bbusbench_now();
+		for (i = 0; i < TOTAL_BYTES / buf_sizes[s]; ++i)
+			crc = bbus_crc32(buf, buf_sizes[s]);
+		report_mbps("bbus_crc32()", buf_sizes[s],
+					bbusbench_now() - begin);
+	}
+
+	(void)crc;
+	bbus_free(buf);
+}
@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-bench.h"
+#include <busybus.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ * Method call throughput of bbusd depending on the number of worker threads.
+ * Spawns ./bbusd on a private socket, connects NUM_SERVICES echo services
+ * and NUM_CALLERS callers (each in its own thread) and counts the calls
+ * completed in RUN_TIME seconds.
+ */
+
+#define BBUSD_PATH	"./bbusd"
+#define NUM_SERVICES	8
+#define NUM_CALLERS	16
+#define RUN_TIME	2.0
+#define SLOW_METHOD_USEC	10000
+
+static volatile int stop_callers;
+static volatile int stop_services;
+static int started;
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+
+static void set_started(int val)
+{
+	pthread_mutex_lock(&start_lock);
+	started = val;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+}
+
+static void wait_started(void)
+{
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+}
+
+static bbus_object* echo_func(bbus_object* arg)
+{
+	char* msg;
+
+	if (bbus_obj_parse(arg, "s", &msg) < 0)
+		return NULL;
+
+	return bbus_obj_build("s", msg);
+}
+
+static struct bbus_method echo_method = {
+	.name = "echo",
+	.argdscr = "s",
+	.retdscr = "s",
+	.func = echo_func,
+};
+
+/* Stands in for a method waiting on slow hardware, such as flash. */
+static bbus_object* slow_func(bbus_object* arg)
+{
+	usleep(SLOW_METHOD_USEC);
+	return echo_func(arg);
+}
+
+static struct bbus_method slow_method = {
+	.name = "slow",
+	.argdscr = "s",
+	.retdscr = "s",
+	.func = slow_func,
+};
+
+static void* service_main(void* arg)
+{
+	bbus_service_connection* conn = arg;
+	struct bbus_timeval tv;
+
+	while (!BBUS_ATOMIC_GET(stop_services)) {
+		tv.sec = 0;
+		tv.usec = 100000;
+		if (bbus_srvc_listencalls(conn, &tv) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+struct caller
+{
+	pthread_t thread;
+	bbus_client_connection* conn;
+	char method[32];
+	int byhandle;
+	unsigned long calls;
+	int failed;
+};
+
+static void* caller_main(void* arg)
+{
+	struct caller* caller = arg;
+	bbus_method_handle handle = BBUS_METHOD_NOHANDLE;
+	bbus_object* argobj;
+	bbus_object* ret;
+
+	argobj = bbus_obj_build("s", "Lorem ipsum dolor sit amet");
+	if (argobj == NULL) {
+		caller->failed = 1;
+		return NULL;
+	}
+
+	if (caller->byhandle) {
+		handle = bbus_resolvemethod(caller->conn, caller->method);
+		if (handle == BBUS_METHOD_NOHANDLE)
+			caller->failed = 1;
+	}
+
+	wait_started();
+
+	while (!BBUS_ATOMIC_GET(stop_callers) && !caller->failed) {
+		if (caller->byhandle)
+			ret = bbus_callmethod_id_view(caller->conn,
+							handle, argobj);
+		else
+			ret = bbus_callmethod_view(caller->conn,
+						caller->method, argobj);
+		if (ret == NULL) {
+			caller->failed = 1;
+			break;
+		}
+		++caller->calls;
+	}
+
+	bbus_obj_free(argobj);
+	return NULL;
+}
+
+static pid_t spawn_daemon(const char* sockpath, unsigned numworkers)
+{
+	char workers[16];
+	pid_t pid;
+	int fd;
+
+	snprintf(workers, sizeof(workers), "%u", numworkers);
+	pid = fork();
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execl(BBUSD_PATH, BBUSD_PATH, "--sockpath", sockpath,
+				"--workers", workers, (char*)NULL);
+		_exit(EXIT_FAILURE);
+	}
+
+	return pid;
+}
+
+static bbus_service_connection* connect_service(unsigned num,
+					struct bbus_method* method)
+{
+	bbus_service_connection* conn = NULL;
+	char name[16];
+	int i;
+
+	snprintf(name, sizeof(name), "bench%u", num);
+	/* Give the daemon some time to start. */
+	for (i = 0; i < 100 && conn == NULL; ++i) {
+		conn = bbus_srvc_connect(name);
+		if (conn == NULL)
+			usleep(20000);
+	}
+	if (conn == NULL)
+		return NULL;
+
+	if (bbus_srvc_regmethod(conn, method) < 0) {
+		bbus_srvc_closeconn(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+static void run_daemon(const char* sockpath, unsigned numworkers,
+							int byhandle)
+{
+	bbus_service_connection* services[NUM_SERVICES];
+	pthread_t srvc_threads[NUM_SERVICES];
+	struct caller callers[NUM_CALLERS];
+	unsigned long calls = 0;
+	unsigned numsrvc = 0;
+	unsigned numcallers = 0;
+	char what[64];
+	double begin;
+	double end;
+	pid_t pid;
+	int failed = 0;
+	unsigned i;
+
+	pid = spawn_daemon(sockpath, numworkers);
+	if (pid < 0) {
+		bbusbench_printerr("Error spawning bbusd");
+		return;
+	}
+
+	BBUS_ATOMIC_SET(stop_callers, 0);
+	BBUS_ATOMIC_SET(stop_services, 0);
+	set_started(0);
+
+	for (numsrvc = 0; numsrvc < NUM_SERVICES; ++numsrvc) {
+		services[numsrvc] = connect_service(numsrvc, &echo_method);
+		if (services[numsrvc] == NULL) {
+			bbusbench_printerr("Error connecting service: %s",
+					bbus_strerror(bbus_lasterror()));
+			goto out;
+		}
+		if (pthread_create(&srvc_threads[numsrvc], NULL,
+				service_main, services[numsrvc]) != 0) {
+			bbus_srvc_closeconn(services[numsrvc]);
+			goto out;
+		}
+	}
+
+	for (numcallers = 0; numcallers < NUM_CALLERS; ++numcallers) {
+		memset(&callers[numcallers], 0, sizeof(struct caller));
+		snprintf(callers[numcallers].method,
+			sizeof(callers[numcallers].method),
+			"bbus.bench%u.echo", numcallers % NUM_SERVICES);
+		callers[numcallers].byhandle = byhandle;
+		callers[numcallers].conn = bbus_connect("bbus-bench");
+		if (callers[numcallers].conn == NULL) {
+			bbusbench_printerr("Error connecting caller: %s",
+					bbus_strerror(bbus_lasterror()));
+			goto out;
+		}
+		if (pthread_create(&callers[numcallers].thread, NULL,
+				caller_main, &callers[numcallers]) != 0) {
+			bbus_closeconn(callers[numcallers].conn);
+			goto out;
+		}
+	}
+
+	begin = bbusbench_now();
+	set_started(1);
+	usleep((useconds_t)(RUN_TIME * 1000000));
+
+out:
+	set_started(1);
+	BBUS_ATOMIC_SET(stop_callers, 1);
+	for (i = 0; i < numcallers; ++i) {
+		pthread_join(callers[i].thread, NULL);
+		calls += callers[i].calls;
+		failed |= callers[i].failed;
+		bbus_closeconn(callers[i].conn);
+	}
+	end = bbusbench_now();
+
+	/* Services must outlive the callers' last calls. */
+	BBUS_ATOMIC_SET(stop_services, 1);
+	for (i = 0; i < numsrvc; ++i) {
+		pthread_join(srvc_threads[i], NULL);
+		bbus_srvc_closeconn(services[i]);
+	}
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	if (numcallers < NUM_CALLERS) {
+		bbusbench_printerr("Benchmark setup failed");
+		return;
+	}
+	if (failed)
+		bbusbench_printerr("Some method calls failed");
+
+	snprintf(what, sizeof(what), "bbusd --workers %u%s", numworkers,
+					byhandle ? ", calls by handle" : "");
+	bbusbench_report(what, calls, end - begin);
+}
+
+BBUSBENCH_DEFINE(daemon_workers)
+{
+	static const unsigned numworkers[] = { 0, 1, 2, 4, 8 };
+	char sockpath[64];
+	unsigned i;
+
+	snprintf(sockpath, sizeof(sockpath), "/tmp/bbus-bench-%d.sock",
+							(int)getpid());
+	bbus_prot_setsockpath(sockpath);
+	bbusbench_print("  %u services, %u callers, %.1f seconds per run, "
+			"%ld cpus online", NUM_SERVICES, NUM_CALLERS,
+			RUN_TIME, sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (i = 0; i < BBUS_ARRAY_SIZE(numworkers); ++i)
+		run_daemon(sockpath, numworkers[i], 0);
+
+	unlink(sockpath);
+}
+
+/*
+ * Same setup, but compares calling methods by name with calling them by
+ * handles resolved beforehand.
+ */
+BBUSBENCH_DEFINE(daemon_method_handles)
+{
+	static const unsigned numworkers[] = { 0, 4 };
+	char sockpath[64];
+	unsigned i;
+
+	snprintf(sockpath, sizeof(sockpath), "/tmp/bbus-bench-%d.sock",
+							(int)getpid());
+	bbus_prot_setsockpath(sockpath);
+	bbusbench_print("  %u services, %u callers, %.1f seconds per run, "
+			"%ld cpus online", NUM_SERVICES, NUM_CALLERS,
+			RUN_TIME, sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (i = 0; i < BBUS_ARRAY_SIZE(numworkers); ++i) {
+		run_daemon(sockpath, numworkers[i], 0);
+		run_daemon(sockpath, numworkers[i], 1);
+	}
+
+	unlink(sockpath);
+}
+
+
+struct async_state
+{
+	unsigned long done;
+	int failed;
+};
+
+static void async_reply(bbus_call_token tok BBUS_UNUSED,
+				bbus_object* ret, void* priv)
+{
+	struct async_state* state = priv;
+
+	if (ret == NULL)
+		state->failed = 1;
+	++state->done;
+}
+
+/* How the service in run_async() handles its calls. */
+struct async_service
+{
+	bbus_service_connection* conn;
+	/* Worker threads for bbus_srvc_run(), 0 to handle calls inline. */
+	unsigned nthreads;
+	/* Batch size for bbus_srvc_draincalls(), 0 to listen for each call. */
+	unsigned maxcalls;
+};
+
+static void* async_service_main(void* arg)
+{
+	struct async_service* srvc = arg;
+	struct bbus_timeval tv;
+
+	if (srvc->nthreads > 0) {
+		if (bbus_srvc_run(srvc->conn, srvc->nthreads) < 0)
+			bbusbench_printerr("Error serving calls: %s",
+					bbus_strerror(bbus_lasterror()));
+		return NULL;
+	}
+
+	if (srvc->maxcalls == 0)
+		return service_main(srvc->conn);
+
+	while (!BBUS_ATOMIC_GET(stop_services)) {
+		tv.sec = 0;
+		tv.usec = 100000;
+		if (bbus_srvc_draincalls(srvc->conn, &tv, srvc->maxcalls) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void run_async(const char* sockpath, unsigned window,
+		struct async_service* service, struct bbus_method* method)
+{
+	bbus_service_connection* srvc = NULL;
+	bbus_client_connection* conn = NULL;
+	struct async_state state;
+	struct bbus_iostats iostats;
+	struct bbus_timeval tv;
+	pthread_t srvc_thread;
+	char methodname[32];
+	unsigned long sent = 0;
+	bbus_object* argobj = NULL;
+	char what[64];
+	double begin;
+	double end;
+	pid_t pid;
+	int r;
+
+	pid = spawn_daemon(sockpath, 0);
+	if (pid < 0) {
+		bbusbench_printerr("Error spawning bbusd");
+		return;
+	}
+
+	memset(&state, 0, sizeof(struct async_state));
+	BBUS_ATOMIC_SET(stop_services, 0);
+	srvc = connect_service(0, method);
+	if (srvc == NULL) {
+		bbusbench_printerr("Error connecting service: %s",
+				bbus_strerror(bbus_lasterror()));
+		goto out_kill;
+	}
+	service->conn = srvc;
+	if (pthread_create(&srvc_thread, NULL,
+				async_service_main, service) != 0) {
+		bbus_srvc_closeconn(srvc);
+		goto out_kill;
+	}
+	snprintf(methodname, sizeof(methodname),
+			"bbus.bench0.%s", method->name);
+
+	conn = bbus_connect("bbus-bench");
+	argobj = bbus_obj_build("s", "Lorem ipsum dolor sit amet");
+	if (conn == NULL || argobj == NULL) {
+		bbusbench_printerr("Error connecting caller: %s",
+				bbus_strerror(bbus_lasterror()));
+		goto out_srvc;
+	}
+
+	bbus_iostats_reset();
+	begin = bbusbench_now();
+	do {
+		/* Keep the window full, then collect whatever came back. */
+		while (sent - state.done < window) {
+			if (bbus_callmethod_async(conn, methodname,
+						argobj) == BBUS_CALL_NOTOKEN) {
+				state.failed = 1;
+				goto drain;
+			}
+			++sent;
+		}
+
+		tv.sec = 1;
+		tv.usec = 0;
+		r = bbus_poll_replies(conn, &tv, async_reply, &state);
+		if (r <= 0) {
+			state.failed = 1;
+			break;
+		}
+	} while (bbusbench_now() - begin < RUN_TIME);
+
+drain:
+	while (!state.failed && state.done < sent) {
+		tv.sec = 1;
+		tv.usec = 0;
+		if (bbus_poll_replies(conn, &tv, async_reply, &state) <= 0)
+			state.failed = 1;
+	}
+	end = bbusbench_now();
+
+	if (state.failed)
+		bbusbench_printerr("Some method calls failed");
+
+	if (service->nthreads > 0)
+		snprintf(what, sizeof(what), "%u call(s) in flight, "
+			"%u service threads", window, service->nthreads);
+	else if (service->maxcalls > 0)
+		snprintf(what, sizeof(what), "%u call(s) in flight, "
+			"draining up to %u", window, service->maxcalls);
+	else
+		snprintf(what, sizeof(what), "%u call(s) in flight", window);
+	bbusbench_report(what, state.done, end - begin);
+	/* Both the caller and the service are counted. */
+	bbus_iostats_get(&iostats);
+	if (state.done > 0)
+		bbusbench_print("    %.2f socket system calls per call",
+				(double)(iostats.rcvcalls + iostats.sndcalls)
+							/ state.done);
+
+out_srvc:
+	bbus_obj_free(argobj);
+	if (conn != NULL)
+		bbus_closeconn(conn);
+	BBUS_ATOMIC_SET(stop_services, 1);
+	bbus_srvc_stop(srvc);
+	pthread_join(srvc_thread, NULL);
+	bbus_srvc_closeconn(srvc);
+
+out_kill:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+/*
+ * Throughput of a single caller connection keeping a number of
+ * asynchronous calls to one service in flight.
+ */
+BBUSBENCH_DEFINE(daemon_async_calls)
+{
+	static const unsigned windows[] = { 1, 16, 256 };
+	struct async_service service;
+	char sockpath[64];
+	unsigned i;
+
+	snprintf(sockpath, sizeof(sockpath), "/tmp/bbus-bench-%d.sock",
+							(int)getpid());
+	bbus_prot_setsockpath(sockpath);
+	bbusbench_print("  1 service, 1 caller, %.1f seconds per run",
+								RUN_TIME);
+
+	memset(&service, 0, sizeof(struct async_service));
+	for (i = 0; i < BBUS_ARRAY_SIZE(windows); ++i)
+		run_async(sockpath, windows[i], &service, &echo_method);
+
+	unlink(sockpath);
+}
+
+/*
+ * Throughput of a service whose method takes SLOW_METHOD_USEC to complete,
+ * handling the calls inline and on a pool of worker threads.
+ */
+BBUSBENCH_DEFINE(service_worker_pool)
+{
+	static const unsigned numthreads[] = { 0, 1, 4, 16 };
+	struct async_service service;
+	char sockpath[64];
+	unsigned i;
+
+	snprintf(sockpath, sizeof(sockpath), "/tmp/bbus-bench-%d.sock",
+							(int)getpid());
+	bbus_prot_setsockpath(sockpath);
+	bbusbench_print("  1 service, 1 caller, %u usec per call, "
+			"%.1f seconds per run", SLOW_METHOD_USEC, RUN_TIME);
+
+	memset(&service, 0, sizeof(struct async_service));
+	for (i = 0; i < BBUS_ARRAY_SIZE(numthreads); ++i) {
+		service.nthreads = numthreads[i];
+		run_async(sockpath, 32, &service, &slow_method);
+	}
+
+	unlink(sockpath);
+}
+
+/*
+ * Throughput of a service handling the calls one by one compared to
+ * draining everything that's arrived, with a single caller keeping the
+ * service busy.
+ */
+BBUSBENCH_DEFINE(service_drain_calls)
+{
+	static const unsigned maxcalls[] = { 0, 1, 16, 64, 256 };
+	struct async_service service;
+	char sockpath[64];
+	unsigned i;
+
+	snprintf(sockpath, sizeof(sockpath), "/tmp/bbus-bench-%d.sock",
+							(int)getpid());
+	bbus_prot_setsockpath(sockpath);
+	bbusbench_print("  1 service, 1 caller, %.1f seconds per run",
+								RUN_TIME);
+
+	memset(&service, 0, sizeof(struct async_service));
+	for (i = 0; i < BBUS_ARRAY_SIZE(maxcalls); ++i) {
+		service.maxcalls = maxcalls[i];
+		run_async(sockpath, 256, &service, &echo_method);
+	}
+
+	unlink(sockpath);
+}
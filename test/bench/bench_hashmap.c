@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-bench.h"
+#include <busybus.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Lookups per second for both hashmap implementations. Keys look like
+ * method names and are looked up in a scrambled order, so that large maps
+ * don't fit in the cache.
+ */
+
+#define NUM_LOOKUPS	2000000
+#define KEYSIZE		32
+
+static const unsigned map_sizes[] = { 100, 10000, 1000000 };
+
+static const struct
+{
+	enum bbus_hmap_impl impl;
+	const char* name;
+} impls[] = {
+	{ BBUS_HMAP_OPENADDR,	"open addressing" },
+	{ BBUS_HMAP_CHAINED,	"chained" },
+};
+
+static int bench_lookups(enum bbus_hmap_impl impl, const char* name,
+				char (*keys)[KEYSIZE], unsigned numkeys)
+{
+	bbus_hashmap* hmap;
+	char what[64];
+	unsigned long found = 0;
+	double begin;
+	unsigned i;
+	int r;
+
+	hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYSTR, impl);
+	if (hmap == NULL)
+		return -1;
+
+	for (i = 0; i < numkeys; ++i) {
+		r = bbus_hmap_setstr(hmap, keys[i], keys[i]);
+		if (r < 0) {
+			bbus_hmap_free(hmap);
+			return -1;
+		}
+	}
+
+	begin = bbusbench_now();
+	for (i = 0; i < NUM_LOOKUPS; ++i) {
+		/* Stepping by a large prime visits the keys in random order. */
+		if (bbus_hmap_findstr(hmap,
+				keys[(i * 2654435761U) % numkeys]) != NULL)
+			found++;
+	}
+	snprintf(what, sizeof(what), "%s, %u keys", name, numkeys);
+	bbusbench_report(what, NUM_LOOKUPS, bbusbench_now() - begin);
+
+	bbus_hmap_free(hmap);
+
+	return found == NUM_LOOKUPS ? 0 : -1;
+}
+
+BBUSBENCH_DEFINE(hashmap_lookups)
+{
+	char (*keys)[KEYSIZE];
+	unsigned numkeys;
+	unsigned i;
+	unsigned j;
+	int r;
+
+	for (i = 0; i < BBUS_ARRAY_SIZE(map_sizes); ++i) {
+		numkeys = map_sizes[i];
+		keys = bbus_malloc(numkeys * KEYSIZE);
+		if (keys == NULL) {
+			bbusbench_printerr("Error allocating keys");
+			return;
+		}
+
+		for (j = 0; j < numkeys; ++j)
+			snprintf(keys[j], KEYSIZE, "bbus.bench.method%u", j);
+
+		for (j = 0; j < BBUS_ARRAY_SIZE(impls); ++j) {
+			r = bench_lookups(impls[j].impl, impls[j].name,
+							keys, numkeys);
+			if (r < 0) {
+				bbusbench_printerr("Error benchmarking %s: %s",
+					impls[j].name,
+					bbus_strerror(bbus_lasterror()));
+			}
+		}
+
+		bbus_free(keys);
+	}
+}
+
+/*
+ * Lookups in maps shaped like the ones bbusd uses, under each hash
+ * function: callers keyed by sequential tokens and methods keyed by name.
+ */
+
+#define NUM_CALLERS	1000
+#define NUM_METHODS	64
+
+static const struct
+{
+	bbus_hmap_hashfunc func;
+	const char* name;
+} hashfuncs[] = {
+	{ bbus_crc32,		"crc32" },
+	{ NULL,			"default hash" },
+};
+
+static void bench_callers(bbus_hmap_hashfunc func, const char* name)
+{
+	bbus_hashmap* hmap;
+	char what[64];
+	double begin;
+	unsigned i;
+
+	hmap = bbus_hmap_create(BBUS_HMAP_KEYUINT);
+	if (hmap == NULL)
+		goto err;
+
+	bbus_hmap_sethashfunc(hmap, func);
+	for (i = 0; i < NUM_CALLERS; ++i) {
+		if (bbus_hmap_setuint(hmap, i, hmap) < 0)
+			goto err;
+	}
+
+	begin = bbusbench_now();
+	for (i = 0; i < NUM_LOOKUPS; ++i) {
+		if (bbus_hmap_finduint(hmap, i % NUM_CALLERS) == NULL)
+			goto err;
+	}
+	snprintf(what, sizeof(what), "caller map, %s", name);
+	bbusbench_report(what, NUM_LOOKUPS, bbusbench_now() - begin);
+
+	bbus_hmap_free(hmap);
+	return;
+
+err:
+	bbusbench_printerr("Error benchmarking caller map");
+	bbus_hmap_free(hmap);
+}
+
+static void bench_methods(bbus_hmap_hashfunc func, const char* name)
+{
+	char keys[NUM_METHODS][KEYSIZE];
+	bbus_hashmap* hmap;
+	char what[64];
+	double begin;
+	unsigned i;
+
+	hmap = bbus_hmap_create(BBUS_HMAP_KEYSTR);
+	if (hmap == NULL)
+		goto err;
+
+	bbus_hmap_sethashfunc(hmap, func);
+	for (i = 0; i < NUM_METHODS; ++i) {
+		snprintf(keys[i], KEYSIZE, "bbus.service%u.method", i);
+		if (bbus_hmap_setstr(hmap, keys[i], hmap) < 0)
+			goto err;
+	}
+
+	begin = bbusbench_now();
+	for (i = 0; i < NUM_LOOKUPS; ++i) {
+		if (bbus_hmap_findstr(hmap, keys[i % NUM_METHODS]) == NULL)
+			goto err;
+	}
+	snprintf(what, sizeof(what), "method map, %s", name);
+	bbusbench_report(what, NUM_LOOKUPS, bbusbench_now() - begin);
+
+	bbus_hmap_free(hmap);
+	return;
+
+err:
+	bbusbench_printerr("Error benchmarking method map");
+	bbus_hmap_free(hmap);
+}
+
+BBUSBENCH_DEFINE(hashmap_hashfuncs)
+{
+	unsigned i;
+
+	for (i = 0; i < BBUS_ARRAY_SIZE(hashfuncs); ++i)
+		bench_callers(hashfuncs[i].func, hashfuncs[i].name);
+	for (i = 0; i < BBUS_ARRAY_SIZE(hashfuncs); ++i)
+		bench_methods(hashfuncs[i].func, hashfuncs[i].name);
+}
+
+/*
+ * Worst case latency of a single insert while a map grows from empty to
+ * a million entries. Single inserts are timed with the CPU clock of the
+ * thread, so that being preempted doesn't count, while page faults and
+ * memory given back to the kernel do.
+ */
+
+#define NUM_INSERTS	1000000
+
+static double cpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+BBUSBENCH_DEFINE(hashmap_insert_latency)
+{
+	bbus_hashmap* hmap;
+	double begin;
+	double start;
+	double took;
+	double worst;
+	unsigned i;
+	unsigned j;
+
+	for (j = 0; j < BBUS_ARRAY_SIZE(impls); ++j) {
+		hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT, impls[j].impl);
+		if (hmap == NULL)
+			goto err_create;
+
+		begin = bbusbench_now();
+		for (i = 0; i < NUM_INSERTS; ++i) {
+			if (bbus_hmap_setuint(hmap, i, hmap) < 0)
+				goto err_insert;
+		}
+		bbusbench_report(impls[j].name, NUM_INSERTS,
+					bbusbench_now() - begin);
+		bbus_hmap_free(hmap);
+
+		/* Reading the clock is slower than an insert, time apart. */
+		hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT, impls[j].impl);
+		if (hmap == NULL)
+			goto err_create;
+
+		worst = 0.0;
+		for (i = 0; i < NUM_INSERTS; ++i) {
+			start = cpu_now();
+			if (bbus_hmap_setuint(hmap, i, hmap) < 0)
+				goto err_insert;
+			took = cpu_now() - start;
+			if (took > worst)
+				worst = took;
+		}
+		bbusbench_print("  %-40s %12.1f us", "  worst single insert",
+							worst * 1000000.0);
+
+		bbus_hmap_free(hmap);
+	}
+
+	return;
+
+err_insert:
+	bbusbench_printerr("Error inserting");
+	bbus_hmap_free(hmap);
+	return;
+
+err_create:
+	bbusbench_printerr("Error creating the hashmap");
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+
+#include "bbus-bench.h"
+#include "../../lib/protocol.h"
+#include <busybus.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Cost of sending and receiving small messages over a local socket pair,
+ * mostly dominated by the protocol's handling of the header.
+ */
+
+#define NUM_MSGS	200000
+
+static int send_small(int sock, struct bbus_msg_hdr* hdr, unsigned num)
+{
+	static const char meta[] = "bbus.bench.echo";
+
+	bbus_hdr_settoken(hdr, num);
+	return __bbus_prot_sendvmsg(sock, hdr, meta, NULL, 0);
+}
+
+static void prep_hdr(struct bbus_msg_hdr* hdr)
+{
+	bbus_hdr_build(hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+	bbus_hdr_setpsize(hdr, sizeof("bbus.bench.echo"));
+	BBUS_HDR_SETFLAG(hdr, BBUS_PROT_HASMETA);
+}
+
+BBUSBENCH_DEFINE(prot_small_msgs)
+{
+	char buf[BBUS_MAXMSGSIZE];
+	struct bbus_msg* msg = (struct bbus_msg*)buf;
+	struct bbus_msg* rcvbuf = NULL;
+	size_t rcvbufsize = 0;
+	struct __bbus_prot_rcvctx ctx;
+	struct bbus_msg_hdr hdr;
+	int sock[2];
+	double begin;
+	unsigned i;
+	int r;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) < 0) {
+		bbusbench_printerr("Error creating socket pair");
+		return;
+	}
+
+	prep_hdr(&hdr);
+	__bbus_prot_rcvctx_init(&ctx);
+
+	begin = bbusbench_now();
+	for (i = 0; i < NUM_MSGS; ++i) {
+		if (send_small(sock[0], &hdr, i) < 0
+				|| __bbus_prot_recvmsg(sock[1], msg,
+							sizeof(buf)) < 0)
+			goto err;
+	}
+	bbusbench_report("send + blocking receive", NUM_MSGS,
+					bbusbench_now() - begin);
+
+	begin = bbusbench_now();
+	for (i = 0; i < NUM_MSGS; ++i) {
+		if (send_small(sock[0], &hdr, i) < 0)
+			goto err;
+
+		/*
+		 * The first attempt returns 0 without reading if the previous
+		 * read emptied the socket.
+		 */
+		do {
+			r = __bbus_prot_tryrecvmsg(sock[1], &ctx,
+						&rcvbuf, &rcvbufsize);
+		} while (r == 0);
+		if (r < 0)
+			goto err;
+	}
+	bbusbench_report("send + non-blocking receive", NUM_MSGS,
+					bbusbench_now() - begin);
+
+	goto out;
+
+err:
+	bbusbench_printerr("Error transferring message: %s",
+				bbus_strerror(bbus_lasterror()));
+out:
+	bbus_free(rcvbuf);
+	__bbus_prot_rcvctx_free(&ctx);
+	close(sock[0]);
+	close(sock[1]);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-bench.h"
+#include "../../bin/bbusd/service.h"
+#include <busybus.h>
+#include <stdio.h>
+
+/*
+ * Cost of resolving a method name in bbusd's service map. Links the
+ * daemon's service module directly and fills it with NUM_SERVICES
+ * services, each registering NUM_METHODS methods, at increasing depths.
+ */
+
+#define NUM_SERVICES	64
+#define NUM_METHODS	8
+#define NUM_LOOKUPS	2000000
+#define NAMESIZE	128
+
+static const char* const prefixes[] = {
+	"bbus.bench",
+	"bbus.bench.org.example",
+	"bbus.bench.org.example.product.module",
+	"bbus.bench.org.example.product.module.component.unit",
+};
+
+static char names[BBUS_ARRAY_SIZE(prefixes)]
+			[NUM_SERVICES * NUM_METHODS][NAMESIZE];
+
+static int register_methods(void)
+{
+	struct bbusd_remote_method* mthd;
+	unsigned p;
+	unsigned i;
+	int r;
+
+	for (p = 0; p < BBUS_ARRAY_SIZE(prefixes); ++p) {
+		for (i = 0; i < NUM_SERVICES * NUM_METHODS; ++i) {
+			snprintf(names[p][i], NAMESIZE, "%s.srvc%u.method%u",
+					prefixes[p], i / NUM_METHODS,
+					i % NUM_METHODS);
+			mthd = bbusd_alloc_remote_method();
+			if (mthd == NULL)
+				return -1;
+
+			mthd->type = BBUSD_METHOD_REMOTE;
+			r = bbusd_insert_method(names[p][i],
+					(struct bbusd_method*)mthd);
+			if (r < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+BBUSBENCH_DEFINE(service_lookup)
+{
+	char what[64];
+	unsigned depth;
+	unsigned p;
+	unsigned i;
+	double begin;
+
+	bbusd_init_service_map();
+	if (register_methods() < 0) {
+		bbusbench_printerr("Error registering methods");
+		goto out;
+	}
+
+	for (p = 0; p < BBUS_ARRAY_SIZE(prefixes); ++p) {
+		for (i = 0, depth = 1; names[p][0][i]; ++i)
+			depth += names[p][0][i] == '.';
+
+		begin = bbusbench_now();
+		for (i = 0; i < NUM_LOOKUPS; ++i) {
+			if (bbusd_locate_method(names[p][(i * 7919)
+					% (NUM_SERVICES * NUM_METHODS)]) == NULL) {
+				bbusbench_printerr("Method not found");
+				goto out;
+			}
+		}
+		snprintf(what, sizeof(what), "%u levels deep", depth);
+		bbusbench_report(what, NUM_LOOKUPS, bbusbench_now() - begin);
+	}
+
+out:
+	bbusd_free_service_map();
+}
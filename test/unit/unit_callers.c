@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-unit.h"
+#include "../../bin/bbusd/callers.h"
+#include <busybus.h>
+#include <string.h>
+
+/* Must match the call id layout in bin/bbusd/callers.c. */
+#define CALLID_IDXMASK		0xFFFFFU
+#define CALLER_TOKEN		1234
+
+/*
+ * Calls only compare the service client pointers, so these never need to
+ * point to real clients.
+ */
+static struct bbusd_clientlist_elem srvc1 = {
+	NULL, NULL, (bbus_client*)&srvc1 };
+static struct bbusd_clientlist_elem srvc2 = {
+	NULL, NULL, (bbus_client*)&srvc2 };
+
+static unsigned numfailed;
+
+static void count_failed(const struct bbusd_call* call BBUS_UNUSED)
+{
+	++numfailed;
+}
+
+static unsigned new_call(struct bbusd_clientlist_elem* srvc)
+{
+	struct bbus_msg_hdr hdr;
+
+	memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
+	return bbusd_new_call(CALLER_TOKEN, &hdr, srvc, 0);
+}
+
+BBUSUNIT_DEFINE_TEST(callers_take_once)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbusd_call call;
+		unsigned id;
+
+		bbusd_init_caller_map();
+
+		id = new_call(&srvc1);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, id);
+		BBUSUNIT_ASSERT_EQ(0, bbusd_take_call(id, NULL, &call));
+		BBUSUNIT_ASSERT_EQ(id, call.id);
+		BBUSUNIT_ASSERT_EQ(CALLER_TOKEN, call.caller);
+		BBUSUNIT_ASSERT_EQ(&srvc1, call.srvc);
+		BBUSUNIT_ASSERT_EQ(-1, bbusd_take_call(id, NULL, &call));
+
+	BBUSUNIT_FINALLY;
+
+		bbusd_clean_caller_map();
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(callers_stale_id)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbusd_call call;
+		unsigned oldid;
+		unsigned newid;
+
+		bbusd_init_caller_map();
+
+		oldid = new_call(&srvc1);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, oldid);
+		BBUSUNIT_ASSERT_EQ(0, bbusd_take_call(oldid, NULL, &call));
+
+		newid = new_call(&srvc1);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, newid);
+		BBUSUNIT_ASSERT_EQ(oldid & CALLID_IDXMASK,
+					newid & CALLID_IDXMASK);
+		BBUSUNIT_ASSERT_NOTEQ(oldid, newid);
+		BBUSUNIT_ASSERT_EQ(-1, bbusd_take_call(oldid, NULL, &call));
+		BBUSUNIT_ASSERT_EQ(0, bbusd_take_call(newid, NULL, &call));
+		BBUSUNIT_ASSERT_EQ(newid, call.id);
+
+	BBUSUNIT_FINALLY;
+
+		bbusd_clean_caller_map();
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(callers_take_wrong_srvc)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbusd_call call;
+		unsigned id;
+
+		bbusd_init_caller_map();
+
+		id = new_call(&srvc1);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, id);
+		BBUSUNIT_ASSERT_EQ(-1, bbusd_take_call(id, srvc2.cli, &call));
+		/* The call must still be there for the right service. */
+		BBUSUNIT_ASSERT_EQ(0, bbusd_take_call(id, srvc1.cli, &call));
+		BBUSUNIT_ASSERT_EQ(id, call.id);
+
+	BBUSUNIT_FINALLY;
+
+		bbusd_clean_caller_map();
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(callers_fail_srvc_calls)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbusd_call call;
+		unsigned id1a;
+		unsigned id1b;
+		unsigned id2;
+
+		bbusd_init_caller_map();
+
+		id1a = new_call(&srvc1);
+		id2 = new_call(&srvc2);
+		id1b = new_call(&srvc1);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, id1a);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, id2);
+		BBUSUNIT_ASSERT_NOTEQ(BBUSD_NOCALL, id1b);
+
+		numfailed = 0;
+		bbusd_fail_srvc_calls(&srvc1, count_failed);
+		BBUSUNIT_ASSERT_EQ(2, numfailed);
+		BBUSUNIT_ASSERT_EQ(-1, bbusd_take_call(id1a, NULL, &call));
+		BBUSUNIT_ASSERT_EQ(-1, bbusd_take_call(id1b, NULL, &call));
+		BBUSUNIT_ASSERT_EQ(0, bbusd_take_call(id2, NULL, &call));
+		BBUSUNIT_ASSERT_EQ(&srvc2, call.srvc);
+
+	BBUSUNIT_FINALLY;
+
+		bbusd_clean_caller_map();
+
+	BBUSUNIT_ENDTEST;
+}
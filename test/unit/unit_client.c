@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-unit.h"
+#include <busybus.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * The test plays the part of bbusd: it accepts the service connection,
+ * acknowledges the method registrations and sends the calls itself.
+ */
+
+#define SLOW_CALL	1
+#define FAST_CALL	2
+/* How long the slow method waits for the fast one, in milliseconds. */
+#define SLOW_MAXWAIT	5000
+
+static int fast_done;
+
+static bbus_object* fast_func(bbus_object* arg BBUS_UNUSED)
+{
+	BBUS_ATOMIC_SET(fast_done, 1);
+	return bbus_obj_build("u", FAST_CALL);
+}
+
+/* Can only return once the fast method has been called. */
+static bbus_object* slow_func(bbus_object* arg BBUS_UNUSED)
+{
+	unsigned i;
+
+	for (i = 0; i < SLOW_MAXWAIT && !BBUS_ATOMIC_GET(fast_done); ++i)
+		usleep(1000);
+
+	return bbus_obj_build("u", SLOW_CALL);
+}
+
+static struct bbus_method methods[] = {
+	{
+		.name = "slow",
+		.argdscr = "u",
+		.retdscr = "u",
+		.func = slow_func,
+	},
+	{
+		.name = "fast",
+		.argdscr = "u",
+		.retdscr = "u",
+		.func = fast_func,
+	},
+};
+
+struct service
+{
+	pthread_t thread;
+	bbus_service_connection* conn;
+	int ret;
+};
+
+static void* service_main(void* arg)
+{
+	struct service* srvc = arg;
+	unsigned i;
+
+	srvc->ret = -1;
+	srvc->conn = bbus_srvc_connect("unit");
+	if (srvc->conn == NULL)
+		return NULL;
+
+	for (i = 0; i < BBUS_ARRAY_SIZE(methods); ++i) {
+		if (bbus_srvc_regmethod(srvc->conn, &methods[i]) < 0)
+			return NULL;
+	}
+
+	srvc->ret = bbus_srvc_run(srvc->conn, 2);
+	return NULL;
+}
+
+static int send_call(bbus_client* cli, const char* method, uint32_t token)
+{
+	struct bbus_msg_hdr hdr;
+	bbus_object* arg;
+	int r;
+
+	arg = bbus_obj_build("u", token);
+	if (arg == NULL)
+		return -1;
+
+	bbus_hdr_build(&hdr, BBUS_MSGTYPE_SRVCALL, BBUS_PROT_EGOOD);
+	BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
+	BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+	bbus_hdr_setpsize(&hdr, strlen(method) + 1 + bbus_obj_rawsize(arg));
+	bbus_hdr_settoken(&hdr, token);
+	r = bbus_client_sendmsg(cli, &hdr, method, arg);
+	bbus_obj_free(arg);
+
+	return r;
+}
+
+/*
+ * Replies are sent as soon as each call is done, not in the order in
+ * which the calls came in.
+ */
+BBUSUNIT_DEFINE_TEST(srvc_run_reply_order)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned char buf[BBUS_MAXMSGSIZE];
+		struct bbus_msg* msg = (struct bbus_msg*)buf;
+		struct bbus_msg_hdr hdr;
+		struct service srvc;
+		char sockpath[64];
+		bbus_server* srv = NULL;
+		bbus_client* cli = NULL;
+		int started = 0;
+		unsigned i;
+		int r;
+
+		memset(&srvc, 0, sizeof(struct service));
+		snprintf(sockpath, sizeof(sockpath),
+				"/tmp/bbus-unit-%d.sock", (int)getpid());
+		(void)unlink(sockpath);
+		bbus_prot_setsockpath(sockpath);
+
+		srv = bbus_srv_create();
+		BBUSUNIT_ASSERT_NOTNULL(srv);
+		BBUSUNIT_ASSERT_EQ(0, bbus_srv_listen(srv));
+
+		r = pthread_create(&srvc.thread, NULL, service_main, &srvc);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		started = 1;
+
+		cli = bbus_srv_accept(srv, NULL);
+		BBUSUNIT_ASSERT_NOTNULL(cli);
+		for (i = 0; i < BBUS_ARRAY_SIZE(methods); ++i) {
+			r = bbus_client_rcvmsg(cli, msg, sizeof(buf));
+			BBUSUNIT_ASSERT_EQ(0, r);
+			BBUSUNIT_ASSERT_EQ(BBUS_MSGTYPE_SRVREG,
+						msg->hdr.msgtype);
+
+			bbus_hdr_build(&hdr, BBUS_MSGTYPE_SRVACK,
+						BBUS_PROT_EGOOD);
+			r = bbus_client_sendmsg(cli, &hdr, NULL, NULL);
+			BBUSUNIT_ASSERT_EQ(0, r);
+		}
+
+		BBUSUNIT_ASSERT_EQ(0, send_call(cli, "slow", SLOW_CALL));
+		BBUSUNIT_ASSERT_EQ(0, send_call(cli, "fast", FAST_CALL));
+
+		r = bbus_client_rcvmsg(cli, msg, sizeof(buf));
+		BBUSUNIT_ASSERT_EQ(0, r);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGTYPE_SRVREPLY, msg->hdr.msgtype);
+		BBUSUNIT_ASSERT_EQ(FAST_CALL, bbus_hdr_gettoken(&msg->hdr));
+
+		r = bbus_client_rcvmsg(cli, msg, sizeof(buf));
+		BBUSUNIT_ASSERT_EQ(0, r);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGTYPE_SRVREPLY, msg->hdr.msgtype);
+		BBUSUNIT_ASSERT_EQ(SLOW_CALL, bbus_hdr_gettoken(&msg->hdr));
+
+	BBUSUNIT_FINALLY;
+
+		if (started) {
+			if (srvc.conn != NULL)
+				bbus_srvc_stop(srvc.conn);
+			if (cli != NULL)
+				(void)bbus_client_shutdown(cli);
+			pthread_join(srvc.thread, NULL);
+		}
+		if (srvc.conn != NULL)
+			(void)bbus_srvc_closeconn(srvc.conn);
+		if (cli != NULL) {
+			(void)bbus_client_close(cli);
+			bbus_client_free(cli);
+		}
+		if (srv != NULL) {
+			(void)bbus_srv_close(srv);
+			bbus_srv_free(srv);
+		}
+		(void)unlink(sockpath);
+
+	BBUSUNIT_ENDTEST;
+}
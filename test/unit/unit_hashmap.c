@@ -197,3 +197,332 @@ BBUSUNIT_DEFINE_TEST(hashmap_reset)
 	BBUSUNIT_ENDTEST;
 }
 
+BBUSUNIT_DEFINE_TEST(hashmap_long_keys)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char short_key[] = "short";
+		static const char long_key[] =
+			"a key, that doesn't fit in the map entry itself";
+
+		bbus_hashmap* hmap;
+		int r;
+		long val1;
+		long val2;
+		void* found;
+
+		hmap = bbus_hmap_create(BBUS_HMAP_KEYSTR);
+		BBUSUNIT_ASSERT_NOTNULL(hmap);
+		val1 = 1;
+		val2 = 2;
+		r = bbus_hmap_setstr(hmap, short_key, &val1);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		r = bbus_hmap_setstr(hmap, long_key, &val2);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		found = bbus_hmap_findstr(hmap, short_key);
+		BBUSUNIT_ASSERT_EQ(&val1, found);
+		found = bbus_hmap_findstr(hmap, long_key);
+		BBUSUNIT_ASSERT_EQ(&val2, found);
+		found = bbus_hmap_rmstr(hmap, long_key);
+		BBUSUNIT_ASSERT_EQ(&val2, found);
+		found = bbus_hmap_findstr(hmap, long_key);
+		BBUSUNIT_ASSERT_NULL(found);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(hmap);
+
+	BBUSUNIT_ENDTEST;
+}
+
+static const enum bbus_hmap_impl hmap_impls[] = {
+	BBUS_HMAP_OPENADDR,
+	BBUS_HMAP_CHAINED,
+};
+
+BBUSUNIT_DEFINE_TEST(hashmap_impls_insert_remove)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_hashmap* hmap = NULL;
+		unsigned impl;
+		long i;
+		int r;
+		void* found;
+
+		for (impl = 0; impl < BBUS_ARRAY_SIZE(hmap_impls); ++impl) {
+			hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT,
+							hmap_impls[impl]);
+			BBUSUNIT_ASSERT_NOTNULL(hmap);
+
+			for (i = 0; i < 5000; ++i) {
+				r = bbus_hmap_setuint(hmap, i, (void*)(i + 1));
+				BBUSUNIT_ASSERT_EQ(0, r);
+			}
+			BBUSUNIT_ASSERT_EQ(5000, bbus_hmap_size(hmap));
+
+			for (i = 0; i < 5000; i += 2) {
+				found = bbus_hmap_rmuint(hmap, i);
+				BBUSUNIT_ASSERT_EQ(i + 1, (long)found);
+			}
+			BBUSUNIT_ASSERT_EQ(2500, bbus_hmap_size(hmap));
+
+			for (i = 0; i < 5000; ++i) {
+				found = bbus_hmap_finduint(hmap, i);
+				if (i % 2)
+					BBUSUNIT_ASSERT_EQ(i + 1, (long)found);
+				else
+					BBUSUNIT_ASSERT_NULL(found);
+			}
+
+			bbus_hmap_reset(hmap);
+			BBUSUNIT_ASSERT_EQ(0, bbus_hmap_size(hmap));
+			BBUSUNIT_ASSERT_NULL(bbus_hmap_finduint(hmap, 1));
+
+			bbus_hmap_free(hmap);
+			hmap = NULL;
+		}
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(hmap);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(hashmap_impls_prefix_keys)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char* keys[] = {
+			"echo",
+			"echo2",
+			"ech",
+			"a method name that is too long to be stored inline",
+			"a method name that is too long to be stored inline!",
+		};
+
+		bbus_hashmap* hmap = NULL;
+		unsigned impl;
+		unsigned i;
+		int r;
+
+		for (impl = 0; impl < BBUS_ARRAY_SIZE(hmap_impls); ++impl) {
+			hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYSTR,
+							hmap_impls[impl]);
+			BBUSUNIT_ASSERT_NOTNULL(hmap);
+
+			for (i = 0; i < BBUS_ARRAY_SIZE(keys); ++i) {
+				r = bbus_hmap_setstr(hmap, keys[i],
+							(void*)keys[i]);
+				BBUSUNIT_ASSERT_EQ(0, r);
+			}
+			BBUSUNIT_ASSERT_EQ(BBUS_ARRAY_SIZE(keys),
+						bbus_hmap_size(hmap));
+
+			for (i = 0; i < BBUS_ARRAY_SIZE(keys); ++i) {
+				BBUSUNIT_ASSERT_EQ(keys[i],
+					bbus_hmap_findstr(hmap, keys[i]));
+			}
+			BBUSUNIT_ASSERT_NULL(bbus_hmap_findstr(hmap, "ec"));
+
+			bbus_hmap_free(hmap);
+			hmap = NULL;
+		}
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(hmap);
+
+	BBUSUNIT_ENDTEST;
+}
+
+/*
+ * Value of 'key' after inserting all keys up to 'last', removing key
+ * i - 7 after inserting every key i divisible by three.
+ */
+static long resize_expected(long key, long last)
+{
+	if (key % 3 == 2 && key + 7 <= last)
+		return 0;
+
+	return key + 1;
+}
+
+/* Enough for the old tables to be big and given back to the kernel in steps. */
+#define RESIZE_NUMKEYS	20000
+/* Every key is looked up after every this many inserts. */
+#define RESIZE_CHECKALL	500
+
+BBUSUNIT_DEFINE_TEST(hashmap_impls_incremental_resize)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_hashmap* hmap = NULL;
+		unsigned impl;
+		long i;
+		long j;
+		int r;
+
+		for (impl = 0; impl < BBUS_ARRAY_SIZE(hmap_impls); ++impl) {
+			hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT,
+							hmap_impls[impl]);
+			BBUSUNIT_ASSERT_NOTNULL(hmap);
+
+			/*
+			 * Removals and lookups are interleaved with inserts,
+			 * so that they hit maps which are still being resized.
+			 */
+			for (i = 0; i < RESIZE_NUMKEYS; ++i) {
+				r = bbus_hmap_setuint(hmap, i, (void*)(i + 1));
+				BBUSUNIT_ASSERT_EQ(0, r);
+				if (i % 3 == 0 && i >= 7) {
+					BBUSUNIT_ASSERT_EQ(i - 6,
+						(long)bbus_hmap_rmuint(hmap,
+								i - 7));
+				}
+				BBUSUNIT_ASSERT_EQ(resize_expected(i / 2, i),
+					(long)bbus_hmap_finduint(hmap, i / 2));
+				if (i % RESIZE_CHECKALL != 0)
+					continue;
+
+				for (j = 0; j <= i; ++j) {
+					BBUSUNIT_ASSERT_EQ(
+						resize_expected(j, i),
+						(long)bbus_hmap_finduint(hmap,
+									j));
+				}
+			}
+
+			for (i = 0; i < RESIZE_NUMKEYS; ++i) {
+				BBUSUNIT_ASSERT_EQ(resize_expected(i,
+							RESIZE_NUMKEYS - 1),
+					(long)bbus_hmap_finduint(hmap, i));
+			}
+
+			bbus_hmap_free(hmap);
+			hmap = NULL;
+		}
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(hmap);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(hashmap_maxload)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_hashmap* oamap = NULL;
+		bbus_hashmap* chmap = NULL;
+		long i;
+		int r;
+
+		oamap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT,
+						BBUS_HMAP_OPENADDR);
+		BBUSUNIT_ASSERT_NOTNULL(oamap);
+		chmap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT,
+						BBUS_HMAP_CHAINED);
+		BBUSUNIT_ASSERT_NOTNULL(chmap);
+
+		/* Open addressing needs free slots, chaining doesn't. */
+		r = bbus_hmap_setmaxload(oamap, 100);
+		BBUSUNIT_ASSERT_EQ(-1, r);
+		BBUSUNIT_ASSERT_EQ(BBUS_EINVALARG, bbus_lasterror());
+		r = bbus_hmap_setmaxload(chmap, 5);
+		BBUSUNIT_ASSERT_EQ(-1, r);
+		BBUSUNIT_ASSERT_EQ(BBUS_EINVALARG, bbus_lasterror());
+
+		r = bbus_hmap_setmaxload(oamap, 95);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		r = bbus_hmap_setmaxload(chmap, 400);
+		BBUSUNIT_ASSERT_EQ(0, r);
+
+		for (i = 0; i < 1000; ++i) {
+			r = bbus_hmap_setuint(oamap, i, (void*)(i + 1));
+			BBUSUNIT_ASSERT_EQ(0, r);
+			r = bbus_hmap_setuint(chmap, i, (void*)(i + 1));
+			BBUSUNIT_ASSERT_EQ(0, r);
+		}
+		for (i = 0; i < 1000; ++i) {
+			BBUSUNIT_ASSERT_EQ(i + 1,
+				(long)bbus_hmap_finduint(oamap, i));
+			BBUSUNIT_ASSERT_EQ(i + 1,
+				(long)bbus_hmap_finduint(chmap, i));
+		}
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(oamap);
+		bbus_hmap_free(chmap);
+
+	BBUSUNIT_ENDTEST;
+}
+
+static uint32_t const_hash(const void* key BBUS_UNUSED,
+				size_t ksize BBUS_UNUSED)
+{
+	return 7;
+}
+
+BBUSUNIT_DEFINE_TEST(hashmap_impls_custom_hashfunc)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_hashmap* hmap = NULL;
+		unsigned impl;
+		long i;
+		int r;
+
+		for (impl = 0; impl < BBUS_ARRAY_SIZE(hmap_impls); ++impl) {
+			hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYUINT,
+							hmap_impls[impl]);
+			BBUSUNIT_ASSERT_NOTNULL(hmap);
+			r = bbus_hmap_sethashfunc(hmap, const_hash);
+			BBUSUNIT_ASSERT_EQ(0, r);
+
+			/* Every key collides with every other one. */
+			for (i = 0; i < 300; ++i) {
+				r = bbus_hmap_setuint(hmap, i, (void*)(i + 1));
+				BBUSUNIT_ASSERT_EQ(0, r);
+			}
+			for (i = 0; i < 300; i += 3)
+				bbus_hmap_rmuint(hmap, i);
+			for (i = 0; i < 300; ++i) {
+				BBUSUNIT_ASSERT_EQ(i % 3 ? i + 1 : 0,
+					(long)bbus_hmap_finduint(hmap, i));
+			}
+
+			r = bbus_hmap_sethashfunc(hmap, NULL);
+			BBUSUNIT_ASSERT_EQ(-1, r);
+			BBUSUNIT_ASSERT_EQ(BBUS_EINVALARG, bbus_lasterror());
+
+			bbus_hmap_free(hmap);
+			hmap = NULL;
+		}
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(hmap);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(hashmap_invalid_impl)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_hashmap* hmap;
+
+		hmap = bbus_hmap_create_impl(BBUS_HMAP_KEYSTR, 0);
+		BBUSUNIT_ASSERT_NULL(hmap);
+		BBUSUNIT_ASSERT_EQ(BBUS_EINVALARG, bbus_lasterror());
+
+	BBUSUNIT_FINALLY;
+
+		bbus_hmap_free(hmap);
+
+	BBUSUNIT_ENDTEST;
+}
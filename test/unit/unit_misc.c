@@ -13,11 +13,15 @@
  */
 
 #include "bbus-unit.h"
+#include "../../lib/crc32.h"
+#include "../../lib/stats.h"
+#include "../../lib/pool.h"
 #include <busybus.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 
 BBUSUNIT_DEFINE_TEST(crc32)
 {
@@ -42,6 +46,80 @@ BBUSUNIT_DEFINE_TEST(crc32_emptybuf)
 	BBUSUNIT_ENDTEST;
 }
 
+BBUSUNIT_DEFINE_TEST(crc32_variants)
+{
+	BBUSUNIT_BEGINTEST;
+
+		const struct __bbus_crc32_variant* vars;
+		unsigned char buf[1024 + 16];
+		unsigned numvars;
+		unsigned i;
+		size_t off;
+		size_t size;
+		uint32_t expected;
+		uint32_t crc;
+
+		for (i = 0; i < sizeof(buf); ++i)
+			buf[i] = (unsigned char)(i * 131 + (i >> 3));
+
+		numvars = __bbus_crc32_getvariants(&vars);
+		BBUSUNIT_ASSERT_TRUE(numvars >= 3);
+
+		/* Cover every tail length and misaligned starts. */
+		for (off = 0; off < 16; off += 5) {
+			for (size = 0; size <= 1024; size += 7) {
+				expected = vars[0].update(0xffffffff,
+							buf + off, size);
+				for (i = 1; i < numvars; ++i) {
+					crc = vars[i].update(0xffffffff,
+							buf + off, size);
+					BBUSUNIT_ASSERT_EQ(expected, crc);
+				}
+				BBUSUNIT_ASSERT_EQ(expected ^ 0xffffffff,
+					bbus_crc32(buf + off, size));
+			}
+		}
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(hash_str)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char data[] = "xbbus.bbusd.echo\0\0";
+		char buf[sizeof(data)];
+
+		/* The length of the key matters, not only its contents. */
+		BBUSUNIT_ASSERT_NOTEQ(bbus_hash_str(data + 1, 15),
+					bbus_hash_str(data + 1, 16));
+		BBUSUNIT_ASSERT_NOTEQ(bbus_hash_str(data + 1, 16),
+					bbus_hash_str(data + 1, 17));
+		/* Alignment doesn't. */
+		memcpy(buf, data + 1, 15);
+		BBUSUNIT_ASSERT_EQ(bbus_hash_str(data + 1, 15),
+					bbus_hash_str(buf, 15));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(hash_uint)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned key = 1;
+
+		BBUSUNIT_ASSERT_EQ(0x514E28B7U,
+				bbus_hash_uint(&key, sizeof(key)));
+		key = 0;
+		BBUSUNIT_ASSERT_EQ(0, bbus_hash_uint(&key, sizeof(key)));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
 BBUSUNIT_DEFINE_TEST(memdup)
 {
 	BBUSUNIT_BEGINTEST;
@@ -77,6 +155,16 @@ BBUSUNIT_DEFINE_TEST(error_strings)
 					bbus_strerror(BBUS_EMSGINVTYPRCVD));
 		BBUSUNIT_ASSERT_STREQ("error registering the method",
 					bbus_strerror(BBUS_EMREGERR));
+		BBUSUNIT_ASSERT_STREQ("outbound message queue full",
+					bbus_strerror(BBUS_EQUEUEFULL));
+		BBUSUNIT_ASSERT_STREQ("message too big",
+					bbus_strerror(BBUS_EMSGTOOBIG));
+		BBUSUNIT_ASSERT_STREQ("object is read-only",
+					bbus_strerror(BBUS_EOBJRDONLY));
+		BBUSUNIT_ASSERT_STREQ("method handle no longer valid",
+					bbus_strerror(BBUS_ESTALEHANDLE));
+		BBUSUNIT_ASSERT_STREQ("method call timed out",
+					bbus_strerror(BBUS_ETIMEDOUT));
 
 	BBUSUNIT_FINALLY;
 	BBUSUNIT_ENDTEST;
@@ -119,6 +207,289 @@ BBUSUNIT_DEFINE_TEST(malloc0)
 	BBUSUNIT_ENDTEST;
 }
 
+BBUSUNIT_DEFINE_TEST(memstats_count)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbus_memstats before;
+		struct bbus_memstats after;
+		void* p;
+
+		bbus_memstats_get(&before);
+		p = bbus_malloc(16);
+		BBUSUNIT_ASSERT_NOTNULL(p);
+		p = bbus_realloc(p, 32);
+		BBUSUNIT_ASSERT_NOTNULL(p);
+		bbus_free(p);
+		bbus_free(NULL);
+		bbus_memstats_get(&after);
+
+		BBUSUNIT_ASSERT_EQ(2, after.allocs - before.allocs);
+		BBUSUNIT_ASSERT_EQ(1, after.frees - before.frees);
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+static void* alloc_and_free(void* arg BBUS_UNUSED)
+{
+	bbus_free(bbus_malloc(16));
+	return NULL;
+}
+
+BBUSUNIT_DEFINE_TEST(memstats_threads)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbus_memstats stats;
+		pthread_t thread;
+		int r;
+
+		bbus_memstats_reset();
+		r = pthread_create(&thread, NULL, alloc_and_free, NULL);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		r = pthread_join(thread, NULL);
+		BBUSUNIT_ASSERT_EQ(0, r);
+
+		bbus_memstats_get(&stats);
+		BBUSUNIT_ASSERT_EQ(1, stats.allocs);
+		BBUSUNIT_ASSERT_EQ(1, stats.frees);
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+static void* count_sent(void* arg BBUS_UNUSED)
+{
+	__BBUS_STATS_ADD(sndmsgs, 3);
+	return NULL;
+}
+
+/*
+ * Statistics are counted per thread - counts of threads, that already
+ * exited must not get lost.
+ */
+BBUSUNIT_DEFINE_TEST(iostats_threads)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbus_iostats stats;
+		pthread_t thread;
+		int r;
+
+		bbus_iostats_reset();
+		r = pthread_create(&thread, NULL, count_sent, NULL);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		r = pthread_join(thread, NULL);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		__BBUS_STATS_ADD(sndmsgs, 2);
+
+		bbus_iostats_get(&stats);
+		BBUSUNIT_ASSERT_EQ(5, stats.sndmsgs);
+		BBUSUNIT_ASSERT_EQ(0, stats.rcvmsgs);
+
+		bbus_iostats_reset();
+		bbus_iostats_get(&stats);
+		BBUSUNIT_ASSERT_EQ(0, stats.sndmsgs);
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(arena_alloc)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_arena* arena;
+		char* p[100];
+		unsigned i;
+
+		arena = bbus_arena_create(256);
+		BBUSUNIT_ASSERT_NOTNULL(arena);
+
+		/* Spans several chunks. */
+		for (i = 0; i < BBUS_ARRAY_SIZE(p); ++i) {
+			p[i] = bbus_arena_alloc(arena, 13);
+			BBUSUNIT_ASSERT_NOTNULL(p[i]);
+			BBUSUNIT_ASSERT_EQ(0, (unsigned long)p[i]
+						% (2 * sizeof(void*)));
+			memset(p[i], i, 13);
+		}
+
+		for (i = 0; i < BBUS_ARRAY_SIZE(p); ++i)
+			BBUSUNIT_ASSERT_EQ((char)i, p[i][12]);
+
+		/* Bigger than a chunk. */
+		p[0] = bbus_arena_alloc(arena, 1000);
+		BBUSUNIT_ASSERT_NOTNULL(p[0]);
+		memset(p[0], 0, 1000);
+
+		p[1] = bbus_arena_memdup(arena, "arena", sizeof("arena"));
+		BBUSUNIT_ASSERT_STREQ("arena", p[1]);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_arena_free(arena);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(arena_reset)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbus_memstats before;
+		struct bbus_memstats after;
+		bbus_arena* arena;
+		void* first;
+		void* p;
+		unsigned i;
+
+		arena = bbus_arena_create(256);
+		BBUSUNIT_ASSERT_NOTNULL(arena);
+		first = bbus_arena_alloc(arena, 8);
+		for (i = 0; i < 10; ++i)
+			(void)bbus_arena_alloc(arena, 100);
+
+		bbus_memstats_get(&before);
+		bbus_arena_reset(arena);
+		bbus_memstats_get(&after);
+		BBUSUNIT_ASSERT_TRUE(after.frees > before.frees);
+
+		/* The first chunk is reused without touching the heap. */
+		bbus_memstats_get(&before);
+		p = bbus_arena_alloc(arena, 8);
+		bbus_memstats_get(&after);
+		BBUSUNIT_ASSERT_EQ(first, p);
+		BBUSUNIT_ASSERT_EQ(before.allocs, after.allocs);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_arena_free(arena);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(pool_recycle)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbus_poolstats stats;
+		bbus_pool* pool;
+		void* first;
+		void* p;
+
+		pool = bbus_pool_create(40);
+		BBUSUNIT_ASSERT_NOTNULL(pool);
+
+		first = bbus_pool_alloc(pool);
+		BBUSUNIT_ASSERT_NOTNULL(first);
+		bbus_pool_free(pool, first);
+
+		/* Freed objects are reused first. */
+		p = bbus_pool_alloc(pool);
+		BBUSUNIT_ASSERT_EQ(first, p);
+
+		bbus_pool_getstats(pool, &stats);
+		BBUSUNIT_ASSERT_EQ(2, stats.allocs);
+		BBUSUNIT_ASSERT_EQ(1, stats.frees);
+		BBUSUNIT_ASSERT_EQ(1, stats.inuse);
+		BBUSUNIT_ASSERT_EQ(1, stats.slabs);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_pool_destroy(pool);
+
+	BBUSUNIT_ENDTEST;
+}
+
+#define CAPPED_MAXCACHED	2
+#define CAPPED_NUMOBJS		5
+
+/*
+ * Free objects over the limit go back to the heap, the ones under it are
+ * kept. The static pool can't be destroyed, the cached objects are leaked.
+ */
+BBUSUNIT_DEFINE_TEST(pool_capped)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static bbus_pool pool = __BBUS_POOL_CAPPED_INITIALIZER(
+						4096, CAPPED_MAXCACHED);
+		struct bbus_poolstats stats;
+		void* objs[CAPPED_NUMOBJS];
+		unsigned i;
+
+		for (i = 0; i < CAPPED_NUMOBJS; ++i) {
+			objs[i] = bbus_pool_alloc(&pool);
+			BBUSUNIT_ASSERT_NOTNULL(objs[i]);
+		}
+
+		bbus_pool_getstats(&pool, &stats);
+		BBUSUNIT_ASSERT_EQ(CAPPED_NUMOBJS, stats.slabs);
+
+		for (i = 0; i < CAPPED_NUMOBJS; ++i)
+			bbus_pool_free(&pool, objs[i]);
+
+		bbus_pool_getstats(&pool, &stats);
+		BBUSUNIT_ASSERT_EQ(0, stats.inuse);
+		BBUSUNIT_ASSERT_EQ(CAPPED_MAXCACHED, stats.cached);
+		BBUSUNIT_ASSERT_EQ(CAPPED_MAXCACHED, stats.slabs);
+
+		/* The cached objects are still reused. */
+		objs[0] = bbus_pool_alloc(&pool);
+		BBUSUNIT_ASSERT_EQ(objs[1], objs[0]);
+		bbus_pool_free(&pool, objs[0]);
+
+		bbus_pool_getstats(&pool, &stats);
+		BBUSUNIT_ASSERT_EQ(CAPPED_MAXCACHED, stats.slabs);
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(pool_many_objects)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbus_poolstats stats;
+		bbus_pool* pool;
+		char* p[500];
+		unsigned i;
+
+		pool = bbus_pool_create(24);
+		BBUSUNIT_ASSERT_NOTNULL(pool);
+
+		for (i = 0; i < BBUS_ARRAY_SIZE(p); ++i) {
+			p[i] = bbus_pool_alloc0(pool);
+			BBUSUNIT_ASSERT_NOTNULL(p[i]);
+			BBUSUNIT_ASSERT_EQ(0, p[i][23]);
+			BBUSUNIT_ASSERT_EQ(0, (unsigned long)p[i]
+						% (2 * sizeof(void*)));
+			memset(p[i], i, 24);
+		}
+
+		for (i = 0; i < BBUS_ARRAY_SIZE(p); ++i)
+			BBUSUNIT_ASSERT_EQ((char)i, p[i][0]);
+
+		bbus_pool_getstats(pool, &stats);
+		BBUSUNIT_ASSERT_TRUE(stats.slabs > 1);
+		BBUSUNIT_ASSERT_EQ(BBUS_ARRAY_SIZE(p), stats.inuse);
+
+		for (i = 0; i < BBUS_ARRAY_SIZE(p); ++i)
+			bbus_pool_free(pool, p[i]);
+
+		bbus_pool_getstats(pool, &stats);
+		BBUSUNIT_ASSERT_EQ(0, stats.inuse);
+		BBUSUNIT_ASSERT_TRUE(stats.cached >= BBUS_ARRAY_SIZE(p));
+
+	BBUSUNIT_FINALLY;
+
+		bbus_pool_destroy(pool);
+
+	BBUSUNIT_ENDTEST;
+}
+
 BBUSUNIT_DEFINE_TEST(build_basic_string)
 {
 	BBUSUNIT_BEGINTEST;
@@ -96,6 +96,113 @@ BBUSUNIT_DEFINE_TEST(object_frombuf)
 	BBUSUNIT_ENDTEST;
 }
 
+BBUSUNIT_DEFINE_TEST(object_view)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char propbuf[] =
+					"\x11\x22\x33\x44"
+					"string\0";
+
+		static const size_t propsize = sizeof(propbuf)-1;
+
+		bbus_object* obj;
+		unsigned u;
+		char* s;
+		int ret;
+
+		obj = bbus_obj_mkview(propbuf, propsize);
+		BBUSUNIT_ASSERT_NOTNULL(obj);
+		BBUSUNIT_ASSERT_TRUE(bbus_obj_isview(obj));
+		BBUSUNIT_ASSERT_EQ(propbuf, bbus_obj_rawdata(obj));
+		BBUSUNIT_ASSERT_EQ(propsize, bbus_obj_rawsize(obj));
+
+		ret = bbus_obj_parse(obj, "us", &u, &s);
+		BBUSUNIT_ASSERT_EQ(0, ret);
+		BBUSUNIT_ASSERT_EQ(0x11223344, u);
+		BBUSUNIT_ASSERT_STREQ("string", s);
+		BBUSUNIT_ASSERT_EQ(propbuf + 4, s);
+
+		ret = bbus_obj_insuint(obj, 1);
+		BBUSUNIT_ASSERT_EQ(-1, ret);
+		BBUSUNIT_ASSERT_EQ(BBUS_EOBJRDONLY, bbus_lasterror());
+
+		/* Retargeting rewinds the view. */
+		bbus_obj_setview(obj, propbuf + 4, propsize - 4);
+		ret = bbus_obj_extrstr(obj, &s);
+		BBUSUNIT_ASSERT_EQ(0, ret);
+		BBUSUNIT_ASSERT_STREQ("string", s);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_obj_free(obj);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(object_setview_frees_owned_data)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char propbuf[] = "\x11\x22\x33\x44";
+
+		bbus_object* obj;
+		unsigned u;
+		int ret;
+
+		obj = bbus_obj_build("u", 5);
+		BBUSUNIT_ASSERT_NOTNULL(obj);
+		BBUSUNIT_ASSERT_FALSE(bbus_obj_isview(obj));
+
+		bbus_obj_setview(obj, propbuf, sizeof(propbuf)-1);
+		BBUSUNIT_ASSERT_TRUE(bbus_obj_isview(obj));
+		ret = bbus_obj_extruint(obj, &u);
+		BBUSUNIT_ASSERT_EQ(0, ret);
+		BBUSUNIT_ASSERT_EQ(0x11223344, u);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_obj_free(obj);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(object_arena_build)
+{
+	BBUSUNIT_BEGINTEST;
+
+		bbus_arena* arena;
+		bbus_object* obj;
+		unsigned u;
+		char* s;
+		int ret;
+
+		arena = bbus_arena_create(BBUS_ARENA_DEFCHUNKSIZE);
+		BBUSUNIT_ASSERT_NOTNULL(arena);
+
+		/* Big enough to have the buffer grow a couple of times. */
+		obj = bbus_obj_arena_build(arena, "us", 1234,
+			"a string, that doesn't fit in the initial buffer of "
+			"the object and needs to be moved around the arena");
+		BBUSUNIT_ASSERT_NOTNULL(obj);
+
+		ret = bbus_obj_parse(obj, "us", &u, &s);
+		BBUSUNIT_ASSERT_EQ(0, ret);
+		BBUSUNIT_ASSERT_EQ(1234, u);
+		BBUSUNIT_ASSERT_STREQ("a string, that doesn't fit in the "
+			"initial buffer of the object and needs to be moved "
+			"around the arena", s);
+
+		/* Does nothing - the memory belongs to the arena. */
+		bbus_obj_free(obj);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_arena_free(arena);
+
+	BBUSUNIT_ENDTEST;
+}
+
 BBUSUNIT_DEFINE_TEST(object_basic_extract)
 {
 	BBUSUNIT_BEGINTEST;
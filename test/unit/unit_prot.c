@@ -13,9 +13,12 @@
  */
 
 #include "bbus-unit.h"
+#include "../../lib/protocol.h"
 #include <busybus.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #define MKMSG(MSG, MSGTYPE, SOTYPE, ERR, TOKEN, PSIZE, FLAGS, PLOAD)	\
 	do {								\
@@ -117,6 +120,34 @@ BBUSUNIT_DEFINE_TEST(prot_extract_meta_and_obj)
 	BBUSUNIT_ENDTEST;
 }
 
+BBUSUNIT_DEFINE_TEST(prot_raw_obj)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char payload[] =	"meta string\0"
+						"\x11\x22\x33\x44";
+		static const size_t payloadsize = sizeof(payload)-1;
+
+		char msgbuf[BBUS_MSGHDR_SIZE + payloadsize];
+		struct bbus_msg* msg = (struct bbus_msg*)msgbuf;
+		const void* raw;
+		size_t size = 0;
+
+		MKMSG(msg, BBUS_MSGTYPE_SO, BBUS_SOTYPE_NONE,
+			BBUS_PROT_EGOOD, 0, payloadsize,
+			BBUS_PROT_HASMETA | BBUS_PROT_HASOBJECT, payload);
+
+		raw = bbus_prot_rawobj(msg, &size);
+		BBUSUNIT_ASSERT_EQ(msg->payload + sizeof("meta string"), raw);
+		BBUSUNIT_ASSERT_EQ(sizeof(bbus_uint32), size);
+
+		msg->hdr.flags = BBUS_PROT_HASMETA;
+		BBUSUNIT_ASSERT_NULL(bbus_prot_rawobj(msg, &size));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
 BBUSUNIT_DEFINE_TEST(prot_extract_invalid_meta)
 {
 	BBUSUNIT_BEGINTEST;
@@ -199,15 +230,570 @@ BBUSUNIT_DEFINE_TEST(prot_set_psize_gtmax)
 {
 	BBUSUNIT_BEGINTEST;
 
-		static const size_t size = 2 * UINT16_MAX;
+		static const uint64_t size = 2 * (uint64_t)UINT32_MAX;
 
 		struct bbus_msg_hdr hdr;
 
 		memset(&hdr, 0, sizeof(struct bbus_msg_hdr));
-		bbus_hdr_setpsize(&hdr, size);
-		BBUSUNIT_ASSERT_EQ(UINT16_MAX, bbus_hdr_getpsize(&hdr));
+		bbus_hdr_setpsize(&hdr, (size_t)size);
+		BBUSUNIT_ASSERT_EQ(sizeof(size_t) > sizeof(uint32_t)
+					? UINT32_MAX : (size_t)size,
+					bbus_hdr_getpsize(&hdr));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_hdr_encode_decode)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg_hdr decoded;
+		size_t hdrsize;
+
+		memset(&hdr, 0, sizeof(hdr));
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_SRVREPLY, BBUS_PROT_EMETHODERR);
+		hdr.sotype = BBUS_SOTYPE_SRVPRV;
+		bbus_hdr_settoken(&hdr, 0xDEADBEEF);
+		bbus_hdr_setpsize(&hdr, 1234);
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE, hdrsize);
+		BBUSUNIT_ASSERT_EQ(hdrsize, __bbus_prot_wirehdrsize(wirehdr));
+		BBUSUNIT_ASSERT_EQ(0, memcmp(wirehdr, BBUS_MAGIC,
+							BBUS_MAGIC_SIZE));
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGTYPE_SRVREPLY,
+				wirehdr[__BBUS_PROT_WIREOFF_MSGTYPE]);
+		BBUSUNIT_ASSERT_EQ(BBUS_SOTYPE_SRVPRV,
+				wirehdr[__BBUS_PROT_WIREOFF_SOTYPE]);
+		BBUSUNIT_ASSERT_EQ(BBUS_PROT_EMETHODERR,
+				wirehdr[__BBUS_PROT_WIREOFF_ERRCODE]);
+		BBUSUNIT_ASSERT_EQ(BBUS_PROT_HASOBJECT,
+				wirehdr[__BBUS_PROT_WIREOFF_FLAGS]);
+
+		__bbus_prot_hdrdecode(&decoded, wirehdr);
+		BBUSUNIT_ASSERT_EQ(0, memcmp(&hdr, &decoded, sizeof(hdr)));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_hdr_encode_extlen)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg_hdr decoded;
+		size_t hdrsize;
+
+		memset(&hdr, 0, sizeof(hdr));
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, 3 * UINT16_MAX);
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
+
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE + sizeof(uint32_t),
+								hdrsize);
+		BBUSUNIT_ASSERT_EQ(hdrsize, __bbus_prot_wirehdrsize(wirehdr));
+		BBUSUNIT_ASSERT_EQ(BBUS_PROT_HASMETA | BBUS_PROT_EXTLEN,
+					wirehdr[__BBUS_PROT_WIREOFF_FLAGS]);
+
+		__bbus_prot_hdrdecode(&decoded, wirehdr);
+		BBUSUNIT_ASSERT_EQ(3 * UINT16_MAX, bbus_hdr_getpsize(&decoded));
+		BBUSUNIT_ASSERT_TRUE(BBUS_HDR_ISFLAGSET(&decoded,
+						BBUS_PROT_HASMETA));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_hdr_encode_callid)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg_hdr decoded;
+		size_t hdrsize;
+
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLIREPLY, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, 100);
+		bbus_hdr_setcallid(&hdr, 0xCAFEBABE);
+		BBUSUNIT_ASSERT_TRUE(BBUS_HDR_ISFLAGSET(&hdr,
+						BBUS_PROT_HASCALLID));
+
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE + sizeof(uint32_t),
+								hdrsize);
+		BBUSUNIT_ASSERT_EQ(hdrsize, __bbus_prot_wirehdrsize(wirehdr));
+		__bbus_prot_hdrdecode(&decoded, wirehdr);
+		BBUSUNIT_ASSERT_EQ(0xCAFEBABE, bbus_hdr_getcallid(&decoded));
+		BBUSUNIT_ASSERT_EQ(100, bbus_hdr_getpsize(&decoded));
+
+		/* The call id follows the extended payload size. */
+		bbus_hdr_setpsize(&hdr, 3 * UINT16_MAX);
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE + 2*sizeof(uint32_t),
+								hdrsize);
+		BBUSUNIT_ASSERT_EQ(hdrsize, __bbus_prot_wirehdrsize(wirehdr));
+		BBUSUNIT_ASSERT_EQ(BBUS_PROT_HASCALLID | BBUS_PROT_EXTLEN,
+					wirehdr[__BBUS_PROT_WIREOFF_FLAGS]);
+		__bbus_prot_hdrdecode(&decoded, wirehdr);
+		BBUSUNIT_ASSERT_EQ(0xCAFEBABE, bbus_hdr_getcallid(&decoded));
+		BBUSUNIT_ASSERT_EQ(3 * UINT16_MAX, bbus_hdr_getpsize(&decoded));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_hdr_encode_timeout)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg_hdr decoded;
+		size_t hdrsize;
+
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, 100);
+		bbus_hdr_settimeout(&hdr, 2500);
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE + sizeof(uint32_t),
+								hdrsize);
+		BBUSUNIT_ASSERT_EQ(hdrsize, __bbus_prot_wirehdrsize(wirehdr));
+		__bbus_prot_hdrdecode(&decoded, wirehdr);
+		BBUSUNIT_ASSERT_EQ(2500, bbus_hdr_gettimeout(&decoded));
+		BBUSUNIT_ASSERT_FALSE(BBUS_HDR_ISFLAGSET(&decoded,
+						BBUS_PROT_HASCALLID));
+
+		/* All extensions present at once. */
+		bbus_hdr_setpsize(&hdr, 3 * UINT16_MAX);
+		bbus_hdr_setcallid(&hdr, 77);
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ(__BBUS_PROT_MAXWIREHDR, hdrsize);
+		BBUSUNIT_ASSERT_EQ(hdrsize, __bbus_prot_wirehdrsize(wirehdr));
+		__bbus_prot_hdrdecode(&decoded, wirehdr);
+		BBUSUNIT_ASSERT_EQ(3 * UINT16_MAX, bbus_hdr_getpsize(&decoded));
+		BBUSUNIT_ASSERT_EQ(77, bbus_hdr_getcallid(&decoded));
+		BBUSUNIT_ASSERT_EQ(2500, bbus_hdr_gettimeout(&decoded));
+
+	BBUSUNIT_FINALLY;
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_maxpload_clamp)
+{
+	BBUSUNIT_BEGINTEST;
+
+		size_t saved;
+
+		saved = bbus_prot_getmaxpload();
+
+		bbus_prot_setmaxpload(0);
+		BBUSUNIT_ASSERT_EQ(BBUS_MAXPLOADSIZE, bbus_prot_getmaxpload());
+		bbus_prot_setmaxpload(BBUS_MAXPLOADSIZE * 2);
+		BBUSUNIT_ASSERT_EQ(BBUS_MAXPLOADSIZE * 2,
+					bbus_prot_getmaxpload());
+
+	BBUSUNIT_FINALLY;
+
+		bbus_prot_setmaxpload(saved);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_tryrecv_byte_by_byte)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char meta[] = "bbus.echod.echo";
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg_hdr hdr;
+		char raw[BBUS_MAXMSGSIZE];
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		int wire[2] = { -1, -1 };
+		int feed[2] = { -1, -1 };
+		ssize_t rawsize;
+		ssize_t i;
+		int r;
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, wire));
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, feed));
+
+		/* Serialize the message by sending it through a socketpair. */
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_settoken(&hdr, 1234);
+		bbus_hdr_setpsize(&hdr, sizeof(meta));
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
+		r = __bbus_prot_sendvmsg(wire[0], &hdr, meta, NULL, 0);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		rawsize = read(wire[1], raw, sizeof(raw));
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE + sizeof(meta),
+							(size_t)rawsize);
+
+		/* Feed it to the receiver one byte at a time. */
+		for (i = 0; i < rawsize; ++i) {
+			BBUSUNIT_ASSERT_EQ(1, write(feed[0], raw + i, 1));
+			r = __bbus_prot_tryrecvmsg(feed[1], &ctx,
+						&msg, &msgsize);
+			BBUSUNIT_ASSERT_EQ(i == rawsize - 1 ? 1 : 0, r);
+		}
+
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGTYPE_CLICALL, msg->hdr.msgtype);
+		BBUSUNIT_ASSERT_EQ(1234, bbus_hdr_gettoken(&msg->hdr));
+		BBUSUNIT_ASSERT_STREQ(meta, bbus_prot_extractmeta(msg));
+
+		/* Nothing more to read. */
+		r = __bbus_prot_tryrecvmsg(feed[1], &ctx, &msg, &msgsize);
+		BBUSUNIT_ASSERT_EQ(0, r);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(wire[0]);
+		close(wire[1]);
+		close(feed[0]);
+		close(feed[1]);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_tryrecv_batch)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char meta[] = "bbus.echod.echo";
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg_hdr hdr;
+		struct bbus_iostats before;
+		struct bbus_iostats after;
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		int sock[2] = { -1, -1 };
+		unsigned i;
+		int r;
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, sock));
+
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, sizeof(meta));
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASMETA);
+		for (i = 0; i < 3; ++i) {
+			bbus_hdr_settoken(&hdr, i);
+			r = __bbus_prot_sendvmsg(sock[0], &hdr, meta, NULL, 0);
+			BBUSUNIT_ASSERT_EQ(0, r);
+		}
+
+		/* All three messages should be picked up by a single read. */
+		bbus_iostats_get(&before);
+		for (i = 0; i < 3; ++i) {
+			r = __bbus_prot_tryrecvmsg(sock[1], &ctx,
+						&msg, &msgsize);
+			BBUSUNIT_ASSERT_EQ(1, r);
+			BBUSUNIT_ASSERT_EQ(i, bbus_hdr_gettoken(&msg->hdr));
+			BBUSUNIT_ASSERT_STREQ(meta,
+					bbus_prot_extractmeta(msg));
+			BBUSUNIT_ASSERT_EQ(i < 2 ? BBUS_TRUE : BBUS_FALSE,
+					__bbus_prot_rcvpending(&ctx));
+		}
+
+		/* The socket is known to be empty - no read attempt. */
+		r = __bbus_prot_tryrecvmsg(sock[1], &ctx, &msg, &msgsize);
+		BBUSUNIT_ASSERT_EQ(0, r);
+		bbus_iostats_get(&after);
+		BBUSUNIT_ASSERT_EQ(1, after.rcvcalls - before.rcvcalls);
+		BBUSUNIT_ASSERT_EQ(3, after.rcvmsgs - before.rcvmsgs);
+
+	BBUSUNIT_FINALLY;
+
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(sock[0]);
+		close(sock[1]);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_sendbatch)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const char obj[] = "\x00\x00\x00\x2a";
+		unsigned char wirehdrs[3][__BBUS_PROT_MAXWIREHDR];
+		struct iovec iov[3 * __BBUS_PROT_MAXNUMIOV];
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg_hdr hdr;
+		struct bbus_iostats before;
+		struct bbus_iostats after;
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		size_t size = 0;
+		int sock[2] = { -1, -1 };
+		int numiov = 0;
+		ssize_t r;
+		unsigned i;
+		int n;
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, sock));
+
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_SRVREPLY, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, sizeof(obj) - 1);
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+		for (i = 0; i < 3; ++i) {
+			bbus_hdr_settoken(&hdr, i);
+			r = __bbus_prot_mkiov(&hdr, wirehdrs[i], NULL, obj,
+					sizeof(obj) - 1, iov + numiov, &n);
+			BBUSUNIT_ASSERT_TRUE(r > 0);
+			numiov += n;
+			size += r;
+		}
+
+		/* All three messages should go out with a single send. */
+		bbus_iostats_get(&before);
+		BBUSUNIT_ASSERT_EQ(0, __bbus_prot_sendbatch(sock[0], iov,
+							numiov, size, 3));
+		bbus_iostats_get(&after);
+		BBUSUNIT_ASSERT_EQ(1, after.sndcalls - before.sndcalls);
+		BBUSUNIT_ASSERT_EQ(3, after.sndmsgs - before.sndmsgs);
+
+		for (i = 0; i < 3; ++i) {
+			r = __bbus_prot_tryrecvmsg(sock[1], &ctx,
+						&msg, &msgsize);
+			BBUSUNIT_ASSERT_EQ(1, r);
+			BBUSUNIT_ASSERT_EQ(i, bbus_hdr_gettoken(&msg->hdr));
+			BBUSUNIT_ASSERT_EQ(sizeof(obj) - 1,
+					bbus_hdr_getpsize(&msg->hdr));
+			BBUSUNIT_ASSERT_EQ(0, memcmp(msg->payload, obj,
+							sizeof(obj) - 1));
+		}
 
 	BBUSUNIT_FINALLY;
+
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(sock[0]);
+		close(sock[1]);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_tryrecv_conn_closed)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		int sock[2] = { -1, -1 };
+		int r;
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, sock));
+		close(sock[0]);
+		sock[0] = -1;
+
+		r = __bbus_prot_tryrecvmsg(sock[1], &ctx, &msg, &msgsize);
+		BBUSUNIT_ASSERT_EQ(-1, r);
+		BBUSUNIT_ASSERT_EQ(BBUS_ECONNCLOSED, bbus_lasterror());
+
+	BBUSUNIT_FINALLY;
+
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(sock[1]);
+
 	BBUSUNIT_ENDTEST;
 }
 
+/*
+ * Writes the message in chunks and tries to receive it after each one.
+ * Returns the last result of __bbus_prot_tryrecvmsg().
+ */
+static int feed_chunks(int wr, int rd, struct __bbus_prot_rcvctx* ctx,
+			const char* raw, size_t rawsize,
+			struct bbus_msg** msg, size_t* msgsize)
+{
+	static const size_t chunk = 4096;
+
+	size_t off;
+	size_t len;
+	int r = 0;
+	int i;
+
+	for (off = 0; off < rawsize; off += len) {
+		len = rawsize - off < chunk ? rawsize - off : chunk;
+		if (write(wr, raw + off, len) != (ssize_t)len)
+			return -1;
+
+		r = __bbus_prot_tryrecvmsg(rd, ctx, msg, msgsize);
+		if (r != 0)
+			return r;
+	}
+
+	/* The last read might have been skipped. */
+	for (i = 0; i < 2 && r == 0; ++i)
+		r = __bbus_prot_tryrecvmsg(rd, ctx, msg, msgsize);
+
+	return r;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_tryrecv_large_msg)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const size_t psize = 150000;
+
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		char* raw = NULL;
+		size_t hdrsize;
+		int sock[2] = { -1, -1 };
+		size_t i;
+		int r;
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, sock));
+
+		raw = bbus_malloc(__BBUS_PROT_MAXWIREHDR + psize);
+		BBUSUNIT_ASSERT_NOTNULL(raw);
+
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_settoken(&hdr, 4321);
+		bbus_hdr_setpsize(&hdr, psize);
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+		hdrsize = __bbus_prot_hdrencode(&hdr, (unsigned char*)raw);
+		BBUSUNIT_ASSERT_EQ(BBUS_MSGHDR_REALSIZE + sizeof(uint32_t),
+								hdrsize);
+		for (i = 0; i < psize; ++i)
+			raw[hdrsize + i] = (char)(i % 251);
+
+		r = feed_chunks(sock[0], sock[1], &ctx, raw,
+					hdrsize + psize, &msg, &msgsize);
+		BBUSUNIT_ASSERT_EQ(1, r);
+		BBUSUNIT_ASSERT_TRUE(msgsize >= BBUS_MSGHDR_SIZE + psize);
+		BBUSUNIT_ASSERT_EQ(4321, bbus_hdr_gettoken(&msg->hdr));
+		BBUSUNIT_ASSERT_EQ(psize, bbus_hdr_getpsize(&msg->hdr));
+		BBUSUNIT_ASSERT_EQ(0, memcmp(msg->payload,
+						raw + hdrsize, psize));
+
+	BBUSUNIT_FINALLY;
+
+		bbus_free(raw);
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(sock[0]);
+		close(sock[1]);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_tryrecv_large_msg_at_once)
+{
+	BBUSUNIT_BEGINTEST;
+
+		static const size_t psize = 100000;
+
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		char* obj = NULL;
+		int sock[2] = { -1, -1 };
+		size_t i;
+		int r;
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, sock));
+
+		obj = bbus_malloc(psize);
+		BBUSUNIT_ASSERT_NOTNULL(obj);
+		for (i = 0; i < psize; ++i)
+			obj[i] = (char)(i % 251);
+
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, psize);
+		BBUS_HDR_SETFLAG(&hdr, BBUS_PROT_HASOBJECT);
+		r = __bbus_prot_sendvmsg(sock[0], &hdr, NULL, obj, psize);
+		BBUSUNIT_ASSERT_EQ(0, r);
+
+		/*
+		 * The whole message is in the socket, it must be received
+		 * without waiting for readability in between.
+		 */
+		r = __bbus_prot_tryrecvmsg(sock[1], &ctx, &msg, &msgsize);
+		BBUSUNIT_ASSERT_EQ(1, r);
+		BBUSUNIT_ASSERT_EQ(psize, bbus_hdr_getpsize(&msg->hdr));
+		BBUSUNIT_ASSERT_EQ(0, memcmp(msg->payload, obj, psize));
+
+	BBUSUNIT_FINALLY;
+
+		bbus_free(obj);
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(sock[0]);
+		close(sock[1]);
+
+	BBUSUNIT_ENDTEST;
+}
+
+BBUSUNIT_DEFINE_TEST(prot_tryrecv_msg_too_big)
+{
+	BBUSUNIT_BEGINTEST;
+
+		unsigned char wirehdr[__BBUS_PROT_MAXWIREHDR];
+		struct __bbus_prot_rcvctx ctx;
+		struct bbus_msg_hdr hdr;
+		struct bbus_msg* msg = NULL;
+		size_t msgsize = 0;
+		size_t saved;
+		size_t hdrsize;
+		int sock[2] = { -1, -1 };
+		int r;
+
+		saved = bbus_prot_getmaxpload();
+		bbus_prot_setmaxpload(BBUS_MAXPLOADSIZE);
+
+		__bbus_prot_rcvctx_init(&ctx);
+		BBUSUNIT_ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM,
+							0, sock));
+
+		/* Only the header is needed to reject the message. */
+		bbus_hdr_build(&hdr, BBUS_MSGTYPE_CLICALL, BBUS_PROT_EGOOD);
+		bbus_hdr_setpsize(&hdr, BBUS_MAXPLOADSIZE + 1);
+		hdrsize = __bbus_prot_hdrencode(&hdr, wirehdr);
+		BBUSUNIT_ASSERT_EQ((ssize_t)hdrsize,
+					write(sock[0], wirehdr, hdrsize));
+
+		r = __bbus_prot_tryrecvmsg(sock[1], &ctx, &msg, &msgsize);
+		BBUSUNIT_ASSERT_EQ(-1, r);
+		BBUSUNIT_ASSERT_EQ(BBUS_EMSGTOOBIG, bbus_lasterror());
+
+	BBUSUNIT_FINALLY;
+
+		bbus_prot_setmaxpload(saved);
+		bbus_free(msg);
+		__bbus_prot_rcvctx_free(&ctx);
+		close(sock[0]);
+		close(sock[1]);
+
+	BBUSUNIT_ENDTEST;
+}
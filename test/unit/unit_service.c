@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2013 Bartosz Golaszewski <bartekgola@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bbus-unit.h"
+#include "../../bin/bbusd/service.h"
+#include <busybus.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* Must match the handle layout in bin/bbusd/service.c. */
+#define HANDLE_IDXMASK		0xFFFFFU
+#define HANDLE_GENMASK		0xFFFU
+#define METHOD_PATH		"bbus.unit.srvc.meth"
+
+static struct bbusd_remote_method* mkmethod(struct bbusd_clientlist_elem* srvc)
+{
+	struct bbusd_remote_method* mthd;
+
+	mthd = bbusd_alloc_remote_method();
+	if (mthd == NULL)
+		return NULL;
+
+	mthd->type = BBUSD_METHOD_REMOTE;
+	mthd->srvc = srvc;
+
+	return mthd;
+}
+
+/*
+ * A handle resolved before the service went away must not reach the method
+ * registered in the same slot afterwards - bbusd answers calls made with it
+ * with BBUS_PROT_ESTALEHANDLE.
+ */
+BBUSUNIT_DEFINE_TEST(service_stale_handle)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbusd_clientlist_elem srvc1 = { NULL, NULL, NULL };
+		struct bbusd_clientlist_elem srvc2 = { NULL, NULL, NULL };
+		struct bbusd_remote_method* mthd1;
+		struct bbusd_remote_method* mthd2;
+		bbus_method_handle oldhandle;
+		bbus_method_handle newhandle;
+		const char* path = NULL;
+		int r;
+
+		bbusd_init_service_map();
+
+		mthd1 = mkmethod(&srvc1);
+		BBUSUNIT_ASSERT_NOTNULL(mthd1);
+		r = bbusd_insert_method(METHOD_PATH,
+					(struct bbusd_method*)mthd1);
+		BBUSUNIT_ASSERT_EQ(0, r);
+
+		oldhandle = bbusd_method_gethandle(METHOD_PATH);
+		BBUSUNIT_ASSERT_NOTEQ(BBUS_METHOD_NOHANDLE, oldhandle);
+		BBUSUNIT_ASSERT_EQ((struct bbusd_method*)mthd1,
+				bbusd_method_byhandle(oldhandle, &path));
+		BBUSUNIT_ASSERT_STREQ(METHOD_PATH, path);
+
+		bbusd_remove_srvc_methods(&srvc1);
+		BBUSUNIT_ASSERT_EQ(BBUS_METHOD_NOHANDLE,
+				bbusd_method_gethandle(METHOD_PATH));
+		BBUSUNIT_ASSERT_NULL(bbusd_method_byhandle(oldhandle, NULL));
+
+		mthd2 = mkmethod(&srvc2);
+		BBUSUNIT_ASSERT_NOTNULL(mthd2);
+		r = bbusd_insert_method(METHOD_PATH,
+					(struct bbusd_method*)mthd2);
+		BBUSUNIT_ASSERT_EQ(0, r);
+
+		newhandle = bbusd_method_gethandle(METHOD_PATH);
+		BBUSUNIT_ASSERT_EQ(oldhandle & HANDLE_IDXMASK,
+					newhandle & HANDLE_IDXMASK);
+		BBUSUNIT_ASSERT_NOTEQ(oldhandle, newhandle);
+		BBUSUNIT_ASSERT_NULL(bbusd_method_byhandle(oldhandle, NULL));
+		BBUSUNIT_ASSERT_EQ((struct bbusd_method*)mthd2,
+				bbusd_method_byhandle(newhandle, NULL));
+
+	BBUSUNIT_FINALLY;
+
+		bbusd_free_service_map();
+
+	BBUSUNIT_ENDTEST;
+}
+
+/*
+ * A service registering and unregistering the same method over and over
+ * again gets the same slot every time. Once the slot's generation wraps,
+ * the slot must be retired rather than hand out the first handle again.
+ */
+BBUSUNIT_DEFINE_TEST(service_handle_wrap)
+{
+	BBUSUNIT_BEGINTEST;
+
+		struct bbusd_clientlist_elem srvc = { NULL, NULL, NULL };
+		struct bbusd_remote_method* mthd;
+		bbus_method_handle firsthandle = BBUS_METHOD_NOHANDLE;
+		bbus_method_handle handle;
+		int savedout = -1;
+		int devnull;
+		unsigned i;
+		int r;
+
+		bbusd_init_service_map();
+
+		/* Don't flood the output with 'Method unregistered' lines. */
+		fflush(stdout);
+		savedout = dup(STDOUT_FILENO);
+		devnull = open("/dev/null", O_WRONLY);
+		if (savedout >= 0 && devnull >= 0)
+			dup2(devnull, STDOUT_FILENO);
+		if (devnull >= 0)
+			close(devnull);
+
+		for (i = 0; i <= HANDLE_GENMASK; ++i) {
+			mthd = mkmethod(&srvc);
+			BBUSUNIT_ASSERT_NOTNULL(mthd);
+			r = bbusd_insert_method(METHOD_PATH,
+					(struct bbusd_method*)mthd);
+			BBUSUNIT_ASSERT_EQ(0, r);
+
+			handle = bbusd_method_gethandle(METHOD_PATH);
+			BBUSUNIT_ASSERT_NOTEQ(BBUS_METHOD_NOHANDLE, handle);
+			if (i == 0)
+				firsthandle = handle;
+			else
+				BBUSUNIT_ASSERT_NOTEQ(firsthandle, handle);
+
+			BBUSUNIT_ASSERT_EQ((struct bbusd_method*)mthd,
+					bbusd_method_byhandle(handle, NULL));
+			if (i > 0) {
+				BBUSUNIT_ASSERT_NULL(bbusd_method_byhandle(
+							firsthandle, NULL));
+			}
+
+			bbusd_remove_srvc_methods(&srvc);
+		}
+
+		/* All generations of the first slot have been used up. */
+		BBUSUNIT_ASSERT_NOTEQ(firsthandle & HANDLE_IDXMASK,
+					handle & HANDLE_IDXMASK);
+
+	BBUSUNIT_FINALLY;
+
+		if (savedout >= 0) {
+			fflush(stdout);
+			dup2(savedout, STDOUT_FILENO);
+			close(savedout);
+		}
+		bbusd_free_service_map();
+
+	BBUSUNIT_ENDTEST;
+}